@@ -0,0 +1,161 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<size_t> numAllocations(0);
+
+    void countAllocation()
+    {
+        numAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+size_t AllocationCounter::count()
+{
+    return numAllocations.load(std::memory_order_relaxed);
+}
+
+#if defined(__GLIBC__)
+
+// The malloc family of the executable takes the place of that of the C library in the shared libraries as well, so Qt,
+// HDF5 and operator new are all counted. The calls are forwarded to the allocator of the C library.
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* pointer, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+
+    void* malloc(size_t size)
+    {
+        countAllocation();
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        countAllocation();
+        return __libc_calloc(count, size);
+    }
+
+    // A resize may move the block, so it counts as an allocation
+    void* realloc(void* pointer, size_t size)
+    {
+        if (size > 0)
+            countAllocation();
+        return __libc_realloc(pointer, size);
+    }
+
+    void* memalign(size_t alignment, size_t size)
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** result, size_t alignment, size_t size)
+    {
+        if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+
+        countAllocation();
+        void* pointer = __libc_memalign(alignment, size);
+        if (pointer == nullptr)
+            return ENOMEM;
+
+        *result = pointer;
+        return 0;
+    }
+}
+
+bool AllocationCounter::countsMalloc()
+{
+    return true;
+}
+
+#else
+
+namespace
+{
+    void* allocate(size_t size)
+    {
+        countAllocation();
+
+        void* pointer = std::malloc(size > 0 ? size : 1);
+        if (pointer == nullptr)
+            throw std::bad_alloc();
+        return pointer;
+    }
+
+    void* allocateAligned(size_t size, std::align_val_t alignment)
+    {
+        countAllocation();
+
+        const size_t align = static_cast<size_t>(alignment);
+#if defined(_WIN32)
+        void* pointer = _aligned_malloc(size > 0 ? size : 1, align);
+#else
+        // aligned_alloc requires the size to be a multiple of the alignment
+        const size_t roundedSize = ((size > 0 ? size : 1) + align - 1) / align * align;
+        void* pointer = std::aligned_alloc(align, roundedSize);
+#endif
+        if (pointer == nullptr)
+            throw std::bad_alloc();
+        return pointer;
+    }
+
+    void freeAligned(void* pointer)
+    {
+#if defined(_WIN32)
+        _aligned_free(pointer);
+#else
+        std::free(pointer);
+#endif
+    }
+}
+
+// Without a replaceable malloc only operator new is counted, the allocations of Qt and the C libraries are not
+bool AllocationCounter::countsMalloc()
+{
+    return false;
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); }
+    catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); }
+    catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { freeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { freeAligned(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { freeAligned(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { freeAligned(pointer); }
+
+#endif
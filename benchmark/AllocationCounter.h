@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts the heap allocations of the process. With glibc the malloc family is replaced, which also counts the
+// allocations of Qt and the other shared libraries, elsewhere only the global operator new is replaced. It is only
+// linked into the benchmark executables, the plugin and the core library keep the default allocator.
+namespace AllocationCounter
+{
+    // Number of allocations of all threads since the process started
+    size_t count();
+
+    // Whether allocations with malloc are counted, otherwise only operator new calls are and the counts of stages that
+    // allocate through Qt or the C libraries are meaningless
+    bool countsMalloc();
+}
@@ -0,0 +1,351 @@
+// Performance regression gate. Generates a synthetic dataset, runs the end-to-end benchmark and the micro-benchmarks
+// on it and compares the time, peak memory and allocation count of every stage and kernel with a stored baseline.
+// Exits with 1 when a metric exceeds its baseline by more than the tolerance, e.g.
+//   PatchSeqBenchmarkGate --baseline benchmark/baseline.json --work-dir gate
+// After an intended change in performance, or on a new reference machine, --update-baseline rewrites the metrics.
+// Metrics only compare with runs of the same build on the same machine, so a baseline without any is bootstrapped:
+// the first run records them and passes.
+//
+// The baseline holds the generator and micro-benchmark arguments, the number of end-to-end repetitions, default
+// tolerances per metric and the metrics themselves. A metric may exceed its baseline value by relative * baseline +
+// absolute, and an entry can override the defaults with its own "tolerances" object.
+
+#include "json.hpp"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QProcess>
+#include <QTextStream>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Ordered, so the rewritten baseline keeps its layout
+using json = nlohmann::ordered_json;
+
+namespace
+{
+    // Metrics compared against the baseline, for all of them lower is better
+    const char* TIME = "timeMs";
+    const char* PEAK_MEMORY = "peakBytes";
+    const char* ALLOCATIONS = "allocations";
+
+    const char* const METRICS[] = { TIME, PEAK_MEMORY, ALLOCATIONS };
+
+    // Repeated measurements of the metrics of every stage and kernel, by key
+    using Samples = std::map<std::string, std::map<std::string, std::vector<double>>>;
+
+    bool runProcess(const QString& program, const QStringList& arguments, const QProcessEnvironment& environment)
+    {
+        // The benchmark executables are built next to the gate
+        const QString programPath = QDir(QCoreApplication::applicationDirPath()).filePath(program);
+
+        QProcess process;
+        process.setProcessEnvironment(environment);
+        process.setProcessChannelMode(QProcess::ForwardedChannels);
+        process.start(programPath, arguments);
+
+        if (!process.waitForFinished(-1) || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+        {
+            qCritical() << "Failed to run" << programPath << arguments;
+            return false;
+        }
+        return true;
+    }
+
+    bool readJson(const QString& filePath, json& result)
+    {
+        std::ifstream file(filePath.toStdString());
+        if (!file)
+            return false;
+
+        result = json::parse(file, nullptr, false);
+        return !result.is_discarded();
+    }
+
+    QStringList toArguments(const json& list)
+    {
+        QStringList arguments;
+        for (const json& argument : list)
+            arguments << QString::fromStdString(argument.get<std::string>());
+        return arguments;
+    }
+
+    bool runEndToEnd(const QDir& workDir, int repetition, Samples& samples)
+    {
+        const QDir datasetDir(workDir.filePath("dataset"));
+        const QString outputPath = workDir.filePath(QString("end_to_end_%1.json").arg(repetition));
+        const QString memoryReportPath = workDir.filePath(QString("memory_%1.json").arg(repetition));
+
+        // The memory profiler samples the peak resident set size of every stage
+        QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+        environment.insert("PATCHSEQ_MEMORY_REPORT", memoryReportPath);
+
+        QStringList arguments;
+        arguments << "--metadata" << datasetDir.filePath("metadata.csv")
+                  << "--transcriptomics" << datasetDir.filePath("transcriptomics.csv")
+                  << "--ephys" << datasetDir.filePath("ephys.csv")
+                  << "--morphology" << datasetDir.filePath("morphology.csv")
+                  << "--morphologies" << datasetDir.filePath("SWC")
+                  << "--traces" << datasetDir.filePath("NWB")
+                  << "--failed-sweeps" << datasetDir.filePath("failed_sweeps.json")
+                  << "--output" << outputPath;
+
+        if (!runProcess("PatchSeqBenchmark", arguments, environment))
+            return false;
+
+        json timings;
+        json memoryReport;
+        if (!readJson(outputPath, timings) || !readJson(memoryReportPath, memoryReport))
+        {
+            qCritical() << "Failed to read the end-to-end results from" << workDir.path();
+            return false;
+        }
+
+        for (const json& stage : timings["stages"])
+        {
+            auto& stageSamples = samples["endToEnd/" + stage["name"].get<std::string>()];
+            stageSamples[TIME].push_back(stage["milliseconds"].get<double>());
+            if (stage.contains("allocations"))
+                stageSamples[ALLOCATIONS].push_back(stage["allocations"].get<double>());
+        }
+
+        // Nested stages of the loader itself are part of the benchmark stages
+        for (const json& stage : memoryReport["stages"])
+        {
+            if (stage["depth"].get<int>() == 0)
+                samples["endToEnd/" + stage["name"].get<std::string>()][PEAK_MEMORY].push_back(stage["peakBytes"].get<double>());
+        }
+
+        auto& totalSamples = samples["endToEnd/Total"];
+        totalSamples[TIME].push_back(timings["totalMilliseconds"].get<double>());
+        if (timings.contains("totalAllocations"))
+            totalSamples[ALLOCATIONS].push_back(timings["totalAllocations"].get<double>());
+        totalSamples[PEAK_MEMORY].push_back(timings["peakRssBytes"].get<double>());
+
+        return true;
+    }
+
+    bool runMicroBenchmarks(const QDir& workDir, const QStringList& extraArguments, Samples& samples)
+    {
+        const QString outputPath = workDir.filePath("micro_benchmarks.json");
+
+        if (!runProcess("PatchSeqMicroBenchmarks", QStringList() << "--output" << outputPath << extraArguments, QProcessEnvironment::systemEnvironment()))
+            return false;
+
+        json results;
+        if (!readJson(outputPath, results))
+        {
+            qCritical() << "Failed to read the micro-benchmark results from" << outputPath;
+            return false;
+        }
+
+        for (const json& benchmark : results["benchmarks"])
+        {
+            auto& benchmarkSamples = samples["micro/" + benchmark["name"].get<std::string>() + " " + benchmark["parameters"].dump()];
+            benchmarkSamples[TIME].push_back(benchmark["minMs"].get<double>());
+            if (benchmark.contains("allocationsPerIteration"))
+                benchmarkSamples[ALLOCATIONS].push_back(benchmark["allocationsPerIteration"].get<double>());
+        }
+
+        return true;
+    }
+
+    // Other load on the machine only makes a run slower, so the fastest repetition is compared, and the median of the
+    // memory and allocation metrics
+    json summarize(const Samples& samples)
+    {
+        json metrics = json::object();
+        for (const auto& [key, keySamples] : samples)
+        {
+            for (auto [metric, values] : keySamples)
+            {
+                std::sort(values.begin(), values.end());
+                metrics[key][metric] = metric == TIME ? values.front() : values[values.size() / 2];
+            }
+        }
+        return metrics;
+    }
+
+    // Entries may only hold their tolerances until the metrics are recorded
+    bool hasMetrics(const json& baseline)
+    {
+        for (const auto& [key, entry] : baseline["metrics"].items())
+        {
+            for (const char* metric : METRICS)
+            {
+                if (entry.contains(metric))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    QString formatValue(const std::string& metric, double value)
+    {
+        if (metric == PEAK_MEMORY)
+            return QString::number(value / (1024.0 * 1024.0), 'f', 1) + " MB";
+        if (metric == TIME)
+            return QString::number(value, 'f', 3) + " ms";
+        return QString::number(value, 'f', 0);
+    }
+
+    // Prints every metric of the baseline next to its current value and returns the number of regressions
+    int compare(const json& baseline, const json& current)
+    {
+        const json& defaultTolerances = baseline["tolerances"];
+
+        QTextStream out(stdout);
+        out << "\n" << QString("Benchmark").leftJustified(72) << QString("Metric").leftJustified(12)
+            << QString("Baseline").rightJustified(14) << QString("Current").rightJustified(14) << QString("Change").rightJustified(10) << "\n";
+
+        int numRegressions = 0;
+        for (const auto& [key, entry] : baseline["metrics"].items())
+        {
+            for (const char* metric : METRICS)
+            {
+                if (!entry.contains(metric))
+                    continue;
+
+                const double baselineValue = entry[metric].get<double>();
+                out << QString::fromStdString(key).leftJustified(72) << QString(metric).leftJustified(12) << formatValue(metric, baselineValue).rightJustified(14);
+
+                // Allocations are only counted where malloc can be replaced
+                if (current.contains(key) && !current[key].contains(metric) && std::string(metric) == ALLOCATIONS)
+                {
+                    out << QString("not measured").rightJustified(14) << "\n";
+                    continue;
+                }
+
+                if (!current.contains(key) || !current[key].contains(metric))
+                {
+                    out << QString("missing").rightJustified(14) << "  REGRESSION\n";
+                    numRegressions++;
+                    continue;
+                }
+
+                json tolerance = defaultTolerances.value(metric, json::object());
+                if (entry.contains("tolerances") && entry["tolerances"].contains(metric))
+                    tolerance.update(entry["tolerances"][metric]);
+
+                const double currentValue = current[key][metric].get<double>();
+                const double limit = baselineValue * (1.0 + tolerance.value("relative", 0.0)) + tolerance.value("absolute", 0.0);
+                const double change = baselineValue > 0 ? (currentValue / baselineValue - 1.0) * 100.0 : 0.0;
+
+                out << formatValue(metric, currentValue).rightJustified(14) << (QString::number(change, 'f', 1) + "%").rightJustified(10);
+                if (currentValue > limit)
+                {
+                    out << "  REGRESSION";
+                    numRegressions++;
+                }
+                out << "\n";
+            }
+        }
+
+        for (const auto& [key, entry] : current.items())
+        {
+            if (!baseline["metrics"].contains(key))
+                out << QString::fromStdString(key).leftJustified(72) << "not in the baseline\n";
+        }
+
+        out.flush();
+        return numRegressions;
+    }
+
+    bool writeBaseline(const QString& filePath, json baseline, const json& current)
+    {
+        // Entries keep their own tolerances
+        json metrics = current;
+        for (auto& [key, entry] : metrics.items())
+        {
+            if (baseline["metrics"].contains(key) && baseline["metrics"][key].contains("tolerances"))
+                entry["tolerances"] = baseline["metrics"][key]["tolerances"];
+        }
+        baseline["metrics"] = metrics;
+
+        std::ofstream file(filePath.toStdString());
+        if (!file)
+            return false;
+
+        file << baseline.dump(2) << "\n";
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("PatchSeqBenchmarkGate");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs the benchmarks on a synthetic dataset and fails when they regress against a baseline.");
+    parser.addHelpOption();
+
+    QCommandLineOption baselineOption("baseline", "Baseline JSON with the settings, tolerances and reference metrics.", "file");
+    QCommandLineOption workDirOption("work-dir", "Directory for the dataset and the benchmark results.", "directory", "benchmark_gate");
+    QCommandLineOption updateOption("update-baseline", "Writes the current metrics to the baseline instead of comparing them.");
+
+    parser.addOptions({ baselineOption, workDirOption, updateOption });
+    parser.process(app);
+
+    json baseline;
+    if (!parser.isSet(baselineOption) || !readJson(parser.value(baselineOption), baseline))
+    {
+        qCritical() << "No readable baseline given, use --baseline";
+        return 1;
+    }
+
+    QDir workDir(parser.value(workDirOption));
+    if (!workDir.mkpath("."))
+    {
+        qCritical() << "Failed to create" << workDir.path();
+        return 1;
+    }
+
+    const QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+
+    // The dataset is deterministic, so it is regenerated to match the current generator arguments
+    if (!runProcess("PatchSeqGenerateDataset", QStringList() << "--output" << workDir.filePath("dataset") << toArguments(baseline["dataset"]), environment))
+        return 1;
+
+    Samples samples;
+
+    const int numRepetitions = std::max(1, baseline.value("repetitions", 1));
+    for (int repetition = 0; repetition < numRepetitions; repetition++)
+    {
+        if (!runEndToEnd(workDir, repetition, samples))
+            return 1;
+    }
+
+    if (!runMicroBenchmarks(workDir, toArguments(baseline["microBenchmarks"]), samples))
+        return 1;
+
+    const json current = summarize(samples);
+
+    if (parser.isSet(updateOption) || !hasMetrics(baseline))
+    {
+        if (!writeBaseline(parser.value(baselineOption), baseline, current))
+        {
+            qCritical() << "Failed to write the baseline to" << parser.value(baselineOption);
+            return 1;
+        }
+
+        qInfo() << (parser.isSet(updateOption) ? "Updated the baseline" : "Recorded a new baseline") << parser.value(baselineOption) << "with" << current.size() << "benchmarks";
+        return 0;
+    }
+
+    const int numRegressions = compare(baseline, current);
+    if (numRegressions > 0)
+    {
+        qCritical() << numRegressions << "metrics regressed beyond their tolerance";
+        return 1;
+    }
+
+    qInfo() << "No regressions against" << parser.value(baselineOption);
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Writes a synthetic patch-seq dataset at a chosen scale, for benchmarking the loader without sharing donor data.
+// The output directory can be passed to PatchSeqBenchmark, e.g.
+//   PatchSeqGenerateDataset --output synthetic --cells 100000 --seed 3
+//   PatchSeqBenchmark --metadata synthetic/metadata.csv --transcriptomics synthetic/transcriptomics.csv ...
+
+#include "SyntheticDataset.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <type_traits>
+
+namespace
+{
+    // Reads an option into a config field when it is given
+    template<typename T>
+    bool readOption(const QCommandLineParser& parser, const QCommandLineOption& option, T& value)
+    {
+        if (!parser.isSet(option))
+            return true;
+
+        bool ok = false;
+        if constexpr (std::is_floating_point_v<T>)
+            value = static_cast<T>(parser.value(option).toDouble(&ok));
+        else
+            value = static_cast<T>(parser.value(option).toULongLong(&ok));
+
+        if (!ok)
+            qCritical() << "Invalid value for --" + option.names().first() << parser.value(option);
+        return ok;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("PatchSeqGenerateDataset");
+
+    SyntheticDatasetConfig config;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Writes a deterministic synthetic patch-seq dataset.");
+    parser.addHelpOption();
+
+    QCommandLineOption outputOption("output", "Output directory.", "directory");
+    QCommandLineOption seedOption("seed", "Random seed.", "number", QString::number(config.seed));
+    QCommandLineOption cellsOption("cells", "Number of cells.", "number", QString::number(config.numCells));
+    QCommandLineOption groupsOption("groups", "Number of cell types.", "number", QString::number(config.numGroups));
+    QCommandLineOption genesOption("genes", "Number of genes.", "number", QString::number(config.numGenes));
+    QCommandLineOption ephysFeaturesOption("ephys-features", "Number of electrophysiology features.", "number", QString::number(config.numEphysFeatures));
+    QCommandLineOption morphologyFeaturesOption("morphology-features", "Number of morphology features.", "number", QString::number(config.numMorphologyFeatures));
+    QCommandLineOption swcCellsOption("swc-cells", "Number of cells with an SWC file.", "number", QString::number(config.numSwcCells));
+    QCommandLineOption swcNodesOption("swc-nodes", "Number of SWC nodes per cell.", "number", QString::number(config.numSwcNodesPerCell));
+    QCommandLineOption nwbCellsOption("nwb-cells", "Number of cells with an NWB file.", "number", QString::number(config.numNwbCells));
+    QCommandLineOption sweepsOption("sweeps", "Number of sweeps per cell.", "number", QString::number(config.numSweepsPerCell));
+    QCommandLineOption samplesOption("samples", "Number of samples per sweep.", "number", QString::number(config.numSamplesPerSweep));
+    QCommandLineOption missingOption("missing", "Fraction of missing feature values.", "fraction", QString::number(config.missingFraction));
+    QCommandLineOption missingExpressionOption("missing-expression", "Fraction of missing gene counts.", "fraction", QString::number(config.expressionMissingFraction));
+    QCommandLineOption duplicatesOption("duplicates", "Fraction of duplicated rows.", "fraction", QString::number(config.duplicateFraction));
+
+    parser.addOptions({ outputOption, seedOption, cellsOption, groupsOption, genesOption, ephysFeaturesOption, morphologyFeaturesOption,
+                        swcCellsOption, swcNodesOption, nwbCellsOption, sweepsOption, samplesOption, missingOption, missingExpressionOption, duplicatesOption });
+    parser.process(app);
+
+    if (!parser.isSet(outputOption))
+    {
+        qCritical() << "No output directory given, use --output";
+        return 1;
+    }
+
+    bool ok = readOption(parser, seedOption, config.seed)
+           && readOption(parser, cellsOption, config.numCells)
+           && readOption(parser, groupsOption, config.numGroups)
+           && readOption(parser, genesOption, config.numGenes)
+           && readOption(parser, ephysFeaturesOption, config.numEphysFeatures)
+           && readOption(parser, morphologyFeaturesOption, config.numMorphologyFeatures)
+           && readOption(parser, swcCellsOption, config.numSwcCells)
+           && readOption(parser, swcNodesOption, config.numSwcNodesPerCell)
+           && readOption(parser, nwbCellsOption, config.numNwbCells)
+           && readOption(parser, sweepsOption, config.numSweepsPerCell)
+           && readOption(parser, samplesOption, config.numSamplesPerSweep)
+           && readOption(parser, missingOption, config.missingFraction)
+           && readOption(parser, missingExpressionOption, config.expressionMissingFraction)
+           && readOption(parser, duplicatesOption, config.duplicateFraction);
+
+    if (!ok)
+        return 1;
+
+    if (config.numGroups == 0 || config.numSwcNodesPerCell == 0)
+    {
+        qCritical() << "The number of groups and SWC nodes per cell should be at least 1";
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    WriteSyntheticDataset(config, parser.value(outputOption));
+
+    qDebug() << "Wrote synthetic dataset to" << parser.value(outputOption) << "in" << timer.elapsed() << "ms";
+
+    return 0;
+}
@@ -0,0 +1,419 @@
+// Micro-benchmarks of the loader's hot kernels on synthetic inputs of a few sizes. Every benchmark reports the median
+// time of an iteration, its throughput in MB/s and items/s and its heap allocations, and the results are written as
+// JSON so they can be compared across releases, e.g.
+//   PatchSeqMicroBenchmarks --output results.json --filter Spikes --scale 2
+
+#include "SyntheticDataset.h"
+#include "AllocationCounter.h"
+
+#include "CSVReader.h"
+#include "DataFrame.h"
+#include "MatrixData.h"
+#include "MatrixDataLoader.h"
+#include "json.hpp"
+
+#include "Morphology/SWCLoader.h"
+#include "Electrophysiology/SpikeDetector.h"
+#include "Electrophysiology/SpikeExtractor.h"
+#include "Electrophysiology/SweepProcessing.h"
+#include "Electrophysiology/TracePyramid.h"
+#include "Electrophysiology/EphysTypes.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace
+{
+    // Results are accumulated here so the compiler can't discard the work of a kernel
+    volatile size_t sink = 0;
+
+    // Sweep indices of the synthetic stimulus sets, see SyntheticDataset.cpp
+    constexpr size_t RHEO_SWEEP = 1;
+    constexpr size_t SUPRATHRESHOLD_SWEEP = 2;
+
+    class BenchmarkRunner
+    {
+    public:
+        BenchmarkRunner(double minSeconds, const QString& filter) :
+            _minSeconds(minSeconds),
+            _filter(filter)
+        {
+
+        }
+
+        bool isSelected(const QString& name) const
+        {
+            return _filter.isEmpty() || name.contains(_filter, Qt::CaseInsensitive);
+        }
+
+        // Runs setup and kernel until at least minSeconds were spent in the kernel, only the kernel is timed.
+        // Bytes and items are per iteration, bytes can be 0 for kernels without a natural input size.
+        template<typename Setup, typename Kernel>
+        void run(const QString& name, const json& parameters, double bytes, double items, const char* itemUnit, Setup setup, Kernel kernel)
+        {
+            if (!isSelected(name))
+                return;
+
+            using Clock = std::chrono::steady_clock;
+
+            // Warm up caches and allocators
+            setup();
+            kernel();
+
+            std::vector<double> seconds;
+            double totalSeconds = 0;
+            size_t allocations = 0;
+            while ((totalSeconds < _minSeconds || seconds.size() < MIN_ITERATIONS) && seconds.size() < MAX_ITERATIONS)
+            {
+                setup();
+                const size_t allocationsBegin = AllocationCounter::count();
+                Clock::time_point begin = Clock::now();
+                kernel();
+                double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+                allocations += AllocationCounter::count() - allocationsBegin;
+
+                seconds.push_back(elapsed);
+                totalSeconds += elapsed;
+            }
+
+            std::sort(seconds.begin(), seconds.end());
+            const double median = seconds[seconds.size() / 2];
+
+            json result = {
+                { "name", name.toStdString() },
+                { "parameters", parameters },
+                { "iterations", seconds.size() },
+                { "medianMs", median * 1e3 },
+                { "minMs", seconds.front() * 1e3 },
+                { "maxMs", seconds.back() * 1e3 },
+                { "itemUnit", itemUnit },
+                { "itemsPerSecond", items / median }
+            };
+            if (AllocationCounter::countsMalloc())
+                result["allocationsPerIteration"] = allocations / seconds.size();
+            if (bytes > 0)
+                result["megabytesPerSecond"] = bytes / median / 1e6;
+
+            QTextStream out(stdout);
+            out << name.leftJustified(40) << QString::fromStdString(parameters.dump()).leftJustified(28)
+                << QString::number(median * 1e3, 'f', 3).rightJustified(12) << " ms"
+                << QString::number(items / median, 'g', 4).rightJustified(12) << " " << itemUnit << "/s";
+            if (bytes > 0)
+                out << QString::number(bytes / median / 1e6, 'f', 1).rightJustified(10) << " MB/s";
+            out << "\n";
+            out.flush();
+
+            _results.push_back(std::move(result));
+        }
+
+        const json& getResults() const { return _results; }
+
+    private:
+        static constexpr size_t MIN_ITERATIONS = 3;
+        static constexpr size_t MAX_ITERATIONS = 1000;
+
+        double _minSeconds;
+        QString _filter;
+        json _results = json::array();
+    };
+
+    void noSetup() {}
+
+    SyntheticDatasetConfig makeConfig(size_t numCells, float missingFraction)
+    {
+        SyntheticDatasetConfig config;
+        config.numCells = numCells;
+        config.missingFraction = missingFraction;
+        config.duplicateFraction = 0;
+        return config;
+    }
+
+    void benchmarkParsing(BenchmarkRunner& runner, const QTemporaryDir& dir, size_t scale)
+    {
+        const std::pair<size_t, size_t> shapes[] = { { 1000 * scale, 100 }, { 10000 * scale, 100 }, { 2000 * scale, 2000 } };
+
+        for (auto [numRows, numCols] : shapes)
+        {
+            for (bool withMissingValues : { false, true })
+            {
+                const QString name = withMissingValues ? "MissingValueLineRead" : "FastLineRead";
+                if (!runner.isSelected(name) && !runner.isSelected("CSVReader::LoadCSV"))
+                    continue;
+
+                const QString filePath = dir.filePath(QString("features_%1_%2_%3.csv").arg(numRows).arg(numCols).arg(withMissingValues));
+                WriteSyntheticFeatureTable(makeConfig(numRows, withMissingValues ? 0.05f : 0.0f), filePath, numCols);
+
+                const double fileBytes = static_cast<double>(QFileInfo(filePath).size());
+                const json parameters = { { "rows", numRows }, { "cols", numCols } };
+
+                // The line readers are internal to MatrixDataLoader, they are measured through the path that uses them
+                runner.run(name, parameters, fileBytes, static_cast<double>(numRows * numCols), "values", noSetup, [&]()
+                {
+                    DataFrame df;
+                    MatrixData matrix;
+                    MatrixDataLoader(withMissingValues).LoadMatrixData(filePath, df, matrix, 2);
+                    sink = sink + matrix.numRows;
+                });
+
+                if (!withMissingValues)
+                    continue;
+
+                runner.run("CSVReader::LoadCSV", parameters, fileBytes, static_cast<double>(numRows), "rows", noSetup, [&]()
+                {
+                    std::vector<QString> headers;
+                    std::vector<std::vector<QString>> data;
+                    CSVReader().LoadCSV(filePath, headers, data);
+                    sink = sink + data.size();
+                });
+            }
+        }
+    }
+
+    void benchmarkSwc(BenchmarkRunner& runner, const QTemporaryDir& dir, size_t scale)
+    {
+        if (!runner.isSelected("SWCLoader::LoadSWC"))
+            return;
+
+        for (size_t numNodes : { 1000 * scale, 10000 * scale, 100000 * scale })
+        {
+            SyntheticDatasetConfig config;
+            config.numSwcNodesPerCell = numNodes;
+
+            const QString filePath = dir.filePath(QString("cell_%1.swc").arg(numNodes));
+            WriteSyntheticSwc(config, 0, filePath);
+
+            runner.run("SWCLoader::LoadSWC", { { "nodes", numNodes } }, static_cast<double>(QFileInfo(filePath).size()), static_cast<double>(numNodes), "nodes", noSetup, [&]()
+            {
+                SWCMorphology cellMorphology;
+                SWCLoader().LoadSWC(filePath, cellMorphology);
+                sink = sink + cellMorphology.ids.size();
+            });
+        }
+    }
+
+    void benchmarkSweeps(BenchmarkRunner& runner, size_t scale)
+    {
+        for (size_t numSamples : { 10000 * scale, 100000 * scale, 1000000 * scale })
+        {
+            SyntheticDatasetConfig config;
+            config.numSamplesPerSweep = numSamples;
+
+            const json parameters = { { "samples", numSamples } };
+            const double sweepBytes = static_cast<double>(numSamples * sizeof(float));
+
+            std::vector<float> current;
+            std::vector<float> voltage;
+            MakeSyntheticSweep(config, 0, SUPRATHRESHOLD_SWEEP, current, voltage);
+
+            Trace acquisition;
+            acquisition.ySeries = voltage;
+
+            runner.run("DetectSpikes", parameters, sweepBytes, static_cast<double>(numSamples), "samples", noSetup, [&]()
+            {
+                sink = sink + DetectSpikes(acquisition).size();
+            });
+
+            runner.run("ComputeStimulusEnvelopes", parameters, sweepBytes, static_cast<double>(numSamples), "samples", noSetup, [&]()
+            {
+                sink = sink + ComputeStimulusEnvelopes(current).size();
+            });
+
+            // Reduction to the display resolution of the loader
+            Trace decimated;
+            runner.run("DecimateMinMax", parameters, sweepBytes, static_cast<double>(numSamples), "samples", noSetup, [&]()
+            {
+                DecimateMinMax(acquisition, 8192, decimated);
+                sink = sink + decimated.ySeries.size();
+            });
+
+            runner.run("TracePyramid", parameters, sweepBytes, static_cast<double>(numSamples), "samples", noSetup, [&]()
+            {
+                sink = sink + TracePyramid(acquisition).numLevels();
+            });
+
+            // Zoomed into a tenth of the sweep on a full HD wide view
+            if (runner.isSelected("TracePyramid::query"))
+            {
+                const TracePyramid pyramid(acquisition);
+                Trace view;
+                runner.run("TracePyramid::query", parameters, 0, 1, "queries", noSetup, [&]()
+                {
+                    pyramid.query(0.45f * numSamples, 0.55f * numSamples, 1920, view);
+                    sink = sink + view.ySeries.size();
+                });
+            }
+
+            // The extractor searches for the stimulus onset from sample 10000 on, so it needs longer sweeps
+            if (numSamples <= 10000)
+                continue;
+
+            MakeSyntheticSweep(config, 0, RHEO_SWEEP, current, voltage);
+
+            Trace rheoStimulus;
+            rheoStimulus.ySeries = current;
+            Trace rheoAcquisition;
+            rheoAcquisition.ySeries = voltage;
+
+            runner.run("SpikeExtractor::DetectActionPotential", parameters, 2 * sweepBytes, static_cast<double>(numSamples), "samples", noSetup, [&]()
+            {
+                ActionPotentialTrace actionPotential = SpikeExtractor().DetectActionPotential(rheoStimulus, rheoAcquisition);
+                sink = sink + actionPotential.voltage.size();
+            });
+        }
+    }
+
+    void benchmarkMatrixData(BenchmarkRunner& runner, const QTemporaryDir& dir, size_t scale)
+    {
+        if (!runner.isSelected("MatrixData") && !runner.isSelected("DataFrame::subsetAndReorderByColumn"))
+            return;
+
+        for (size_t numRows : { 2000 * scale, 20000 * scale, 100000 * scale })
+        {
+            constexpr size_t numCols = 100;
+
+            const QString filePath = dir.filePath(QString("matrix_%1.csv").arg(numRows));
+            WriteSyntheticFeatureTable(makeConfig(numRows, 0.05f), filePath, numCols);
+
+            DataFrame df;
+            MatrixData source;
+            MatrixDataLoader(true).LoadMatrixData(filePath, df, source, 2);
+
+            const json parameters = { { "rows", numRows }, { "cols", numCols } };
+            const double matrixBytes = static_cast<double>(numRows * numCols * sizeof(float));
+            const double numValues = static_cast<double>(numRows * numCols);
+
+            MatrixData matrix;
+            auto copySource = [&]() { matrix = source; };
+
+            runner.run("MatrixData::imputeMissingValues(MEAN)", parameters, matrixBytes, numValues, "values", copySource, [&]()
+            {
+                matrix.imputeMissingValues(ImputationStrategy::MEAN);
+                sink = sink + matrix.numRows;
+            });
+
+            // The neighbour search makes KNN imputation much slower, only the smallest matrix is timed
+            if (numRows == 2000 * scale)
+            {
+                runner.run("MatrixData::imputeMissingValues(KNN)", parameters, matrixBytes, numValues, "values", copySource, [&]()
+                {
+                    matrix.imputeMissingValues(ImputationStrategy::KNN);
+                    sink = sink + matrix.numRows;
+                });
+            }
+
+            MatrixData imputed = source;
+            imputed.imputeMissingValues(ImputationStrategy::MEAN);
+
+            runner.run("MatrixData::standardize", parameters, matrixBytes, numValues, "values", [&]() { matrix = imputed; }, [&]()
+            {
+                matrix.standardize();
+                sink = sink + matrix.numRows;
+            });
+
+            // Removing every 100th row, as when dropping duplicates or cells without metadata
+            std::vector<int> rowsToDelete;
+            for (size_t row = 0; row < numRows; row += 100)
+                rowsToDelete.push_back(static_cast<int>(row));
+
+            runner.run("MatrixData::removeRows", parameters, matrixBytes, numValues, "values", copySource, [&]()
+            {
+                matrix.removeRows(rowsToDelete);
+                sink = sink + matrix.numRows;
+            });
+
+            // Align a shuffled subset of the cells with the full table, as when matching a modality to the metadata
+            std::vector<int> order(df.numRows());
+            std::iota(order.begin(), order.end(), 0);
+            std::reverse(order.begin(), order.end());
+            DataFrame subset = df;
+            subset.reorder(order);
+            subset.removeRows(rowsToDelete);
+
+            runner.run("DataFrame::subsetAndReorderByColumn", { { "rows", numRows } }, 0, static_cast<double>(subset.numRows()), "rows", noSetup, [&]()
+            {
+                DataFrame result = DataFrame::subsetAndReorderByColumn(df, subset, "cell_id", "cell_id");
+                sink = sink + result.numRows();
+            });
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("PatchSeqMicroBenchmarks");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Micro-benchmarks of the loader's hot kernels.");
+    parser.addHelpOption();
+
+    QCommandLineOption outputOption("output", "JSON file the results are written to.", "file", "micro_benchmarks.json");
+    QCommandLineOption filterOption("filter", "Only run the benchmarks whose name contains this text.", "text");
+    QCommandLineOption scaleOption("scale", "Multiplies the input sizes.", "factor", "1");
+    QCommandLineOption minTimeOption("min-time", "Minimum time spent in every benchmark, in seconds.", "seconds", "0.5");
+
+    parser.addOptions({ outputOption, filterOption, scaleOption, minTimeOption });
+    parser.process(app);
+
+    const size_t scale = std::max(1u, parser.value(scaleOption).toUInt());
+
+    QTemporaryDir dir;
+    if (!dir.isValid())
+    {
+        qCritical() << "Failed to create a temporary directory for the inputs";
+        return 1;
+    }
+
+    BenchmarkRunner runner(parser.value(minTimeOption).toDouble(), parser.value(filterOption));
+
+    benchmarkParsing(runner, dir, scale);
+    benchmarkSwc(runner, dir, scale);
+    benchmarkSweeps(runner, scale);
+    benchmarkMatrixData(runner, dir, scale);
+
+    json context = {
+        { "date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate).toStdString() },
+        { "threads", std::thread::hardware_concurrency() },
+        { "scale", scale },
+#ifdef NDEBUG
+        { "buildType", "release" },
+#else
+        { "buildType", "debug" },
+#endif
+#if defined(_MSC_VER)
+        { "compiler", "MSVC " + std::to_string(_MSC_VER) }
+#elif defined(__clang__)
+        { "compiler", "Clang " __clang_version__ }
+#elif defined(__GNUC__)
+        { "compiler", "GCC " __VERSION__ }
+#else
+        { "compiler", "unknown" }
+#endif
+    };
+
+    std::ofstream file(parser.value(outputOption).toStdString());
+    if (!file)
+    {
+        qCritical() << "Failed to write results to" << parser.value(outputOption);
+        return 1;
+    }
+
+    file << json({ { "context", context }, { "benchmarks", runner.getResults() } }).dump(2);
+    qInfo() << "Wrote" << runner.getResults().size() << "results to" << parser.value(outputOption);
+
+    return 0;
+}
@@ -0,0 +1,338 @@
+// Loads a patch-seq dataset end to end without ManiVault or a GUI and prints the time spent in every stage. The
+// processing stages are those of the plugin, only the datasets aren't created. Every input is optional, stages whose
+// inputs are missing are skipped. PATCHSEQ_TRACE and PATCHSEQ_MEMORY_REPORT
+// work as in the plugin. With --output the timings and heap allocation counts of the stages are also written as JSON.
+
+#include "DataFrame.h"
+#include "MatrixData.h"
+#include "PatchSeqStages.h"
+#include "CellRegistry.h"
+#include "FeatureNames.h"
+#include "LoadException.h"
+#include "Tracing.h"
+#include "MemoryProfiler.h"
+#include "Parallel.h"
+#include "AllocationCounter.h"
+#include "json.hpp"
+
+#include "Morphology/SWCLoader.h"
+#include "Electrophysiology/NWBLoader.h"
+#include "Electrophysiology/NWBLoadSession.h"
+#include "Electrophysiology/EphysTypes.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include <fstream>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace
+{
+    struct StageTiming
+    {
+        QString name;
+        qint64 milliseconds;
+        size_t allocations;
+        QString detail;
+    };
+
+    std::vector<StageTiming> timings;
+
+    // Times a stage and also traces and profiles it, so the benchmark reports line up with those of the plugin
+    class StageTimer
+    {
+    public:
+        StageTimer(const char* name, const QString& detail = QString()) :
+            _name(name),
+            _detail(detail),
+            _traceScope(name, detail),
+            _memoryStage(name),
+            _allocationsBegin(AllocationCounter::count())
+        {
+            _timer.start();
+        }
+
+        ~StageTimer()
+        {
+            timings.push_back({ _name, _timer.elapsed(), AllocationCounter::count() - _allocationsBegin, _detail });
+        }
+
+        void setDetail(const QString& detail) { _detail = detail; }
+
+    private:
+        QString _name;
+        QString _detail;
+        TraceScope _traceScope;
+        MemoryStage _memoryStage;
+        size_t _allocationsBegin;
+        QElapsedTimer _timer;
+    };
+
+    QString shape(const MatrixData& matrix)
+    {
+        return QString("%1 x %2").arg(matrix.numRows).arg(matrix.numCols);
+    }
+
+    void printTimings(qint64 totalMilliseconds)
+    {
+        QTextStream out(stdout);
+        out << "\n" << QString("Stage").leftJustified(24) << QString("Time (ms)").rightJustified(12) << "  Detail\n";
+        for (const StageTiming& timing : timings)
+            out << timing.name.leftJustified(24) << QString::number(timing.milliseconds).rightJustified(12) << "  " << timing.detail << "\n";
+        out << QString("Total").leftJustified(24) << QString::number(totalMilliseconds).rightJustified(12) << "\n";
+    }
+
+    bool writeTimings(const QString& filePath, qint64 totalMilliseconds, size_t totalAllocations)
+    {
+        json stages = json::array();
+        for (const StageTiming& timing : timings)
+        {
+            json stage = {
+                { "name", timing.name.toStdString() },
+                { "milliseconds", timing.milliseconds },
+                { "detail", timing.detail.toStdString() }
+            };
+            // Most stages allocate through Qt, so operator new counts alone are left out
+            if (AllocationCounter::countsMalloc())
+                stage["allocations"] = timing.allocations;
+            stages.push_back(stage);
+        }
+
+        std::ofstream file(filePath.toStdString());
+        if (!file)
+            return false;
+
+        json results = {
+            { "stages", stages },
+            { "totalMilliseconds", totalMilliseconds },
+            { "peakRssBytes", MemoryProfiler::peakRss() }
+        };
+        if (AllocationCounter::countsMalloc())
+            results["totalAllocations"] = totalAllocations;
+
+        file << results.dump(2);
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("PatchSeqBenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Loads a patch-seq dataset without a GUI and prints per-stage timings.");
+    parser.addHelpOption();
+
+    QCommandLineOption metadataOption("metadata", "Cell metadata CSV.", "file");
+    QCommandLineOption transcriptomicsOption("transcriptomics", "Gene expression CSV.", "file");
+    QCommandLineOption ephysOption("ephys", "Electrophysiology feature CSV.", "file");
+    QCommandLineOption morphologyOption("morphology", "Morphology feature CSV.", "file");
+    QCommandLineOption morphologiesOption("morphologies", "Directory of SWC reconstructions.", "directory");
+    QCommandLineOption tracesOption("traces", "Directory of NWB files.", "directory");
+    QCommandLineOption failedSweepsOption("failed-sweeps", "CSV of sweeps that failed quality control.", "file");
+    QCommandLineOption cellIdOption("cell-id", "Name of the cell identifier column.", "column", "cell_id");
+    QCommandLineOption clusterColumnsOption("cluster-columns", "Comma-separated metadata columns whose clusters get marker genes.", "columns", "Group_name,Subclass_name");
+    QCommandLineOption fileBackedThresholdOption("file-backed-threshold", "Gene expression files larger than this many bytes are parsed into a memory-mapped file.", "bytes");
+    QCommandLineOption matrixCacheOption("matrix-cache", "Directory the parsed values of file-backed gene expression are cached in.", "directory");
+    QCommandLineOption nwbThreadsOption("nwb-threads", "Maximum number of NWB files loaded at once.", "number", "8");
+    QCommandLineOption lazyTracesOption("lazy-traces", "Indexes the NWB files and only reads the sweeps of the first n of them.", "n");
+    QCommandLineOption outputOption("output", "JSON file the stage timings and allocation counts are written to.", "file");
+
+    parser.addOptions({ metadataOption, transcriptomicsOption, ephysOption, morphologyOption, morphologiesOption, tracesOption, failedSweepsOption, cellIdOption, clusterColumnsOption, fileBackedThresholdOption, matrixCacheOption, nwbThreadsOption, lazyTracesOption, outputOption });
+    parser.process(app);
+
+    // The defaults of the plugin, without an index cache so the neighbour search is always measured
+    StageSettings settings;
+    settings.cellIdTag = parser.value(cellIdOption);
+    if (parser.isSet(fileBackedThresholdOption))
+        settings.fileBackedMatrixThreshold = parser.value(fileBackedThresholdOption).toLongLong();
+    settings.matrixCacheDir = parser.value(matrixCacheOption);
+
+    const QString& cellIdTag = settings.cellIdTag;
+
+    QElapsedTimer totalTimer;
+    totalTimer.start();
+    const size_t allocationsBegin = AllocationCounter::count();
+
+    DataFrame metadataDf;
+    GeneExpression geneExpression;
+    FeatureData ephysFeatures;
+    FeatureData morphologyFeatures;
+
+    try
+    {
+        if (parser.isSet(metadataOption))
+        {
+            StageTimer stage("Metadata", parser.value(metadataOption));
+            metadataDf.readFromFile(parser.value(metadataOption));
+            metadataDf.removeDuplicateRows(cellIdTag);
+            stage.setDetail(QString("%1 cells").arg(metadataDf.numRows()));
+        }
+
+        if (parser.isSet(transcriptomicsOption))
+        {
+            {
+                StageTimer stage("Gene expression", parser.value(transcriptomicsOption));
+                LoadGeneExpression(parser.value(transcriptomicsOption), settings, geneExpression);
+                stage.setDetail(shape(geneExpression.matrix));
+            }
+
+            StageTimer stage("Gene expression embedding", QString("%1 components").arg(settings.numPcaComponents));
+            Embedding embedding;
+            EmbedGeneExpression(geneExpression.matrix, settings, embedding);
+        }
+
+        if (parser.isSet(ephysOption))
+        {
+            {
+                StageTimer stage("Ephys features", parser.value(ephysOption));
+                LoadEphysFeatures(parser.value(ephysOption), metadataDf, featuresToDelete, settings, ephysFeatures);
+                stage.setDetail(shape(ephysFeatures.matrix));
+            }
+
+            StageTimer stage("Ephys embedding");
+            Embedding embedding;
+            EmbedFeatures(ephysFeatures.matrix, settings, embedding);
+        }
+
+        if (parser.isSet(morphologyOption))
+        {
+            {
+                StageTimer stage("Morphology features", parser.value(morphologyOption));
+                LoadMorphologyFeatures(parser.value(morphologyOption), settings, morphologyFeatures);
+                stage.setDetail(shape(morphologyFeatures.matrix));
+            }
+
+            StageTimer stage("Morphology embedding");
+            Embedding embedding;
+            EmbedFeatures(morphologyFeatures.matrix, settings, embedding);
+        }
+
+        if (geneExpression.matrix.numRows > 0)
+        {
+            if (ephysFeatures.matrix.numRows > 0)
+            {
+                StageTimer stage("Gene-ephys correlation");
+                MatrixData correlations;
+                size_t numCells = CorrelateGenesWithFeatures(geneExpression, ephysFeatures, settings, correlations);
+                stage.setDetail(QString("%1 cells, %2").arg(numCells).arg(shape(correlations)));
+            }
+
+            if (morphologyFeatures.matrix.numRows > 0)
+            {
+                StageTimer stage("Gene-morphology correlation");
+                MatrixData correlations;
+                size_t numCells = CorrelateGenesWithFeatures(geneExpression, morphologyFeatures, settings, correlations);
+                stage.setDetail(QString("%1 cells, %2").arg(numCells).arg(shape(correlations)));
+            }
+        }
+
+        if (geneExpression.matrix.numRows > 0 && metadataDf.numRows() > 0)
+        {
+            StageTimer stage("Marker genes");
+            const QStringList clusterColumns = parser.value(clusterColumnsOption).split(',', Qt::SkipEmptyParts);
+            size_t numClusters = 0;
+            for (const QString& clusterColumn : clusterColumns)
+            {
+                ClusterMarkers clusterMarkers;
+                FindMarkerGenes(geneExpression, LookupClusterNames(geneExpression.df, metadataDf, cellIdTag, clusterColumn), settings, clusterMarkers);
+                numClusters += clusterMarkers.clusters.size();
+            }
+            stage.setDetail(QString("%1 clusters").arg(numClusters));
+        }
+
+        // The metadata references the feature rows of its cells instead of copying the features
+        if (metadataDf.numRows() > 0)
+        {
+            StageTimer stage("Metadata features");
+            CellRegistry cellRegistry;
+            std::vector<uint32_t> metadataCells = cellRegistry.registerCells(metadataDf[cellIdTag]);
+            RowMap ephysRows = cellRegistry.mapRows(metadataCells, cellRegistry.registerCells(ephysFeatures.df[cellIdTag]));
+            RowMap morphologyRows = cellRegistry.mapRows(metadataCells, cellRegistry.registerCells(morphologyFeatures.df[cellIdTag]));
+            stage.setDetail(QString("%1 ephys rows, %2 morphology rows").arg(ephysRows.rows.size()).arg(morphologyRows.rows.size()));
+        }
+
+        if (parser.isSet(morphologiesOption))
+        {
+            StageTimer stage("SWC morphologies", parser.value(morphologiesOption));
+            QDir morphologyDir(parser.value(morphologiesOption));
+            QStringList swcFiles = morphologyDir.entryList(QStringList() << "*.swc" << "*.SWC", QDir::Files);
+
+            std::vector<SWCMorphology> cellMorphologies(swcFiles.size());
+            SWCLoader loader;
+            for (int i = 0; i < swcFiles.size(); i++)
+                loader.LoadSWC(morphologyDir.filePath(swcFiles[i]), cellMorphologies[i]);
+            stage.setDetail(QString("%1 files").arg(swcFiles.size()));
+        }
+
+        if (parser.isSet(tracesOption))
+        {
+            QDir tracesDir(parser.value(tracesOption));
+            QStringList nwbFiles = tracesDir.entryList(QStringList() << "*.nwb" << "*.NWB", QDir::Files);
+
+            QStringList nwbFilePaths;
+            for (const QString& fileName : nwbFiles)
+                nwbFilePaths.append(tracesDir.filePath(fileName));
+
+            const unsigned int numThreads = std::min(numWorkerThreads(), std::max(1u, parser.value(nwbThreadsOption).toUInt()));
+
+            NWBLoader loader;
+            if (!parser.isSet(lazyTracesOption))
+            {
+                StageTimer stage("NWB traces", parser.value(tracesOption));
+                LoadInfo loadInfo;
+                loadInfo.failedSweepPath = parser.value(failedSweepsOption);
+                std::vector<NWBExperiment> experiments;
+                loader.LoadNWBFiles(nwbFilePaths, experiments, loadInfo, numThreads);
+                stage.setDetail(QString("%1 files, %2 threads").arg(nwbFiles.size()).arg(numThreads));
+            }
+            else
+            {
+                const NWBLoadSession session(parser.value(failedSweepsOption));
+                std::vector<NWBFileIndex> indices;
+                {
+                    StageTimer stage("NWB index", parser.value(tracesOption));
+                    LoadInfo loadInfo;
+                    loader.IndexNWBFiles(session, nwbFilePaths, indices, loadInfo, numThreads);
+                    stage.setDetail(QString("%1 files, %2 threads").arg(nwbFiles.size()).arg(numThreads));
+                }
+
+                // Only the files whose traces are displayed are read, with the pyramids the plugin builds for zooming in
+                StageTimer stage("NWB materialize");
+                const size_t numMaterialized = std::min<size_t>(indices.size(), parser.value(lazyTracesOption).toUInt());
+                std::vector<NWBExperiment> experiments(numMaterialized);
+                for (size_t i = 0; i < numMaterialized; i++)
+                    loader.MaterializeNWB(session, indices[i], experiments[i], true);
+                stage.setDetail(QString("%1 files").arg(numMaterialized));
+            }
+        }
+    }
+    catch (const LoadException& e)
+    {
+        qCritical() << "Failed to load" << e.getFilePath() << ":" << e.getReason();
+        return 1;
+    }
+
+    const qint64 totalMilliseconds = totalTimer.elapsed();
+    const size_t totalAllocations = AllocationCounter::count() - allocationsBegin;
+
+    printTimings(totalMilliseconds);
+
+    if (parser.isSet(outputOption) && !writeTimings(parser.value(outputOption), totalMilliseconds, totalAllocations))
+    {
+        qCritical() << "Failed to write timings to" << parser.value(outputOption);
+        return 1;
+    }
+
+    Tracing::write();
+    MemoryProfiler::report();
+
+    return 0;
+}
@@ -0,0 +1,642 @@
+#include "SyntheticDataset.h"
+
+#include "json.hpp"
+
+#include <H5Cpp.h>
+
+#include <QDebug>
+#include <QDir>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <numbers>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace
+{
+    // Independent random streams, so adding a modality or changing its size leaves the others untouched
+    enum class Stream : uint64_t
+    {
+        CELL = 1,
+        METADATA,
+        GROUP_CENTERS,
+        GENES,
+        EXPRESSION,
+        EPHYS,
+        MORPHOLOGY,
+        TX_UMAP,
+        EPHYS_UMAP,
+        MORPHO_UMAP,
+        ME_UMAP,
+        SWC,
+        SWEEPS,
+        FAILED_SWEEPS,
+        DUPLICATES
+    };
+
+    // Number of groups in a subclass and of subclasses in a class
+    constexpr size_t GROUPS_PER_SUBCLASS = 4;
+    constexpr size_t SUBCLASSES_PER_CLASS = 3;
+
+    // Genes that are markers of a group are expressed this many times higher in its cells
+    constexpr size_t NUM_MARKER_GENES_PER_GROUP = 10;
+    constexpr double MARKER_FOLD_CHANGE = 8.0;
+
+    constexpr float FAILED_SWEEP_FRACTION = 0.05f;
+
+    // Stimulus sets cycled through by the sweeps, the last one is not loaded by the NWB loader
+    const char* STIMULUS_CODES[] = { "X1PS_SubThresh", "X3LP_Rheo", "X4PS_SupraThresh", "C1LSCOARSE150216", "X7Ramp", "EXTPGGAEND" };
+
+    // Small, fast and splittable generator (Steele et al.), every cell seeds its own from the dataset seed
+    class SplitMix64
+    {
+    public:
+        SplitMix64(uint64_t seed, Stream stream, uint64_t index) :
+            _state(mix(mix(seed ^ mix(static_cast<uint64_t>(stream))) + index))
+        {
+
+        }
+
+        uint64_t next()
+        {
+            return mix(_state += 0x9e3779b97f4a7c15ull);
+        }
+
+        // Uniform in [0, 1)
+        double uniform()
+        {
+            return (next() >> 11) * 0x1.0p-53;
+        }
+
+        size_t index(size_t n)
+        {
+            return static_cast<size_t>(uniform() * n);
+        }
+
+        double normal()
+        {
+            double u1 = uniform();
+            double u2 = uniform();
+            return std::sqrt(-2.0 * std::log(1.0 - u1)) * std::cos(2.0 * std::numbers::pi * u2);
+        }
+
+        uint32_t poisson(double lambda)
+        {
+            // Knuth's multiplication method for small means, a rounded normal approximation for large ones
+            if (lambda > 30.0)
+                return static_cast<uint32_t>(std::max(0.0, std::round(lambda + std::sqrt(lambda) * normal())));
+
+            const double limit = std::exp(-lambda);
+            uint32_t count = 0;
+            double product = uniform();
+            while (product > limit)
+            {
+                count++;
+                product *= uniform();
+            }
+            return count;
+        }
+
+    private:
+        static uint64_t mix(uint64_t z)
+        {
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+    private:
+        uint64_t _state;
+    };
+
+    class Cell
+    {
+    public:
+        QString id;
+        QString name;
+        size_t group = 0;
+        bool hasTranscriptomics = false;
+        bool hasEphys = false;
+        bool hasMorphology = false;
+    };
+
+    // Row-by-row CSV writer that formats numbers with std::to_chars
+    class CsvWriter
+    {
+    public:
+        CsvWriter(const QString& filePath) :
+            _file(filePath.toStdString(), std::ios::binary)
+        {
+            if (!_file)
+                qWarning() << "Failed to create" << filePath;
+        }
+
+        void field(const QString& text)
+        {
+            separate();
+            _row += text.toStdString();
+        }
+
+        void field(float value)
+        {
+            separate();
+            char buffer[32];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
+            _row.append(buffer, result.ptr);
+        }
+
+        void field(uint32_t value)
+        {
+            separate();
+            char buffer[16];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            _row.append(buffer, result.ptr);
+        }
+
+        void missing()
+        {
+            separate();
+        }
+
+        void endRow()
+        {
+            _row += '\n';
+            _file.write(_row.data(), _row.size());
+            _row.clear();
+            _firstField = true;
+        }
+
+    private:
+        void separate()
+        {
+            if (!_firstField)
+                _row += ',';
+            _firstField = false;
+        }
+
+    private:
+        std::ofstream _file;
+        std::string _row;
+        bool _firstField = true;
+    };
+
+    QString groupName(size_t group)
+    {
+        return QString("Group_%1").arg(group + 1);
+    }
+
+    QString subclassName(size_t group)
+    {
+        return QString("Subclass_%1").arg(group / GROUPS_PER_SUBCLASS + 1);
+    }
+
+    QString className(size_t group)
+    {
+        return QString("Class_%1").arg(group / (GROUPS_PER_SUBCLASS * SUBCLASSES_PER_CLASS) + 1);
+    }
+
+    QString sweepGroupName(size_t sweepNumber, const char* suffix)
+    {
+        return QString("data_%1_%2").arg(sweepNumber, 5, 10, QChar('0')).arg(suffix);
+    }
+
+    // Writes the rows of the cells that pass the filter, followed by a second copy of a fraction of them.
+    // Rows are generated from the cell index alone, so a duplicate is identical to the original row.
+    template<typename Filter, typename WriteRow>
+    void writeRows(const SyntheticDatasetConfig& config, const std::vector<Cell>& cells, Stream stream, CsvWriter& writer, Filter filter, WriteRow writeRow)
+    {
+        std::vector<size_t> duplicates;
+        SplitMix64 duplicateRng(config.seed, Stream::DUPLICATES, static_cast<uint64_t>(stream));
+
+        for (size_t i = 0; i < cells.size(); i++)
+        {
+            if (!filter(cells[i]))
+                continue;
+
+            SplitMix64 rng(config.seed, stream, i);
+            writeRow(i, rng);
+            writer.endRow();
+
+            if (duplicateRng.uniform() < config.duplicateFraction)
+                duplicates.push_back(i);
+        }
+
+        for (size_t i : duplicates)
+        {
+            SplitMix64 rng(config.seed, stream, i);
+            writeRow(i, rng);
+            writer.endRow();
+        }
+    }
+
+    // Per group offsets of a set of values, in units of their spread within a group
+    std::vector<float> makeGroupCenters(const SyntheticDatasetConfig& config, uint64_t offset, size_t numValues, float separation)
+    {
+        std::vector<float> centers(config.numGroups * numValues);
+        SplitMix64 rng(config.seed, Stream::GROUP_CENTERS, offset);
+        for (float& center : centers)
+            center = static_cast<float>(rng.normal()) * separation;
+        return centers;
+    }
+
+    Cell makeCell(const SyntheticDatasetConfig& config, size_t i)
+    {
+        SplitMix64 rng(config.seed, Stream::CELL, i);
+
+        Cell cell;
+        cell.id = QString::number(600000000ull + i);
+        cell.name = QString("SYN%1.%2.%3").arg(config.seed % 100, 2, 10, QChar('0')).arg(i / 1000, 3, 10, QChar('0')).arg(i % 1000, 3, 10, QChar('0'));
+        cell.group = rng.index(config.numGroups);
+        cell.hasTranscriptomics = rng.uniform() < config.transcriptomicsCoverage;
+        cell.hasEphys = rng.uniform() < config.ephysCoverage;
+        cell.hasMorphology = rng.uniform() < config.morphologyCoverage;
+        return cell;
+    }
+
+    std::vector<Cell> makeCells(const SyntheticDatasetConfig& config)
+    {
+        std::vector<Cell> cells(config.numCells);
+        for (size_t i = 0; i < cells.size(); i++)
+            cells[i] = makeCell(config, i);
+        return cells;
+    }
+
+    void writeMetadata(const SyntheticDatasetConfig& config, const std::vector<Cell>& cells, const QString& filePath)
+    {
+        CsvWriter writer(filePath);
+        for (const char* header : { "cell_id", "cell_name", "Group_name", "Subclass_name", "Class_name", "soma_depth", "donor_age" })
+            writer.field(QString(header));
+        writer.endRow();
+
+        std::vector<float> depthCenters = makeGroupCenters(config, 0, 1, 1.0f);
+
+        writeRows(config, cells, Stream::METADATA, writer, [](const Cell&) { return true; }, [&](size_t i, SplitMix64& rng)
+        {
+            const Cell& cell = cells[i];
+            writer.field(cell.id);
+            writer.field(cell.name);
+            writer.field(groupName(cell.group));
+            writer.field(subclassName(cell.group));
+            writer.field(className(cell.group));
+            writer.field(std::clamp(0.5f + 0.2f * depthCenters[cell.group] + 0.05f * static_cast<float>(rng.normal()), 0.0f, 1.0f));
+            writer.field(static_cast<uint32_t>(20 + rng.index(60)));
+        });
+    }
+
+    void writeTranscriptomics(const SyntheticDatasetConfig& config, const std::vector<Cell>& cells, const QString& filePath)
+    {
+        // Mean count of every gene, log-normally distributed so most genes are sparse and a few are highly expressed
+        std::vector<double> geneMeans(config.numGenes);
+        SplitMix64 geneRng(config.seed, Stream::GENES, 0);
+        for (double& mean : geneMeans)
+            mean = std::exp(-1.0 + 1.5 * geneRng.normal());
+
+        CsvWriter writer(filePath);
+        writer.field(QString("cell_id"));
+        for (size_t g = 0; g < config.numGenes; g++)
+            writer.field(QString("Gene%1").arg(g, 5, 10, QChar('0')));
+        writer.endRow();
+
+        const size_t numMarkerGenes = std::min(config.numGenes, config.numGroups * NUM_MARKER_GENES_PER_GROUP);
+
+        writeRows(config, cells, Stream::EXPRESSION, writer, [](const Cell& cell) { return cell.hasTranscriptomics; }, [&](size_t i, SplitMix64& rng)
+        {
+            const Cell& cell = cells[i];
+            const double librarySize = std::exp(0.3 * rng.normal());
+
+            writer.field(cell.id);
+            for (size_t g = 0; g < config.numGenes; g++)
+            {
+                const bool isMarker = g < numMarkerGenes && g % config.numGroups == cell.group;
+                const uint32_t count = rng.poisson(geneMeans[g] * librarySize * (isMarker ? MARKER_FOLD_CHANGE : 1.0));
+                if (rng.uniform() < config.expressionMissingFraction)
+                    writer.missing();
+                else
+                    writer.field(count);
+            }
+        });
+    }
+
+    // Feature tables have per-feature scales spanning a few orders of magnitude, like features measured in different units
+    template<typename Filter>
+    void writeFeatures(const SyntheticDatasetConfig& config, const std::vector<Cell>& cells, const QString& filePath, Stream stream, size_t numFeatures,
+                       const QString& featurePrefix, bool withCellName, Filter filter)
+    {
+        std::vector<float> centers = makeGroupCenters(config, static_cast<uint64_t>(stream), numFeatures, 2.0f);
+
+        CsvWriter writer(filePath);
+        writer.field(QString("cell_id"));
+        if (withCellName)
+            writer.field(QString("cell_name"));
+        for (size_t f = 0; f < numFeatures; f++)
+            writer.field(QString("%1_%2").arg(featurePrefix).arg(f, 3, 10, QChar('0')));
+        writer.endRow();
+
+        writeRows(config, cells, stream, writer, filter, [&](size_t i, SplitMix64& rng)
+        {
+            const Cell& cell = cells[i];
+            writer.field(cell.id);
+            if (withCellName)
+                writer.field(cell.name);
+
+            for (size_t f = 0; f < numFeatures; f++)
+            {
+                const float value = centers[cell.group * numFeatures + f] + static_cast<float>(rng.normal());
+                if (rng.uniform() < config.missingFraction)
+                    writer.missing();
+                else
+                    writer.field(value * std::pow(10.0f, static_cast<float>(f % 4) - 1.0f));
+            }
+        });
+    }
+
+    // Cell types form blobs on a circle, every embedding rotates the circle so they differ from each other
+    template<typename Filter>
+    void writeUMap(const SyntheticDatasetConfig& config, const std::vector<Cell>& cells, const QString& filePath, Stream stream, double rotation, Filter filter)
+    {
+        CsvWriter writer(filePath);
+        writer.field(QString("cell_id"));
+        writer.field(QString("x"));
+        writer.field(QString("y"));
+        writer.endRow();
+
+        writeRows(config, cells, stream, writer, filter, [&](size_t i, SplitMix64& rng)
+        {
+            const Cell& cell = cells[i];
+            const double angle = rotation + 2.0 * std::numbers::pi * cell.group / config.numGroups;
+            writer.field(cell.id);
+            writer.field(static_cast<float>(10.0 * std::cos(angle) + rng.normal()));
+            writer.field(static_cast<float>(10.0 * std::sin(angle) + rng.normal()));
+        });
+    }
+
+    // Random walk dendrites growing out of a soma, groups differ in their extent
+    void writeSwc(const SyntheticDatasetConfig& config, const Cell& cell, size_t cellIndex, const QString& filePath)
+    {
+        SplitMix64 rng(config.seed, Stream::SWC, cellIndex);
+
+        std::ofstream file(filePath.toStdString(), std::ios::binary);
+        file << "# Synthetic reconstruction of cell " << cell.id.toStdString() << "\n";
+        file << "# id type x y z radius parent\n";
+
+        struct Node
+        {
+            float x, y, z, radius;
+            int type;
+        };
+
+        std::vector<Node> nodes;
+        nodes.reserve(config.numSwcNodesPerCell);
+
+        const float stepLength = 2.0f + 0.2f * (cell.group % GROUPS_PER_SUBCLASS);
+        const float somaDepth = -300.0f - 40.0f * (cell.group % 8);
+
+        nodes.push_back({ 0.0f, somaDepth, 0.0f, 6.0f, 1 });
+        file << "1 1 0 " << somaDepth << " 0 6 -1\n";
+
+        size_t parent = 0;
+        float dx = 0, dy = 1, dz = 0;
+        for (size_t n = 1; n < config.numSwcNodesPerCell; n++)
+        {
+            // Mostly continue the current branch, sometimes start a new dendrite at the soma or branch off an earlier node
+            const double choice = rng.uniform();
+            const bool newBranch = choice < 0.08;
+            if (choice < 0.02)
+                parent = 0;
+            else if (newBranch)
+                parent = rng.index(n);
+
+            const Node& parentNode = nodes[parent];
+
+            if (newBranch || parent == 0)
+            {
+                dx = static_cast<float>(rng.normal());
+                dy = static_cast<float>(rng.normal());
+                dz = static_cast<float>(rng.normal());
+            }
+
+            // Keep the direction with some jitter
+            dx += 0.3f * static_cast<float>(rng.normal());
+            dy += 0.3f * static_cast<float>(rng.normal());
+            dz += 0.3f * static_cast<float>(rng.normal());
+            const float length = std::sqrt(dx * dx + dy * dy + dz * dz) + 1e-6f;
+            dx /= length;
+            dy /= length;
+            dz /= length;
+
+            const int type = parent == 0 ? (dy > 0 ? 4 : 3) : parentNode.type;
+            Node node = { parentNode.x + stepLength * dx, parentNode.y + stepLength * dy, parentNode.z + stepLength * dz, std::max(0.2f, parentNode.radius * 0.98f), type };
+            if (parent == 0)
+                node.radius = 2.0f;
+
+            file << n + 1 << ' ' << node.type << ' ' << node.x << ' ' << node.y << ' ' << node.z << ' ' << node.radius << ' ' << parent + 1 << '\n';
+
+            nodes.push_back(node);
+            parent = nodes.size() - 1;
+        }
+    }
+
+    void writeStringAttribute(H5::H5Object& object, const char* name, const std::string& value)
+    {
+        H5::StrType type(H5::PredType::C_S1, H5T_VARIABLE);
+        H5::Attribute attribute = object.createAttribute(name, type, H5::DataSpace(H5S_SCALAR));
+        attribute.write(type, value);
+    }
+
+    void writeFloatAttribute(H5::H5Object& object, const char* name, float value)
+    {
+        H5::Attribute attribute = object.createAttribute(name, H5::PredType::NATIVE_FLOAT, H5::DataSpace(H5S_SCALAR));
+        attribute.write(H5::PredType::NATIVE_FLOAT, &value);
+    }
+
+    // A timeseries group in the NWB layout: data, starting_time with the sampling rate and the sweep attributes
+    void writeTimeSeries(H5::Group& parent, const QString& name, const char* neurodataType, const std::string& stimulusDescription,
+                         const std::vector<float>& data, const char* unit, float conversion, float rate)
+    {
+        H5::Group group = parent.createGroup(name.toStdString());
+        writeStringAttribute(group, "neurodata_type", neurodataType);
+        writeStringAttribute(group, "namespace", "core");
+        writeStringAttribute(group, "stimulus_description", stimulusDescription);
+        writeStringAttribute(group, "comments", "Stim Scale Factor: 100.000");
+
+        hsize_t size = data.size();
+        H5::DataSet dataset = group.createDataSet("data", H5::PredType::IEEE_F32LE, H5::DataSpace(1, &size));
+        dataset.write(data.data(), H5::PredType::NATIVE_FLOAT);
+        writeStringAttribute(dataset, "unit", unit);
+        writeFloatAttribute(dataset, "conversion", conversion);
+
+        double startingTime = 0.0;
+        H5::DataSet startingTimeDataset = group.createDataSet("starting_time", H5::PredType::IEEE_F64LE, H5::DataSpace(H5S_SCALAR));
+        startingTimeDataset.write(&startingTime, H5::PredType::NATIVE_DOUBLE);
+        writeFloatAttribute(startingTimeDataset, "rate", rate);
+        writeStringAttribute(startingTimeDataset, "unit", "seconds");
+    }
+
+    void writeNwb(const SyntheticDatasetConfig& config, size_t cellIndex, const QString& filePath)
+    {
+        H5::H5File file(filePath.toStdString(), H5F_ACC_TRUNC);
+        H5::Group root = file.openGroup("/");
+        writeStringAttribute(root, "nwb_version", "2.2.0");
+        writeStringAttribute(root, "namespace", "core");
+        writeStringAttribute(root, "neurodata_type", "NWBFile");
+
+        H5::Group acquisition = file.createGroup("/acquisition");
+        file.createGroup("/stimulus");
+        H5::Group presentation = file.createGroup("/stimulus/presentation");
+        file.createGroup("/general");
+
+        std::vector<float> current;
+        std::vector<float> voltage;
+
+        for (size_t s = 0; s < config.numSweepsPerCell; s++)
+        {
+            const size_t sweepNumber = s + 1;
+            const std::string stimulusDescription = MakeSyntheticSweep(config, cellIndex, s, current, voltage) + "_DA_0";
+
+            writeTimeSeries(acquisition, sweepGroupName(sweepNumber, "AD0"), "CurrentClampSeries", stimulusDescription, voltage, "volts", 1e-3f, config.samplingRate);
+            writeTimeSeries(presentation, sweepGroupName(sweepNumber, "DA0"), "CurrentClampStimulusSeries", stimulusDescription, current, "amperes", 1e-12f, config.samplingRate);
+        }
+    }
+}
+
+std::string MakeSyntheticSweep(const SyntheticDatasetConfig& config, size_t cellIndex, size_t sweepIndex, std::vector<float>& current, std::vector<float>& voltage)
+{
+    const Cell cell = makeCell(config, cellIndex);
+    SplitMix64 rng(config.seed, Stream::SWEEPS, cellIndex * config.numSweepsPerCell + sweepIndex);
+
+    const size_t numSamples = config.numSamplesPerSweep;
+    const float rheobase = 60.0f + 15.0f * (cell.group % 8);
+    const float resistance = 0.15f + 0.02f * (cell.group % 5);   // mV per pA
+    const float tau = 0.02f * config.samplingRate;              // Membrane time constant of 20 ms in samples
+    const size_t spikeWidth = std::max<size_t>(2, static_cast<size_t>(0.001f * config.samplingRate));
+
+    const std::string code = STIMULUS_CODES[sweepIndex % std::size(STIMULUS_CODES)];
+    const bool isRamp = code.find("Ramp") != std::string::npos;
+
+    // Hyperpolarizing steps below threshold, steps just above and well above rheobase, increasing long squares otherwise
+    float amplitude = -100.0f + 40.0f * (sweepIndex / std::size(STIMULUS_CODES)) + 10.0f * static_cast<float>(rng.index(10));
+    if (code.find("SubThresh") != std::string::npos)
+        amplitude = -10.0f * static_cast<float>(1 + rng.index(10));
+    else if (code.find("Rheo") != std::string::npos)
+        amplitude = rheobase + 10.0f;
+    else if (code.find("SupraThresh") != std::string::npos)
+        amplitude = rheobase + 40.0f + 20.0f * static_cast<float>(rng.index(5));
+
+    const size_t testBegin = numSamples / 50;
+    const size_t testEnd = testBegin + numSamples / 100;
+    const size_t stepBegin = numSamples / 5;
+    const size_t stepEnd = numSamples * 4 / 5;
+
+    current.assign(numSamples, 0.0f);
+    voltage.resize(numSamples);
+
+    for (size_t i = testBegin; i < testEnd; i++)
+        current[i] = -20.0f;
+    for (size_t i = stepBegin; i < stepEnd; i++)
+    {
+        const float fraction = static_cast<float>(i - stepBegin) / (stepEnd - stepBegin);
+        current[i] = isRamp ? std::max(1.0f, 300.0f * fraction) : (amplitude == 0.0f ? 1.0f : amplitude);
+    }
+
+    float v = -70.0f;
+    size_t samplesSinceSpike = 0;
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        const float target = -70.0f + resistance * current[i];
+        v += (target - v) / tau;
+
+        float sample = v + 0.2f * static_cast<float>(rng.normal());
+
+        // Regular firing with a rate that grows with the current above rheobase
+        if (current[i] > rheobase)
+        {
+            const size_t interval = std::max(2 * spikeWidth, static_cast<size_t>(config.samplingRate * 2.0f / (current[i] - rheobase + 20.0f)));
+            samplesSinceSpike++;
+            if (samplesSinceSpike >= interval)
+                samplesSinceSpike = 0;
+            if (samplesSinceSpike < spikeWidth)
+                sample += 100.0f * std::sin(std::numbers::pi_v<float> * samplesSinceSpike / spikeWidth);
+        }
+        else
+            samplesSinceSpike = 0;
+
+        voltage[i] = sample;
+    }
+
+    return code;
+}
+
+void WriteSyntheticSwc(const SyntheticDatasetConfig& config, size_t cellIndex, const QString& filePath)
+{
+    writeSwc(config, makeCell(config, cellIndex), cellIndex, filePath);
+}
+
+void WriteSyntheticFeatureTable(const SyntheticDatasetConfig& config, const QString& filePath, size_t numFeatures)
+{
+    writeFeatures(config, makeCells(config), filePath, Stream::EPHYS, numFeatures, "feature", true, [](const Cell&) { return true; });
+}
+
+void WriteSyntheticDataset(const SyntheticDatasetConfig& config, const QString& outputDir)
+{
+    QDir dir(outputDir);
+    dir.mkpath(".");
+    dir.mkpath("SWC");
+    dir.mkpath("NWB");
+
+    const std::vector<Cell> cells = makeCells(config);
+
+    qDebug() << "Writing metadata of" << cells.size() << "cells..";
+    writeMetadata(config, cells, dir.filePath("metadata.csv"));
+
+    qDebug() << "Writing" << config.numGenes << "genes..";
+    writeTranscriptomics(config, cells, dir.filePath("transcriptomics.csv"));
+
+    qDebug() << "Writing features..";
+    writeFeatures(config, cells, dir.filePath("ephys.csv"), Stream::EPHYS, config.numEphysFeatures, "ephys_feature", true, [](const Cell& cell) { return cell.hasEphys; });
+    writeFeatures(config, cells, dir.filePath("morphology.csv"), Stream::MORPHOLOGY, config.numMorphologyFeatures, "morpho_feature", false, [](const Cell& cell) { return cell.hasMorphology; });
+
+    qDebug() << "Writing UMAPs..";
+    writeUMap(config, cells, dir.filePath("tx_umap.csv"), Stream::TX_UMAP, 0.0, [](const Cell& cell) { return cell.hasTranscriptomics; });
+    writeUMap(config, cells, dir.filePath("ephys_umap.csv"), Stream::EPHYS_UMAP, 0.7, [](const Cell& cell) { return cell.hasEphys; });
+    writeUMap(config, cells, dir.filePath("morpho_umap.csv"), Stream::MORPHO_UMAP, 1.4, [](const Cell& cell) { return cell.hasMorphology; });
+    writeUMap(config, cells, dir.filePath("me_umap.csv"), Stream::ME_UMAP, 2.1, [](const Cell& cell) { return cell.hasEphys && cell.hasMorphology; });
+
+    // Reconstructions and recordings belong to the first cells of the matching modality
+    qDebug() << "Writing" << config.numSwcCells << "SWC files..";
+    size_t numSwcFiles = 0;
+    for (size_t i = 0; i < cells.size() && numSwcFiles < config.numSwcCells; i++)
+    {
+        if (!cells[i].hasMorphology)
+            continue;
+
+        writeSwc(config, cells[i], i, dir.filePath("SWC/" + cells[i].id + ".swc"));
+        numSwcFiles++;
+    }
+
+    qDebug() << "Writing" << config.numNwbCells << "NWB files..";
+    json failedSweeps = json::object();
+    size_t numNwbFiles = 0;
+    for (size_t i = 0; i < cells.size() && numNwbFiles < config.numNwbCells; i++)
+    {
+        if (!cells[i].hasEphys)
+            continue;
+
+        writeNwb(config, i, dir.filePath("NWB/" + cells[i].name + ".nwb"));
+        numNwbFiles++;
+
+        SplitMix64 rng(config.seed, Stream::FAILED_SWEEPS, i);
+        json sweeps = json::array();
+        for (size_t s = 1; s <= config.numSweepsPerCell; s++)
+            if (rng.uniform() < FAILED_SWEEP_FRACTION)
+                sweeps.push_back(s);
+        failedSweeps[cells[i].name.toStdString()] = { { "failed_sweeps", sweeps } };
+    }
+
+    std::ofstream failedSweepsFile(dir.filePath("failed_sweeps.json").toStdString());
+    failedSweepsFile << failedSweeps.dump(2);
+}
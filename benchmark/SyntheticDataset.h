@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QString>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Shape of a synthetic patch-seq dataset. Every cell belongs to one of numGroups cell types, which shifts its gene
+// expression, features, UMAP positions, dendrite extent and firing, so the generated modalities agree with each other.
+// Each modality covers a subset of the metadata cells, and the tables contain duplicated rows and missing values.
+class SyntheticDatasetConfig
+{
+public:
+    uint64_t seed = 1;
+
+    size_t numCells = 1000;
+    size_t numGroups = 20;              // Cell types, every 4 groups form a subclass
+
+    size_t numGenes = 5000;
+    size_t numEphysFeatures = 100;
+    size_t numMorphologyFeatures = 60;
+
+    size_t numSwcCells = 100;           // Cells with an SWC reconstruction
+    size_t numSwcNodesPerCell = 2000;
+
+    size_t numNwbCells = 20;            // Cells with an NWB file
+    size_t numSweepsPerCell = 20;
+    size_t numSamplesPerSweep = 50000;
+    float samplingRate = 50000.0f;      // Hz
+
+    float transcriptomicsCoverage = 0.95f;  // Fraction of the cells in every modality
+    float ephysCoverage = 0.9f;
+    float morphologyCoverage = 0.5f;
+
+    float missingFraction = 0.05f;      // Fraction of the ephys and morphology feature values left empty
+    float expressionMissingFraction = 0.001f;   // Fraction of the gene counts left empty
+    float duplicateFraction = 0.01f;    // Fraction of the rows of every table that is written a second time
+};
+
+// Writes the dataset to outputDir, which is created if needed:
+//   metadata.csv, transcriptomics.csv, ephys.csv, morphology.csv,
+//   tx_umap.csv, ephys_umap.csv, morpho_umap.csv, me_umap.csv,
+//   failed_sweeps.json, SWC/<cell_id>.swc and NWB/<cell_name>.nwb
+// The output only depends on the configuration, the same seed always gives the same files.
+void WriteSyntheticDataset(const SyntheticDatasetConfig& config, const QString& outputDir);
+
+// Building blocks of the dataset, also used on their own by the micro-benchmarks
+
+// Stimulus current (pA) and membrane potential (mV) of a current clamp sweep of a cell, returns the stimulus code
+std::string MakeSyntheticSweep(const SyntheticDatasetConfig& config, size_t cellIndex, size_t sweepIndex, std::vector<float>& current, std::vector<float>& voltage);
+
+// Reconstruction of a cell with config.numSwcNodesPerCell nodes
+void WriteSyntheticSwc(const SyntheticDatasetConfig& config, size_t cellIndex, const QString& filePath);
+
+// Feature table of all config.numCells cells with cell_id and cell_name columns, missing values and duplicated rows
+void WriteSyntheticFeatureTable(const SyntheticDatasetConfig& config, const QString& filePath, size_t numFeatures);
@@ -0,0 +1,139 @@
+#include "Correlation.h"
+
+#include "LinearAlgebra.h"
+#include "MatrixData.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+    // Number of left columns gathered and correlated at a time
+    constexpr size_t COLUMNS_PER_TILE = 1024;
+
+    // Replaces the values of a strided column by their ranks, tied values get the average of their ranks
+    void RankColumn(float* column, size_t count, size_t stride)
+    {
+        std::vector<std::pair<float, uint32_t>> sorted(count);
+        for (size_t i = 0; i < count; i++)
+            sorted[i] = { column[i * stride], static_cast<uint32_t>(i) };
+        std::sort(sorted.begin(), sorted.end());
+
+        for (size_t begin = 0; begin < count;)
+        {
+            size_t end = begin + 1;
+            while (end < count && sorted[end].first == sorted[begin].first)
+                end++;
+
+            float rank = (begin + end - 1) / 2.0f;
+            for (size_t i = begin; i < end; i++)
+                column[sorted[i].second * stride] = rank;
+
+            begin = end;
+        }
+    }
+
+    // Gathers columns [colBegin, colEnd) of the given rows into a row-major block, and centers every column and scales
+    // it to unit length. The inner product of two such columns is then their correlation. Constant columns become zero.
+    std::vector<float> GatherNormalizedColumns(const MatrixData& matrix, const std::vector<uint32_t>& rows, size_t colBegin, size_t colEnd, CorrelationMethod method)
+    {
+        const size_t numRows = rows.size();
+        const size_t numCols = colEnd - colBegin;
+
+        std::vector<float> block(numRows * numCols);
+        parallelFor(numRows, 256, [&](size_t i)
+        {
+            const float* rowData = matrix.data.data() + rows[i] * matrix.numCols;
+            std::copy(rowData + colBegin, rowData + colEnd, block.begin() + i * numCols);
+        });
+
+        parallelFor(numCols, 16, [&](size_t col)
+        {
+            float* column = block.data() + col;
+
+            if (method == CorrelationMethod::SPEARMAN)
+                RankColumn(column, numRows, numCols);
+
+            double sum = 0;
+            for (size_t i = 0; i < numRows; i++)
+                sum += column[i * numCols];
+            const float mean = static_cast<float>(sum / std::max<size_t>(numRows, 1));
+
+            double sumSq = 0;
+            for (size_t i = 0; i < numRows; i++)
+            {
+                float v = column[i * numCols] - mean;
+                column[i * numCols] = v;
+                sumSq += static_cast<double>(v) * v;
+            }
+
+            const float scale = sumSq > 0 ? static_cast<float>(1 / std::sqrt(sumSq)) : 0.0f;
+            for (size_t i = 0; i < numRows; i++)
+                column[i * numCols] *= scale;
+        });
+
+        return block;
+    }
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> JoinRowsOnKeys(const std::vector<QString>& leftKeys, const std::vector<QString>& rightKeys)
+{
+    std::unordered_map<QString, uint32_t> rightRows;
+    rightRows.reserve(rightKeys.size());
+    for (uint32_t row = 0; row < rightKeys.size(); row++)
+    {
+        if (!rightKeys[row].isEmpty())
+            rightRows.emplace(rightKeys[row], row);
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> rowPairs;
+    for (uint32_t row = 0; row < leftKeys.size(); row++)
+    {
+        auto it = rightRows.find(leftKeys[row]);
+        if (it != rightRows.end())
+            rowPairs.emplace_back(row, it->second);
+    }
+
+    return rowPairs;
+}
+
+void ComputeCorrelations(const MatrixData& left, const MatrixData& right, const std::vector<std::pair<uint32_t, uint32_t>>& rowPairs, CorrelationMethod method, MatrixData& correlations)
+{
+    std::vector<uint32_t> leftRows(rowPairs.size());
+    std::vector<uint32_t> rightRows(rowPairs.size());
+    for (size_t i = 0; i < rowPairs.size(); i++)
+    {
+        leftRows[i] = rowPairs[i].first;
+        rightRows[i] = rowPairs[i].second;
+    }
+
+    correlations.headers = right.headers;
+    correlations.numRows = left.numCols;
+    correlations.numCols = right.numCols;
+    correlations.data.clear();
+    correlations.data.resize(left.numCols * right.numCols);
+
+    const size_t numPairs = rowPairs.size();
+    if (numPairs < 2)
+        return;
+
+    // The right matrix is small (features), so it is normalized once and reused for every tile of the left one (genes)
+    std::vector<float> rightBlock = GatherNormalizedColumns(right, rightRows, 0, right.numCols, method);
+
+    for (size_t colBegin = 0; colBegin < left.numCols; colBegin += COLUMNS_PER_TILE)
+    {
+        size_t colEnd = std::min(left.numCols, colBegin + COLUMNS_PER_TILE);
+
+        std::vector<float> leftBlock = GatherNormalizedColumns(left, leftRows, colBegin, colEnd, method);
+
+        float* tileCorrelations = correlations.data.data() + colBegin * right.numCols;
+        MultiplyTransposed(leftBlock.data(), rightBlock.data(), tileCorrelations, numPairs, colEnd - colBegin, right.numCols);
+    }
+
+    // Clamp rounding errors
+    for (float& r : correlations.data)
+        r = std::clamp(r, -1.0f, 1.0f);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QString>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class MatrixData;
+
+enum class CorrelationMethod
+{
+    PEARSON,
+    SPEARMAN    // Pearson correlation of the ranks, ties get their average rank
+};
+
+// Pairs of (left row, right row) whose keys are equal, in the order of the left rows. The right keys are hashed once
+// and every left key is probed, so aligning two modalities is linear in the number of cells. Empty keys never match,
+// for duplicate right keys the first row is used.
+std::vector<std::pair<uint32_t, uint32_t>> JoinRowsOnKeys(const std::vector<QString>& leftKeys, const std::vector<QString>& rightKeys);
+
+// Correlation of every column of left with every column of right over the paired rows. Fills correlations with the
+// left.numCols x right.numCols correlation matrix, with the right column names as headers. The columns of left are
+// processed in tiles, so only a tile of it is gathered at a time. Missing values should be imputed beforehand.
+void ComputeCorrelations(const MatrixData& left, const MatrixData& right, const std::vector<std::pair<uint32_t, uint32_t>>& rowPairs, CorrelationMethod method, MatrixData& correlations);
@@ -0,0 +1,178 @@
+#include "DifferentialExpression.h"
+
+#include "MatrixData.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+    // Number of genes gathered from the row-major matrix at a time
+    constexpr size_t GENES_PER_CHUNK = 64;
+
+    // Per-cluster sums of one gene
+    struct ClusterSums
+    {
+        std::vector<double> rankSums;
+        std::vector<double> logSums;
+        std::vector<double> linearSums;
+        std::vector<uint32_t> numExpressing;
+
+        ClusterSums(size_t numClusters) :
+            rankSums(numClusters), logSums(numClusters), linearSums(numClusters), numExpressing(numClusters)
+        { }
+
+        void reset()
+        {
+            std::fill(rankSums.begin(), rankSums.end(), 0.0);
+            std::fill(logSums.begin(), logSums.end(), 0.0);
+            std::fill(linearSums.begin(), linearSums.end(), 0.0);
+            std::fill(numExpressing.begin(), numExpressing.end(), 0);
+        }
+    };
+
+    // Benjamini-Hochberg adjusted p-values of the markers, which must be sorted by p-value
+    void AdjustPValues(std::vector<MarkerGene>& markers)
+    {
+        const size_t n = markers.size();
+
+        double minAdjusted = 1;
+        for (size_t i = n; i-- > 0;)
+        {
+            minAdjusted = std::min(minAdjusted, markers[i].pValue * n / (i + 1));
+            markers[i].adjustedPValue = minAdjusted;
+        }
+    }
+}
+
+std::vector<std::vector<MarkerGene>> ComputeDifferentialExpression(const MatrixData& expression, const std::vector<int>& labels, size_t numClusters)
+{
+    const size_t numGenes = expression.numCols;
+
+    // Only labelled rows take part
+    std::vector<uint32_t> rows;
+    std::vector<uint32_t> clusterSizes(numClusters, 0);
+    for (uint32_t row = 0; row < expression.numRows; row++)
+    {
+        if (labels[row] < 0)
+            continue;
+
+        rows.push_back(row);
+        clusterSizes[labels[row]]++;
+    }
+
+    const size_t numCells = rows.size();
+
+    std::vector<std::vector<MarkerGene>> markers(numClusters, std::vector<MarkerGene>(numGenes));
+
+    parallelForBlocks(numGenes, GENES_PER_CHUNK, [&](size_t, size_t blockBegin, size_t blockEnd)
+    {
+        std::vector<float> chunk;
+        std::vector<std::pair<float, uint32_t>> sorted(numCells);
+        ClusterSums sums(numClusters);
+
+        for (size_t chunkBegin = blockBegin; chunkBegin < blockEnd; chunkBegin += GENES_PER_CHUNK)
+        {
+            const size_t chunkEnd = std::min(blockEnd, chunkBegin + GENES_PER_CHUNK);
+            const size_t chunkSize = chunkEnd - chunkBegin;
+
+            // Gather the chunk of genes row by row, so the matrix is read in contiguous runs
+            chunk.resize(numCells * chunkSize);
+            for (size_t i = 0; i < numCells; i++)
+            {
+                const float* rowData = expression.data.data() + rows[i] * expression.numCols;
+                std::copy(rowData + chunkBegin, rowData + chunkEnd, chunk.begin() + i * chunkSize);
+            }
+
+            for (size_t g = 0; g < chunkSize; g++)
+            {
+                const size_t gene = chunkBegin + g;
+
+                for (size_t i = 0; i < numCells; i++)
+                    sorted[i] = { chunk[i * chunkSize + g], static_cast<uint32_t>(i) };
+
+                // The single sort of this gene, shared by all clusters
+                std::sort(sorted.begin(), sorted.end());
+
+                sums.reset();
+                double tieCorrection = 0;
+                for (size_t begin = 0; begin < numCells;)
+                {
+                    size_t end = begin + 1;
+                    while (end < numCells && sorted[end].first == sorted[begin].first)
+                        end++;
+
+                    const double numTied = static_cast<double>(end - begin);
+                    tieCorrection += numTied * numTied * numTied - numTied;
+
+                    // Tied values get the average of their ranks, ranks start at 1
+                    const double rank = (begin + end + 1) / 2.0;
+                    const float value = sorted[begin].first;
+                    const double linearValue = std::expm1(static_cast<double>(value));
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        int cluster = labels[rows[sorted[i].second]];
+                        sums.rankSums[cluster] += rank;
+                        sums.logSums[cluster] += value;
+                        sums.linearSums[cluster] += linearValue;
+                        sums.numExpressing[cluster] += value > 0;
+                    }
+
+                    begin = end;
+                }
+
+                const double totalLogSum = std::accumulate(sums.logSums.begin(), sums.logSums.end(), 0.0);
+                const double totalLinearSum = std::accumulate(sums.linearSums.begin(), sums.linearSums.end(), 0.0);
+                const double totalExpressing = std::accumulate(sums.numExpressing.begin(), sums.numExpressing.end(), 0.0);
+
+                for (size_t c = 0; c < numClusters; c++)
+                {
+                    const double n1 = clusterSizes[c];
+                    const double n2 = numCells - n1;
+
+                    MarkerGene& marker = markers[c][gene];
+                    marker.gene = static_cast<uint32_t>(gene);
+                    marker.meanIn = n1 > 0 ? static_cast<float>(sums.logSums[c] / n1) : 0.0f;
+                    marker.meanOut = n2 > 0 ? static_cast<float>((totalLogSum - sums.logSums[c]) / n2) : 0.0f;
+                    marker.fractionIn = n1 > 0 ? static_cast<float>(sums.numExpressing[c] / n1) : 0.0f;
+                    marker.fractionOut = n2 > 0 ? static_cast<float>((totalExpressing - sums.numExpressing[c]) / n2) : 0.0f;
+
+                    const double linearMeanIn = n1 > 0 ? sums.linearSums[c] / n1 : 0;
+                    const double linearMeanOut = n2 > 0 ? (totalLinearSum - sums.linearSums[c]) / n2 : 0;
+                    marker.log2FoldChange = static_cast<float>(std::log2(linearMeanIn + 1) - std::log2(linearMeanOut + 1));
+
+                    marker.pValue = 1;
+                    if (n1 == 0 || n2 == 0)
+                        continue;
+
+                    // Normal approximation of the Mann-Whitney U statistic
+                    const double u = sums.rankSums[c] - n1 * (n1 + 1) / 2;
+                    const double meanU = n1 * n2 / 2;
+                    const double varianceU = n1 * n2 / 12 * ((numCells + 1) - tieCorrection / (static_cast<double>(numCells) * (numCells - 1)));
+                    if (varianceU <= 0)
+                        continue;
+
+                    const double deviation = std::max(std::abs(u - meanU) - 0.5, 0.0);
+                    marker.pValue = std::min(1.0, std::erfc(deviation / std::sqrt(2 * varianceU)));
+                }
+            }
+        }
+    });
+
+    // Rank the genes of every cluster
+    parallelFor(numClusters, 1, [&markers](size_t c)
+    {
+        std::sort(markers[c].begin(), markers[c].end(), [](const MarkerGene& a, const MarkerGene& b)
+        {
+            if (a.pValue != b.pValue)
+                return a.pValue < b.pValue;
+            return a.log2FoldChange > b.log2FoldChange;
+        });
+
+        AdjustPValues(markers[c]);
+    });
+
+    return markers;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class MatrixData;
+
+// Expression statistics of one gene in one cluster, compared to all other labelled cells
+struct MarkerGene
+{
+    uint32_t gene;
+    float meanIn;           // Mean log expression inside the cluster
+    float meanOut;          // Mean log expression outside the cluster
+    float fractionIn;       // Fraction of cells inside the cluster expressing the gene
+    float fractionOut;
+    float log2FoldChange;   // Of the mean linear expression, like Seurat's FindMarkers
+    double pValue;          // Two-sided Wilcoxon rank-sum test
+    double adjustedPValue;  // Benjamini-Hochberg over the genes of the cluster
+};
+
+// Differential expression of every gene in every cluster against the rest of the cells, over log1p of normalized counts.
+// labels holds the cluster of every row in [0, numClusters), or -1 to leave the row out.
+// The values of every gene are sorted once and the ranks are shared by all clusters, the rank-sum test uses the normal
+// approximation with tie and continuity correction. Genes are processed in parallel.
+// Returns the genes of every cluster sorted by p-value.
+std::vector<std::vector<MarkerGene>> ComputeDifferentialExpression(const MatrixData& expression, const std::vector<int>& labels, size_t numClusters);
@@ -0,0 +1,197 @@
+#include "LinearAlgebra.h"
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+    // Tile sizes that keep a panel of B in cache while a block of rows of A streams past it
+    constexpr size_t K_TILE = 256;
+    constexpr size_t ROWS_PER_BLOCK = 16;
+
+    double Dot(const float* a, const float* b, size_t n)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++)
+            sum += static_cast<double>(a[i]) * b[i];
+        return sum;
+    }
+}
+
+void MultiplyMatrices(const float* A, const float* B, float* C, size_t m, size_t k, size_t n)
+{
+    parallelForBlocks(m, ROWS_PER_BLOCK, [=](size_t, size_t begin, size_t end)
+    {
+        std::fill(C + begin * n, C + end * n, 0.0f);
+
+        for (size_t kBegin = 0; kBegin < k; kBegin += K_TILE)
+        {
+            size_t kEnd = std::min(k, kBegin + K_TILE);
+
+            for (size_t i = begin; i < end; i++)
+            {
+                float* cRow = C + i * n;
+                for (size_t p = kBegin; p < kEnd; p++)
+                {
+                    const float a = A[i * k + p];
+                    if (a == 0)
+                        continue;
+
+                    const float* bRow = B + p * n;
+                    for (size_t j = 0; j < n; j++)
+                        cRow[j] += a * bRow[j];
+                }
+            }
+        }
+    });
+}
+
+void MultiplyTransposed(const float* A, const float* B, float* C, size_t m, size_t k, size_t n)
+{
+    // Every block of rows adds its outer products to its own partial result, partials are summed in block order
+    std::vector<std::vector<float>> partials(numParallelBlocks(m, ROWS_PER_BLOCK));
+
+    parallelForBlocks(m, ROWS_PER_BLOCK, [=, &partials](size_t block, size_t begin, size_t end)
+    {
+        std::vector<float>& partial = partials[block];
+        partial.assign(k * n, 0.0f);
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const float* aRow = A + i * k;
+            const float* bRow = B + i * n;
+
+            for (size_t p = 0; p < k; p++)
+            {
+                const float a = aRow[p];
+                if (a == 0)
+                    continue;
+
+                float* cRow = partial.data() + p * n;
+                for (size_t j = 0; j < n; j++)
+                    cRow[j] += a * bRow[j];
+            }
+        }
+    });
+
+    std::fill(C, C + k * n, 0.0f);
+    for (const std::vector<float>& partial : partials)
+    {
+        for (size_t i = 0; i < partial.size(); i++)
+            C[i] += partial[i];
+    }
+}
+
+void OrthonormalizeColumns(std::vector<float>& A, size_t rows, size_t cols)
+{
+    // Work on contiguous column vectors
+    std::vector<float> columns(rows * cols);
+    for (size_t r = 0; r < rows; r++)
+        for (size_t c = 0; c < cols; c++)
+            columns[c * rows + r] = A[r * cols + c];
+
+    for (size_t c = 0; c < cols; c++)
+    {
+        float* v = columns.data() + c * rows;
+
+        // Orthogonalize twice against the previous columns for numerical stability
+        for (int pass = 0; pass < 2; pass++)
+        {
+            std::vector<double> projections(c);
+            parallelFor(c, 4, [&](size_t prev)
+            {
+                projections[prev] = Dot(columns.data() + prev * rows, v, rows);
+            });
+
+            for (size_t prev = 0; prev < c; prev++)
+            {
+                const float* u = columns.data() + prev * rows;
+                const float projection = static_cast<float>(projections[prev]);
+                for (size_t r = 0; r < rows; r++)
+                    v[r] -= projection * u[r];
+            }
+        }
+
+        double norm = std::sqrt(Dot(v, v, rows));
+        float scale = norm > 1e-12 ? static_cast<float>(1.0 / norm) : 0.0f;
+        for (size_t r = 0; r < rows; r++)
+            v[r] *= scale;
+    }
+
+    for (size_t r = 0; r < rows; r++)
+        for (size_t c = 0; c < cols; c++)
+            A[r * cols + c] = columns[c * rows + r];
+}
+
+void SymmetricEigen(std::vector<double> A, size_t n, std::vector<double>& eigenvalues, std::vector<double>& eigenvectors)
+{
+    std::vector<double> V(n * n, 0);
+    for (size_t i = 0; i < n; i++)
+        V[i * n + i] = 1;
+
+    for (int sweep = 0; sweep < 100; sweep++)
+    {
+        double offDiagonal = 0;
+        for (size_t p = 0; p < n; p++)
+            for (size_t q = p + 1; q < n; q++)
+                offDiagonal += A[p * n + q] * A[p * n + q];
+
+        if (offDiagonal < 1e-22)
+            break;
+
+        for (size_t p = 0; p < n; p++)
+        {
+            for (size_t q = p + 1; q < n; q++)
+            {
+                double apq = A[p * n + q];
+                if (std::abs(apq) < 1e-300)
+                    continue;
+
+                // Rotation that zeroes A[p][q]
+                double theta = (A[q * n + q] - A[p * n + p]) / (2 * apq);
+                double t = (theta >= 0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+                double c = 1 / std::sqrt(t * t + 1);
+                double s = t * c;
+
+                for (size_t i = 0; i < n; i++)
+                {
+                    double aip = A[i * n + p];
+                    double aiq = A[i * n + q];
+                    A[i * n + p] = c * aip - s * aiq;
+                    A[i * n + q] = s * aip + c * aiq;
+                }
+                for (size_t i = 0; i < n; i++)
+                {
+                    double api = A[p * n + i];
+                    double aqi = A[q * n + i];
+                    A[p * n + i] = c * api - s * aqi;
+                    A[q * n + i] = s * api + c * aqi;
+                }
+                for (size_t i = 0; i < n; i++)
+                {
+                    double vip = V[i * n + p];
+                    double viq = V[i * n + q];
+                    V[i * n + p] = c * vip - s * viq;
+                    V[i * n + q] = s * vip + c * viq;
+                }
+            }
+        }
+    }
+
+    // Sort eigenpairs by descending eigenvalue
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&A, n](size_t a, size_t b) { return A[a * n + a] > A[b * n + b]; });
+
+    eigenvalues.resize(n);
+    eigenvectors.resize(n * n);
+    for (size_t j = 0; j < n; j++)
+    {
+        eigenvalues[j] = A[order[j] * n + order[j]];
+        for (size_t i = 0; i < n; i++)
+            eigenvectors[i * n + j] = V[i * n + order[j]];
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Dense kernels over row-major float matrices, multithreaded over blocks of output rows
+
+// C (m x n) = A (m x k) * B (k x n)
+void MultiplyMatrices(const float* A, const float* B, float* C, size_t m, size_t k, size_t n);
+
+// C (k x n) = A^T * B, with A (m x k) and B (m x n)
+void MultiplyTransposed(const float* A, const float* B, float* C, size_t m, size_t k, size_t n);
+
+// Makes the columns of the row-major A (rows x cols) orthonormal in place (modified Gram-Schmidt)
+void OrthonormalizeColumns(std::vector<float>& A, size_t rows, size_t cols);
+
+// Eigen decomposition of the symmetric row-major A (n x n) with the cyclic Jacobi method.
+// Eigenvalues are sorted descending, eigenvector i is stored in column i of the row-major eigenvectors.
+void SymmetricEigen(std::vector<double> A, size_t n, std::vector<double>& eigenvalues, std::vector<double>& eigenvectors);
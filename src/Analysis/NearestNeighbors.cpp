@@ -0,0 +1,500 @@
+#include "NearestNeighbors.h"
+
+#include "Parallel.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <random>
+
+namespace
+{
+    constexpr quint32 INDEX_FILE_MAGIC = 0x484E5357; // "HNSW"
+    constexpr quint32 INDEX_FILE_VERSION = 1;
+
+    constexpr int MAX_LEVEL = 16;
+
+    using Candidate = std::pair<float, uint32_t>;
+
+    // Per-thread visited markers, reused across searches by bumping the tag instead of clearing
+    class VisitedSet
+    {
+    public:
+        void reset(size_t size)
+        {
+            if (_tags.size() < size)
+            {
+                _tags.assign(size, 0);
+                _tag = 0;
+            }
+
+            if (++_tag == 0)
+            {
+                std::fill(_tags.begin(), _tags.end(), 0);
+                _tag = 1;
+            }
+        }
+
+        bool visit(uint32_t index)
+        {
+            if (_tags[index] == _tag)
+                return false;
+            _tags[index] = _tag;
+            return true;
+        }
+
+    private:
+        std::vector<uint32_t> _tags;
+        uint32_t _tag = 0;
+    };
+
+    thread_local VisitedSet visitedSet;
+}
+
+HNSWIndex::HNSWIndex(size_t numDimensions, size_t maxNeighbors, size_t efConstruction) :
+    _numDimensions(numDimensions),
+    _maxNeighbors(maxNeighbors),
+    _efConstruction(efConstruction)
+{
+
+}
+
+void HNSWIndex::build(const float* points, size_t numPoints)
+{
+    _numPoints = numPoints;
+    _points.clear();
+    _points.append(points, numPoints * _numDimensions);
+
+    _links.assign(numPoints, {});
+    _levels.resize(numPoints);
+    _linkLocks = std::make_unique<std::mutex[]>(numPoints);
+
+    if (numPoints == 0)
+        return;
+
+    // Draw the level of every point up front with a fixed seed, so only the insertion order varies between threads
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> uniform(std::numeric_limits<double>::min(), 1.0);
+    const double levelMultiplier = 1.0 / std::log(static_cast<double>(std::max<size_t>(_maxNeighbors, 2)));
+    for (size_t i = 0; i < numPoints; i++)
+    {
+        _levels[i] = std::min(static_cast<int>(-std::log(uniform(rng)) * levelMultiplier), MAX_LEVEL);
+        _links[i].resize(_levels[i] + 1);
+    }
+
+    _entryPoint = 0;
+    _maxLevel = _levels[0];
+
+    parallelFor(numPoints - 1, 64, [this](size_t i)
+    {
+        insert(static_cast<uint32_t>(i + 1));
+    });
+}
+
+std::vector<std::pair<float, uint32_t>> HNSWIndex::search(const float* query, size_t k, size_t ef) const
+{
+    if (_numPoints == 0)
+        return {};
+
+    // Greedy descent through the upper levels
+    uint32_t entryPoint = _entryPoint;
+    float entryDistance = distance(query, point(entryPoint));
+    for (int level = _maxLevel; level > 0; level--)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (uint32_t neighbor : _links[entryPoint][level])
+            {
+                float d = distance(query, point(neighbor));
+                if (d < entryDistance)
+                {
+                    entryDistance = d;
+                    entryPoint = neighbor;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<Candidate> nearest = searchLayer<false>(query, entryPoint, std::max(ef, k), 0);
+    if (nearest.size() > k)
+        nearest.resize(k);
+
+    return nearest;
+}
+
+std::vector<uint32_t> HNSWIndex::findNeighbors(uint32_t pointIndex, size_t k, size_t ef) const
+{
+    std::vector<Candidate> nearest = search(point(pointIndex), k + 1, ef);
+
+    std::vector<uint32_t> neighbors;
+    neighbors.reserve(k);
+    for (const Candidate& candidate : nearest)
+    {
+        if (candidate.second != pointIndex && neighbors.size() < k)
+            neighbors.push_back(candidate.second);
+    }
+
+    return neighbors;
+}
+
+std::vector<uint32_t> HNSWIndex::computeKnnGraph(size_t k, size_t ef) const
+{
+    std::vector<uint32_t> graph(_numPoints * k);
+
+    parallelFor(_numPoints, 64, [this, k, ef, &graph](size_t i)
+    {
+        std::vector<uint32_t> neighbors = findNeighbors(static_cast<uint32_t>(i), k, ef);
+
+        // Pad with the point itself when the graph has fewer reachable neighbours than requested
+        neighbors.resize(k, static_cast<uint32_t>(i));
+        std::copy(neighbors.begin(), neighbors.end(), graph.begin() + i * k);
+    });
+
+    return graph;
+}
+
+void HNSWIndex::insert(uint32_t q)
+{
+    const int level = _levels[q];
+    const float* queryPoint = point(q);
+
+    uint32_t entryPoint;
+    int maxLevel;
+    {
+        std::lock_guard<std::mutex> lock(_entryLock);
+        entryPoint = _entryPoint;
+        maxLevel = _maxLevel;
+    }
+
+    // Greedy descent through the levels above the level of the new point
+    float entryDistance = distance(queryPoint, point(entryPoint));
+    for (int lc = maxLevel; lc > level; lc--)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (uint32_t neighbor : getLinks(entryPoint, lc))
+            {
+                float d = distance(queryPoint, point(neighbor));
+                if (d < entryDistance)
+                {
+                    entryDistance = d;
+                    entryPoint = neighbor;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Connect the new point on every level it lives on
+    for (int lc = std::min(level, maxLevel); lc >= 0; lc--)
+    {
+        std::vector<Candidate> candidates = searchLayer<true>(queryPoint, entryPoint, _efConstruction, lc);
+        std::vector<uint32_t> neighbors = selectNeighbors(candidates, _maxNeighbors);
+
+        {
+            std::lock_guard<std::mutex> lock(_linkLocks[q]);
+            _links[q][lc] = neighbors;
+        }
+
+        const size_t maxLinks = lc == 0 ? 2 * _maxNeighbors : _maxNeighbors;
+        for (uint32_t neighbor : neighbors)
+        {
+            std::lock_guard<std::mutex> lock(_linkLocks[neighbor]);
+
+            std::vector<uint32_t>& links = _links[neighbor][lc];
+            links.push_back(q);
+
+            // Shrink the neighbour's links back to the maximum with the same heuristic
+            if (links.size() > maxLinks)
+            {
+                std::vector<Candidate> linkCandidates;
+                linkCandidates.reserve(links.size());
+                for (uint32_t link : links)
+                    linkCandidates.emplace_back(distance(point(neighbor), point(link)), link);
+                std::sort(linkCandidates.begin(), linkCandidates.end());
+
+                links = selectNeighbors(linkCandidates, maxLinks);
+            }
+        }
+
+        if (!candidates.empty())
+            entryPoint = candidates[0].second;
+    }
+
+    if (level > maxLevel)
+    {
+        std::lock_guard<std::mutex> lock(_entryLock);
+        if (level > _maxLevel)
+        {
+            _maxLevel = level;
+            _entryPoint = q;
+        }
+    }
+}
+
+// While building, links of other points can change underneath the search, so they are copied under their lock
+template<bool Concurrent>
+std::vector<std::pair<float, uint32_t>> HNSWIndex::searchLayer(const float* query, uint32_t entryPoint, size_t ef, int level) const
+{
+    visitedSet.reset(_numPoints);
+    visitedSet.visit(entryPoint);
+
+    // Closest unexpanded candidates first, furthest of the current results on top
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+    std::priority_queue<Candidate> results;
+
+    float entryDistance = distance(query, point(entryPoint));
+    candidates.emplace(entryDistance, entryPoint);
+    results.emplace(entryDistance, entryPoint);
+
+    while (!candidates.empty())
+    {
+        Candidate current = candidates.top();
+        if (current.first > results.top().first && results.size() >= ef)
+            break;
+        candidates.pop();
+
+        std::vector<uint32_t> lockedLinks;
+        if constexpr (Concurrent)
+            lockedLinks = getLinks(current.second, level);
+        const std::vector<uint32_t>& links = Concurrent ? lockedLinks : _links[current.second][level];
+
+        for (uint32_t neighbor : links)
+        {
+            if (!visitedSet.visit(neighbor))
+                continue;
+
+            float d = distance(query, point(neighbor));
+            if (results.size() < ef || d < results.top().first)
+            {
+                candidates.emplace(d, neighbor);
+                results.emplace(d, neighbor);
+                if (results.size() > ef)
+                    results.pop();
+            }
+        }
+    }
+
+    std::vector<Candidate> nearest(results.size());
+    for (size_t i = nearest.size(); i > 0; i--)
+    {
+        nearest[i - 1] = results.top();
+        results.pop();
+    }
+
+    return nearest;
+}
+
+std::vector<uint32_t> HNSWIndex::selectNeighbors(const std::vector<Candidate>& candidates, size_t maxNeighbors) const
+{
+    // Keep a candidate only if it is closer to the base point than to any neighbour selected so far,
+    // this spreads the links over different directions
+    std::vector<uint32_t> selected;
+    std::vector<uint32_t> pruned;
+    for (const Candidate& candidate : candidates)
+    {
+        if (selected.size() >= maxNeighbors)
+            break;
+
+        bool keep = true;
+        for (uint32_t neighbor : selected)
+        {
+            if (distance(point(candidate.second), point(neighbor)) < candidate.first)
+            {
+                keep = false;
+                break;
+            }
+        }
+
+        if (keep)
+            selected.push_back(candidate.second);
+        else
+            pruned.push_back(candidate.second);
+    }
+
+    // Fill up with the closest pruned candidates so sparse regions stay connected
+    for (size_t i = 0; i < pruned.size() && selected.size() < maxNeighbors; i++)
+        selected.push_back(pruned[i]);
+
+    return selected;
+}
+
+std::vector<uint32_t> HNSWIndex::getLinks(uint32_t index, int level) const
+{
+    std::lock_guard<std::mutex> lock(_linkLocks[index]);
+    return _links[index][level];
+}
+
+float HNSWIndex::distance(const float* a, const float* b) const
+{
+    float sum = 0;
+    for (size_t i = 0; i < _numDimensions; i++)
+    {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+uint64_t HNSWIndex::hashPoints(const float* points, size_t numPoints, size_t numDimensions)
+{
+    // FNV-1a over the raw bytes and the shape
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const unsigned char* bytes, size_t numBytes)
+    {
+        for (size_t i = 0; i < numBytes; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+
+    mix(reinterpret_cast<const unsigned char*>(&numPoints), sizeof(numPoints));
+    mix(reinterpret_cast<const unsigned char*>(&numDimensions), sizeof(numDimensions));
+    mix(reinterpret_cast<const unsigned char*>(points), numPoints * numDimensions * sizeof(float));
+
+    return hash;
+}
+
+bool HNSWIndex::save(const QString& filePath, uint64_t dataHash) const
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Failed to write nearest neighbour index to:" << filePath;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out << INDEX_FILE_MAGIC << INDEX_FILE_VERSION << quint64(dataHash);
+    out << quint64(_numDimensions) << quint64(_maxNeighbors) << quint64(_efConstruction) << quint64(_numPoints);
+    out << quint32(_entryPoint) << qint32(_maxLevel);
+
+    out.writeRawData(reinterpret_cast<const char*>(_points.data()), static_cast<int>(_points.size() * sizeof(float)));
+
+    for (size_t i = 0; i < _numPoints; i++)
+    {
+        out << qint32(_levels[i]);
+        for (const std::vector<uint32_t>& links : _links[i])
+        {
+            out << quint32(links.size());
+            out.writeRawData(reinterpret_cast<const char*>(links.data()), static_cast<int>(links.size() * sizeof(uint32_t)));
+        }
+    }
+
+    return out.status() == QDataStream::Ok;
+}
+
+bool HNSWIndex::load(const QString& filePath, uint64_t dataHash)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::LittleEndian);
+
+    quint32 magic, version;
+    quint64 hash, numDimensions, maxNeighbors, efConstruction, numPoints;
+    quint32 entryPoint;
+    qint32 maxLevel;
+    in >> magic >> version >> hash;
+    if (in.status() != QDataStream::Ok || magic != INDEX_FILE_MAGIC || version != INDEX_FILE_VERSION || hash != dataHash)
+        return false;
+
+    in >> numDimensions >> maxNeighbors >> efConstruction >> numPoints >> entryPoint >> maxLevel;
+
+    // The file is only trusted as far as it is consistent, a corrupt one is rebuilt instead of crashing a search. The
+    // points must fit in the file before they are allocated.
+    const bool isConsistent = in.status() == QDataStream::Ok
+        && (_numDimensions == 0 || numDimensions == _numDimensions)
+        && numDimensions > 0 && maxNeighbors > 0
+        && numPoints <= static_cast<quint64>(file.size()) / (numDimensions * sizeof(float))
+        && maxLevel >= -1 && maxLevel <= MAX_LEVEL
+        && (numPoints == 0 ? maxLevel == -1 : entryPoint < numPoints && maxLevel >= 0);
+    if (!isConsistent)
+    {
+        qWarning() << "Ignoring an inconsistent nearest neighbour index:" << filePath;
+        return false;
+    }
+
+    std::vector<float> points(numPoints * numDimensions);
+    in.readRawData(reinterpret_cast<char*>(points.data()), static_cast<int>(points.size() * sizeof(float)));
+
+    std::vector<int> levels(numPoints);
+    std::vector<std::vector<std::vector<uint32_t>>> links(numPoints);
+    for (size_t i = 0; i < numPoints && in.status() == QDataStream::Ok; i++)
+    {
+        qint32 level;
+        in >> level;
+        if (level < 0 || level > maxLevel)
+        {
+            qWarning() << "Ignoring a nearest neighbour index with an invalid level:" << filePath;
+            return false;
+        }
+
+        levels[i] = level;
+        links[i].resize(level + 1);
+        for (int lc = 0; lc <= level; lc++)
+        {
+            const quint64 maxLinks = lc == 0 ? 2 * maxNeighbors : maxNeighbors;
+
+            quint32 numLinks;
+            in >> numLinks;
+            if (numLinks > maxLinks)
+            {
+                qWarning() << "Ignoring a nearest neighbour index with too many links:" << filePath;
+                return false;
+            }
+
+            std::vector<uint32_t>& pointLinks = links[i][lc];
+            pointLinks.resize(numLinks);
+            in.readRawData(reinterpret_cast<char*>(pointLinks.data()), static_cast<int>(numLinks * sizeof(uint32_t)));
+
+            if (std::any_of(pointLinks.begin(), pointLinks.end(), [numPoints](uint32_t link) { return link >= numPoints; }))
+            {
+                qWarning() << "Ignoring a nearest neighbour index with links outside of it:" << filePath;
+                return false;
+            }
+        }
+    }
+
+    // Links on a level go to points that reach that level
+    for (size_t i = 0; i < numPoints; i++)
+    {
+        for (int lc = 1; lc <= levels[i]; lc++)
+        {
+            if (std::any_of(links[i][lc].begin(), links[i][lc].end(), [&levels, lc](uint32_t link) { return levels[link] < lc; }))
+                return false;
+        }
+    }
+
+    if (in.status() != QDataStream::Ok || (numPoints > 0 && levels[entryPoint] != maxLevel))
+        return false;
+
+    _numDimensions = numDimensions;
+    _maxNeighbors = maxNeighbors;
+    _efConstruction = efConstruction;
+    _numPoints = numPoints;
+    _entryPoint = entryPoint;
+    _maxLevel = maxLevel;
+    _points.clear();
+    _points.append(points.data(), points.size());
+    _levels = std::move(levels);
+    _links = std::move(links);
+    _linkLocks = std::make_unique<std::mutex[]>(_numPoints);
+
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "MatrixStorage.h"
+
+#include <QString>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Approximate k-nearest-neighbour index over the rows of a matrix, using a hierarchical navigable
+// small world graph (Malkov & Yashunin). Points are inserted in parallel, queries visit a few hundred
+// points instead of all of them. The index keeps its own copy of the points so it can be persisted.
+class HNSWIndex
+{
+public:
+    HNSWIndex(size_t numDimensions = 0, size_t maxNeighbors = 16, size_t efConstruction = 200);
+
+    // Keep the copy of the points in a memory-mapped temporary file, for points that do not fit in memory
+    bool useFileStorage() { return _points.mapFile(); }
+
+    void build(const float* points, size_t numPoints);
+
+    // Nearest points to the query as (squared euclidean distance, point index), closest first
+    std::vector<std::pair<float, uint32_t>> search(const float* query, size_t k, size_t ef = 64) const;
+
+    // The k nearest neighbours of an indexed point, excluding the point itself
+    std::vector<uint32_t> findNeighbors(uint32_t pointIndex, size_t k, size_t ef = 64) const;
+
+    // The k nearest neighbours of every point, excluding the point itself, row-major (numPoints x k)
+    std::vector<uint32_t> computeKnnGraph(size_t k, size_t ef = 64) const;
+
+    size_t numPoints() const { return _numPoints; }
+    size_t numDimensions() const { return _numDimensions; }
+
+    // Persisting, the hash identifies the data the index was built on so stale files are ignored
+    static uint64_t hashPoints(const float* points, size_t numPoints, size_t numDimensions);
+    bool save(const QString& filePath, uint64_t dataHash) const;
+    bool load(const QString& filePath, uint64_t dataHash);
+
+private:
+    void insert(uint32_t point);
+    template<bool Concurrent>
+    std::vector<std::pair<float, uint32_t>> searchLayer(const float* query, uint32_t entryPoint, size_t ef, int level) const;
+    std::vector<uint32_t> selectNeighbors(const std::vector<std::pair<float, uint32_t>>& candidates, size_t maxNeighbors) const;
+    std::vector<uint32_t> getLinks(uint32_t point, int level) const;
+
+    float distance(const float* a, const float* b) const;
+    const float* point(uint32_t index) const { return _points.data() + static_cast<size_t>(index) * _numDimensions; }
+
+private:
+    size_t _numDimensions;
+    size_t _maxNeighbors;
+    size_t _efConstruction;
+
+    size_t _numPoints = 0;
+    MatrixStorage _points;
+
+    std::vector<int> _levels;
+    std::vector<std::vector<std::vector<uint32_t>>> _links; // Per point, per level, the linked points
+    uint32_t _entryPoint = 0;
+    int _maxLevel = -1;
+
+    // Guards the links of every point, and the entry point, while inserting in parallel
+    std::unique_ptr<std::mutex[]> _linkLocks;
+    std::mutex _entryLock;
+};
@@ -0,0 +1,132 @@
+#include "PCA.h"
+
+#include "LinearAlgebra.h"
+#include "MatrixData.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace
+{
+    // Y (n x l) = (X - 1 mu^T) * B, with X (n x d) and B (d x l)
+    void MultiplyCentered(const MatrixData& X, const std::vector<float>& mu, const std::vector<float>& B, std::vector<float>& Y, size_t l)
+    {
+        const size_t n = X.numRows;
+        const size_t d = X.numCols;
+
+        MultiplyMatrices(X.data.data(), B.data(), Y.data(), n, d, l);
+
+        std::vector<float> muB(l, 0);
+        for (size_t p = 0; p < d; p++)
+            for (size_t j = 0; j < l; j++)
+                muB[j] += mu[p] * B[p * l + j];
+
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < l; j++)
+                Y[i * l + j] -= muB[j];
+    }
+
+    // Z (d x l) = (X - 1 mu^T)^T * Q, with X (n x d) and Q (n x l)
+    void MultiplyTransposedCentered(const MatrixData& X, const std::vector<float>& mu, const std::vector<float>& Q, std::vector<float>& Z, size_t l)
+    {
+        const size_t n = X.numRows;
+        const size_t d = X.numCols;
+
+        MultiplyTransposed(X.data.data(), Q.data(), Z.data(), n, d, l);
+
+        std::vector<float> columnSums(l, 0);
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < l; j++)
+                columnSums[j] += Q[i * l + j];
+
+        for (size_t p = 0; p < d; p++)
+            for (size_t j = 0; j < l; j++)
+                Z[p * l + j] -= mu[p] * columnSums[j];
+    }
+}
+
+void ComputeRandomizedPCA(const MatrixData& matrix, size_t numComponents, MatrixData& scores, std::vector<float>& explainedVariance, int numPowerIterations, size_t numOversamples)
+{
+    const size_t n = matrix.numRows;
+    const size_t d = matrix.numCols;
+
+    numComponents = std::min(numComponents, std::min(n, d));
+    const size_t l = std::min(numComponents + numOversamples, std::min(n, d));
+
+    scores.headers.clear();
+    scores.data.clear();
+    scores.numRows = n;
+    scores.numCols = numComponents;
+    explainedVariance.clear();
+
+    if (numComponents == 0)
+        return;
+
+    std::vector<float> mu = matrix.computeColumnStatistics().means();
+
+    // Gaussian test matrix, seeded so that repeated loads give the same embedding
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    std::vector<float> omega(d * l);
+    for (float& v : omega)
+        v = gaussian(rng);
+
+    // Sample the range of the centered data
+    std::vector<float> Q(n * l);
+    MultiplyCentered(matrix, mu, omega, Q, l);
+    OrthonormalizeColumns(Q, n, l);
+
+    // Power iterations sharpen the decay of the spectrum so the leading components are captured accurately
+    std::vector<float> Z(d * l);
+    for (int it = 0; it < numPowerIterations; it++)
+    {
+        MultiplyTransposedCentered(matrix, mu, Q, Z, l);
+        OrthonormalizeColumns(Z, d, l);
+        MultiplyCentered(matrix, mu, Z, Q, l);
+        OrthonormalizeColumns(Q, n, l);
+    }
+
+    // Project the data onto the sampled range, B^T = Xc^T Q is d x l
+    std::vector<float> Bt(d * l);
+    MultiplyTransposedCentered(matrix, mu, Q, Bt, l);
+
+    // The eigen decomposition of B B^T gives the left singular vectors and squared singular values of B
+    std::vector<double> BBt(l * l, 0);
+    for (size_t p = 0; p < d; p++)
+    {
+        const float* row = Bt.data() + p * l;
+        for (size_t a = 0; a < l; a++)
+            for (size_t b = a; b < l; b++)
+                BBt[a * l + b] += static_cast<double>(row[a]) * row[b];
+    }
+    for (size_t a = 0; a < l; a++)
+        for (size_t b = 0; b < a; b++)
+            BBt[a * l + b] = BBt[b * l + a];
+
+    std::vector<double> eigenvalues;
+    std::vector<double> U;
+    SymmetricEigen(BBt, l, eigenvalues, U);
+
+    // Scores are Xc V = Q U S, where S holds the singular values
+    std::vector<float> QU(l * numComponents);
+    for (size_t j = 0; j < l; j++)
+    {
+        for (size_t c = 0; c < numComponents; c++)
+        {
+            double singularValue = std::sqrt(std::max(eigenvalues[c], 0.0));
+            QU[j * numComponents + c] = static_cast<float>(U[j * l + c] * singularValue);
+        }
+    }
+
+    scores.data.resize(n * numComponents);
+    MultiplyMatrices(Q.data(), QU.data(), scores.data.data(), n, l, numComponents);
+
+    for (size_t c = 0; c < numComponents; c++)
+    {
+        scores.headers.push_back(QString("PC %1").arg(c + 1));
+        explainedVariance.push_back(n > 1 ? static_cast<float>(std::max(eigenvalues[c], 0.0) / (n - 1)) : 0.0f);
+    }
+}
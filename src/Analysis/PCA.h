@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class MatrixData;
+
+// Randomized PCA (Halko, Martinsson & Tropp) of the rows of a matrix. The matrix is centered implicitly,
+// so the input is never copied. The range of the data is sampled with a random projection and refined
+// with power iterations, the exact SVD of the small projected problem then gives the components.
+// Fills scores with the projection of every row onto the components, with headers "PC 1", "PC 2", ..
+void ComputeRandomizedPCA(const MatrixData& matrix, size_t numComponents, MatrixData& scores, std::vector<float>& explainedVariance, int numPowerIterations = 4, size_t numOversamples = 10);
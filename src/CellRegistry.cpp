@@ -0,0 +1,86 @@
+#include "CellRegistry.h"
+
+#include "Tracing.h"
+
+std::vector<uint32_t> CellRegistry::registerCells(const std::vector<QString>& cellIds)
+{
+    std::vector<uint32_t> cells(cellIds.size(), INVALID_CELL);
+
+    _cellIndices.reserve(_cellIndices.size() + cellIds.size());
+    for (size_t i = 0; i < cellIds.size(); i++)
+    {
+        const QString& cellId = cellIds[i];
+        if (cellId.isEmpty())
+            continue;
+
+        auto it = _cellIndices.constFind(cellId);
+        if (it == _cellIndices.constEnd())
+        {
+            it = _cellIndices.insert(cellId, static_cast<uint32_t>(_cellIds.size()));
+            _cellIds.push_back(cellId);
+        }
+
+        cells[i] = it.value();
+    }
+
+    return cells;
+}
+
+std::vector<uint32_t> CellRegistry::registerCells(const QStringList& cellIds)
+{
+    return registerCells(std::vector<QString>(cellIds.begin(), cellIds.end()));
+}
+
+std::vector<uint32_t> CellRegistry::findCells(const std::vector<QString>& cellIds) const
+{
+    std::vector<uint32_t> cells(cellIds.size(), INVALID_CELL);
+
+    for (size_t i = 0; i < cellIds.size(); i++)
+    {
+        auto it = _cellIndices.constFind(cellIds[i]);
+        if (it != _cellIndices.constEnd())
+            cells[i] = it.value();
+    }
+
+    return cells;
+}
+
+uint32_t RowMap::firstTargetRow(size_t row) const
+{
+    return offsets[row] != offsets[row + 1] ? rows[offsets[row]] : CellRegistry::INVALID_CELL;
+}
+
+RowMap CellRegistry::mapRows(const std::vector<uint32_t>& sourceCells, const std::vector<uint32_t>& targetCells) const
+{
+    TRACE_SCOPE("Join");
+
+    // Inverse of the target rows grouped by cell, the rows of cell c are cellRows[cellOffsets[c]] up to cellOffsets[c + 1]
+    std::vector<uint32_t> cellOffsets(_cellIds.size() + 1, 0);
+    for (uint32_t cell : targetCells)
+    {
+        if (cell != INVALID_CELL)
+            cellOffsets[cell + 1]++;
+    }
+    for (size_t cell = 0; cell < _cellIds.size(); cell++)
+        cellOffsets[cell + 1] += cellOffsets[cell];
+
+    std::vector<uint32_t> cellRows(cellOffsets.back());
+    std::vector<uint32_t> fill(cellOffsets.begin(), cellOffsets.end() - 1);
+    for (uint32_t row = 0; row < targetCells.size(); row++)
+    {
+        if (targetCells[row] != INVALID_CELL)
+            cellRows[fill[targetCells[row]]++] = row;
+    }
+
+    RowMap rowMap;
+    rowMap.offsets.resize(sourceCells.size() + 1, 0);
+    for (size_t i = 0; i < sourceCells.size(); i++)
+    {
+        const uint32_t cell = sourceCells[i];
+        if (cell != INVALID_CELL)
+            rowMap.rows.insert(rowMap.rows.end(), cellRows.begin() + cellOffsets[cell], cellRows.begin() + cellOffsets[cell + 1]);
+        rowMap.offsets[i + 1] = static_cast<uint32_t>(rowMap.rows.size());
+    }
+
+    return rowMap;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+// Rows of a target dataset for every row of a source dataset, a cell can occur in several rows of the target. The
+// target rows of source row i are rows[offsets[i]] up to rows[offsets[i + 1]], in ascending order.
+class RowMap
+{
+public:
+    size_t numSourceRows() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+    std::span<const uint32_t> targetRows(size_t row) const
+    {
+        return { rows.data() + offsets[row], rows.data() + offsets[row + 1] };
+    }
+
+    // First target row of a source row, or INVALID_CELL, for targets that hold every cell once
+    uint32_t firstTargetRow(size_t row) const;
+
+public:
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> rows;
+};
+
+// Assigns every cell ID a dense index once, shared by all linked datasets. A dataset registers the cell IDs of its
+// rows a single time and keeps the resulting index array, joins between datasets are then plain array lookups.
+class CellRegistry
+{
+public:
+    static constexpr uint32_t INVALID_CELL = std::numeric_limits<uint32_t>::max();
+
+    // Dense cell index of every ID, new IDs are added to the registry. Empty IDs get INVALID_CELL.
+    std::vector<uint32_t> registerCells(const std::vector<QString>& cellIds);
+    std::vector<uint32_t> registerCells(const QStringList& cellIds);
+
+    // Dense cell index of every ID, or INVALID_CELL for IDs that were never registered
+    std::vector<uint32_t> findCells(const std::vector<QString>& cellIds) const;
+
+    size_t numCells() const { return _cellIds.size(); }
+    const QString& getCellId(uint32_t cell) const { return _cellIds[cell]; }
+
+    // For every row of the source dataset, all rows of the target dataset holding the same cell. Both datasets are
+    // given by the cell indices of their rows.
+    RowMap mapRows(const std::vector<uint32_t>& sourceCells, const std::vector<uint32_t>& targetCells) const;
+
+private:
+    QHash<QString, uint32_t> _cellIndices;
+    std::vector<QString> _cellIds;
+};
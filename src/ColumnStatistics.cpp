@@ -0,0 +1,136 @@
+#include "ColumnStatistics.h"
+
+#include "MatrixData.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+ColumnStatistics::ColumnStatistics(size_t numCols) :
+    _means(numCols, 0),
+    _m2(numCols, 0),
+    _counts(numCols, 0),
+    _mins(numCols, std::numeric_limits<float>::infinity()),
+    _maxs(numCols, -std::numeric_limits<float>::infinity())
+{
+
+}
+
+void ColumnStatistics::addRow(const float* row)
+{
+    const size_t numCols = _means.size();
+
+    double* means = _means.data();
+    double* m2 = _m2.data();
+    double* counts = _counts.data();
+    float* mins = _mins.data();
+    float* maxs = _maxs.data();
+
+    // Branch-free Welford update over the contiguous row, missing values contribute
+    // a zero deviation and leave the count untouched
+    for (size_t c = 0; c < numCols; c++)
+    {
+        const float v = row[c];
+        const double valid = v != MISSING_VALUE ? 1.0 : 0.0;
+
+        const double n = counts[c] + valid;
+        const double delta = (static_cast<double>(v) - means[c]) * valid;
+
+        means[c] += delta / std::max(n, 1.0);
+        m2[c] += delta * (static_cast<double>(v) - means[c]);
+        counts[c] = n;
+
+        const float lo = v != MISSING_VALUE ? v : std::numeric_limits<float>::infinity();
+        const float hi = v != MISSING_VALUE ? v : -std::numeric_limits<float>::infinity();
+        mins[c] = std::min(mins[c], lo);
+        maxs[c] = std::max(maxs[c], hi);
+    }
+
+    _numRows++;
+}
+
+void ColumnStatistics::addRows(const float* rows, size_t numRows)
+{
+    const size_t numCols = _means.size();
+
+    for (size_t r = 0; r < numRows; r++)
+        addRow(rows + r * numCols);
+}
+
+void ColumnStatistics::merge(const ColumnStatistics& other)
+{
+    if (_means.empty())
+    {
+        *this = other;
+        return;
+    }
+
+    for (size_t c = 0; c < _means.size(); c++)
+    {
+        const double na = _counts[c];
+        const double nb = other._counts[c];
+        const double n = na + nb;
+
+        if (n == 0)
+            continue;
+
+        const double delta = other._means[c] - _means[c];
+
+        _means[c] += delta * (nb / n);
+        _m2[c] += other._m2[c] + delta * delta * (na * nb / n);
+        _counts[c] = n;
+
+        _mins[c] = std::min(_mins[c], other._mins[c]);
+        _maxs[c] = std::max(_maxs[c], other._maxs[c]);
+    }
+
+    _numRows += other._numRows;
+}
+
+float ColumnStatistics::variance(size_t col) const
+{
+    if (_counts[col] == 0)
+        return 0;
+
+    return static_cast<float>(_m2[col] / _counts[col]);
+}
+
+float ColumnStatistics::stdDev(size_t col) const
+{
+    return std::sqrt(variance(col));
+}
+
+std::vector<float> ColumnStatistics::means() const
+{
+    std::vector<float> result(_means.size());
+    for (size_t c = 0; c < _means.size(); c++)
+        result[c] = mean(c);
+    return result;
+}
+
+std::vector<float> ColumnStatistics::stdDevs() const
+{
+    std::vector<float> result(_means.size());
+    for (size_t c = 0; c < _means.size(); c++)
+        result[c] = stdDev(c);
+    return result;
+}
+
+void ColumnStatistics::selectColumns(const std::vector<int>& cols)
+{
+    ColumnStatistics selection(cols.size());
+    selection._numRows = _numRows;
+
+    for (size_t j = 0; j < cols.size(); j++)
+    {
+        int col = cols[j];
+
+        selection._means[j] = _means[col];
+        selection._m2[j] = _m2[col];
+        selection._counts[j] = _counts[col];
+        selection._mins[j] = _mins[col];
+        selection._maxs[j] = _maxs[col];
+    }
+
+    *this = selection;
+}
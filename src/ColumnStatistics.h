@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-column mean, variance, min, max and missing value count of a row-major matrix.
+// Rows are streamed in with addRow() (Welford's algorithm), partial statistics of
+// separate row blocks can be combined with merge() (Chan et al.).
+class ColumnStatistics
+{
+public:
+    ColumnStatistics() = default;
+    ColumnStatistics(size_t numCols);
+
+    void addRow(const float* row);
+    void addRows(const float* rows, size_t numRows);
+    void merge(const ColumnStatistics& other);
+
+    size_t numColumns() const { return _means.size(); }
+    size_t numRows() const { return _numRows; }
+
+    float mean(size_t col) const { return static_cast<float>(_means[col]); }
+    float variance(size_t col) const;
+    float stdDev(size_t col) const;
+    float min(size_t col) const { return _mins[col]; }
+    float max(size_t col) const { return _maxs[col]; }
+    size_t numValues(size_t col) const { return static_cast<size_t>(_counts[col]); }
+    size_t numMissing(size_t col) const { return _numRows - numValues(col); }
+
+    std::vector<float> means() const;
+    std::vector<float> stdDevs() const;
+
+    // Keep only the statistics of the given columns, in the given order
+    void selectColumns(const std::vector<int>& cols);
+
+private:
+    size_t _numRows = 0;
+
+    std::vector<double> _means;
+    std::vector<double> _m2;    // Sum of squared deviations from the mean
+    std::vector<double> _counts;  // Doubles, as the branch-free update adds 0 or 1 in floating point
+    std::vector<float> _mins;
+    std::vector<float> _maxs;
+};
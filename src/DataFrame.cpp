@@ -1,8 +1,8 @@
 #include "DataFrame.h"
 
 #include "CSVReader.h"
-
-#include <LoaderPlugin.h>
+#include "LoadException.h"
+#include "Tracing.h"
 
 #include <QDebug>
 #include <QFile>
@@ -41,7 +41,7 @@ int DataFrame::findRowWithColumnValue(QString columnName, QString value)
 {
     int col = getColumnIndex(columnName);
 
-    for (int i = 0; i < numRows(); i++)
+    for (unsigned int i = 0; i < numRows(); i++)
     {
         const QString& val = _data[i][col];
         if (val == value)
@@ -51,13 +51,36 @@ int DataFrame::findRowWithColumnValue(QString columnName, QString value)
     return -1;
 }
 
+size_t DataFrame::memoryUsage() const
+{
+    // Every non-empty string holds its characters plus a shared data header
+    constexpr size_t STRING_HEADER_BYTES = 24;
+    auto stringBytes = [](const QString& string) { return string.isEmpty() ? 0 : STRING_HEADER_BYTES + (string.size() + 1) * sizeof(QChar); };
+
+    size_t bytes = _headers.capacity() * sizeof(QString);
+    for (const QString& header : _headers)
+        bytes += stringBytes(header);
+
+    bytes += _data.capacity() * sizeof(std::vector<QString>);
+    for (const std::vector<QString>& row : _data)
+    {
+        bytes += row.capacity() * sizeof(QString);
+        for (const QString& value : row)
+            bytes += stringBytes(value);
+    }
+
+    return bytes;
+}
+
 void DataFrame::readFromFile(QString fileName)
 {
+    TRACE_SCOPE("CSV parse", fileName);
+
     QFile file(fileName);
 
     if (!file.open(QIODevice::ReadOnly))
     {
-        throw mv::plugin::DataLoadException(fileName, "File was not found at location.");
+        throw LoadException(fileName, "File was not found at location.");
     }
 
     QTextStream in(&file);
@@ -80,7 +103,7 @@ std::vector<int> DataFrame::findDuplicateRows(QString columnToCheck)
 
     QSet<QString> uniqueRows;
     std::vector<int> duplicateRows;
-    for (int i = 0; i < column.size(); i++)
+    for (size_t i = 0; i < column.size(); i++)
     {
         if (!uniqueRows.contains(column[i]))
             uniqueRows.insert(column[i]);
@@ -110,9 +133,11 @@ void DataFrame::removeRows(const std::vector<int>& rowsToDelete)
 
 void DataFrame::removeDuplicateRows(QString columnToCheck)
 {
+    TRACE_SCOPE("Dedup", columnToCheck);
+
     std::vector<int> duplicateRows = findDuplicateRows(columnToCheck);
     qDebug() << "Removing duplicate rows: " << duplicateRows.size();
-    for (int i = 0; i < duplicateRows.size(); i++)
+    for (size_t i = 0; i < duplicateRows.size(); i++)
     {
         qDebug() << (*this)[columnToCheck][duplicateRows[i]];
     }
@@ -126,7 +151,7 @@ void DataFrame::addHeader(QString header)
 
 void DataFrame::setHeaders(const QStringList& columnNames)
 {
-    for (const QString columnName : columnNames)
+    for (const QString& columnName : columnNames)
     {
         _headers.push_back(columnName);
     }
@@ -151,7 +176,7 @@ void DataFrame::subsetAndReorderAccordingTo(DataFrame& rightDf, QString columnNa
 
     // Make a map out of meta column
     std::unordered_map<QString, int> indexMap;
-    for (int i = 0; i < columnLeft.size(); i++)
+    for (size_t i = 0; i < columnLeft.size(); i++)
     {
         indexMap[columnLeft[i]] = i;
     }
@@ -184,12 +209,14 @@ void DataFrame::printFirstFewDimensionsOfDataFrame()
 
 DataFrame DataFrame::subsetAndReorderByColumn(const DataFrame& leftDf, DataFrame& rightDf, QString columnNameLeft, QString columnNameRight)
 {
+    TRACE_SCOPE("Join", columnNameLeft);
+
     std::vector<QString> columnRight = rightDf[columnNameRight];
     std::vector<QString> columnLeft = leftDf[columnNameLeft];
 
     // Make a map out of meta column
     std::unordered_map<QString, int> indexMap;
-    for (int i = 0; i < columnLeft.size(); i++)
+    for (size_t i = 0; i < columnLeft.size(); i++)
     {
         indexMap[columnLeft[i]] = i;
     }
@@ -228,7 +255,7 @@ std::vector<QString> DataFrame::operator[](QString columnName) const
 
     std::vector<QString> column;
 
-    for (int row = 0; row < _data.size(); row++)
+    for (size_t row = 0; row < _data.size(); row++)
     {
         column.push_back(_data[row][columnIndex]);
     }
@@ -238,7 +265,7 @@ std::vector<QString> DataFrame::operator[](QString columnName) const
 
 int DataFrame::getColumnIndex(QString columnName) const
 {
-    for (int i = 0; i < _headers.size(); i++)
+    for (size_t i = 0; i < _headers.size(); i++)
     {
         if (_headers[i] == columnName)
             return i;
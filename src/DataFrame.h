@@ -33,6 +33,9 @@ public:
 
     void printFirstFewDimensionsOfDataFrame();
 
+    // Estimated heap bytes held by the headers and values
+    size_t memoryUsage() const;
+
     static DataFrame subsetAndReorderByColumn(const DataFrame& leftDf, DataFrame& rightDf, QString columnNameLeft, QString columnNameRight);
 
     std::vector<QString> operator[](QString columnName) const;
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <vector>
+
+class TracePyramid;
+
+// Plain value types that the NWB loader fills, so the loading code doesn't depend on the data types of the ManiVault
+// plugins. The plugin converts them to its EphysData types.
+
+// Samples of a recording, xSeries holds the time of every sample in seconds
+class Trace
+{
+public:
+    // Keeps the samples [begin, end)
+    void trim(size_t begin, size_t end)
+    {
+        end = std::min(end, ySeries.size());
+        begin = std::min(begin, end);
+
+        ySeries = std::vector<float>(ySeries.begin() + begin, ySeries.begin() + end);
+        if (xSeries.size() >= end)
+            xSeries = std::vector<float>(xSeries.begin() + begin, xSeries.begin() + end);
+    }
+
+public:
+    std::vector<float> xSeries;
+    std::vector<float> ySeries;
+};
+
+// Trace of an NWB group with the attributes of the group
+class TraceRecording
+{
+public:
+    Trace data;
+    QHash<QString, QString> attributes;
+};
+
+// Action potential isolated from a rheobase sweep
+class ActionPotentialTrace
+{
+public:
+    std::vector<float> time;
+    std::vector<float> voltage;
+    int stimulusOffset = 0;     // Samples from the stimulus onset to the peak
+};
+
+class NWBSweep
+{
+public:
+    int sweepNumber = -1;
+    QString stimulusDescription;
+    TraceRecording stimulus;
+    TraceRecording acquisition;
+
+    // The acquisition over the stimulus epoch at full resolution for zooming in, only for sweeps whose display samples
+    // are decimated and only if asked for
+    std::shared_ptr<TracePyramid> acquisitionPyramid;
+};
+
+// The sweeps of a cell that passed the checks, in the order they were loaded
+class NWBExperiment
+{
+public:
+    std::vector<NWBSweep> sweeps;
+    std::optional<ActionPotentialTrace> actionPotential;
+};
@@ -0,0 +1,63 @@
+#include "NWBLoadSession.h"
+
+#include "StimulusCodeMap.h"
+#include "FailedSweepDetector.h"
+
+#include "Tracing.h"
+
+#include <QDebug>
+
+NWBLoadSession::NWBLoadSession(const QString& failedSweepPath) :
+    _usefulStimulusCodes(USEFUL_STIM_CODES),
+    _groupNumberPattern("^.*_(\\d+)_.*$"),
+    _sweepNumberPattern("data_(\\d{5})_"),
+    _stimScalePattern(R"(Stim Scale Factor:\s*([0-9]+)\.)")
+{
+    TRACE_SCOPE("Failed sweeps", failedSweepPath);
+
+    if (!failedSweepPath.isEmpty())
+    {
+        QHash<QString, QVector<int>> failedSweeps = LoadFailedSweeps(failedSweepPath);
+        _failedSweeps.reserve(failedSweeps.size());
+
+        for (auto it = failedSweeps.constBegin(); it != failedSweeps.constEnd(); ++it)
+            _failedSweeps.insert(it.key(), QSet<int>(it.value().begin(), it.value().end()));
+
+        qDebug() << "Failed sweeps of" << _failedSweeps.size() << "cells";
+    }
+
+    // Compile the patterns now, matching is then free of side effects and safe from all worker threads
+    _groupNumberPattern.optimize();
+    _sweepNumberPattern.optimize();
+}
+
+bool NWBLoadSession::isFailedSweep(const QString& cellName, int sweepNumber) const
+{
+    auto it = _failedSweeps.find(cellName);
+    return it != _failedSweeps.end() && it->contains(sweepNumber);
+}
+
+bool NWBLoadSession::isUsefulStimulusCode(const QString& stimulusCode) const
+{
+    return _usefulStimulusCodes.contains(stimulusCode);
+}
+
+QString NWBLoadSession::extractGroupNumber(const QString& groupName) const
+{
+    QRegularExpressionMatch match = _groupNumberPattern.match(groupName);
+    return match.hasMatch() ? match.captured(1) : QString();
+}
+
+int NWBLoadSession::extractSweepNumber(const QString& groupPath) const
+{
+    QRegularExpressionMatch match = _sweepNumberPattern.match(groupPath);
+    return match.hasMatch() ? match.captured(1).toInt() : -1;
+}
+
+int NWBLoadSession::extractStimScale(const std::string& comment) const
+{
+    std::smatch match;
+    if (std::regex_search(comment, match, _stimScalePattern))
+        return std::stoi(match[1]);
+    return -1;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QHash>
+#include <QRegularExpression>
+#include <QSet>
+#include <QString>
+
+#include <regex>
+#include <string>
+
+// Resources shared by all NWB files of a load: the sweeps that failed quality control, the stimulus codes to load and
+// the patterns that parse group names and comments. They are prepared once and only read afterwards, so the worker
+// threads of a parallel load share one session.
+class NWBLoadSession
+{
+public:
+    // Reads the failed sweeps from the JSON file at failedSweepPath, an empty path means no sweeps failed
+    explicit NWBLoadSession(const QString& failedSweepPath);
+
+    // Whether the sweep of the cell with the given file name failed quality control
+    bool isFailedSweep(const QString& cellName, int sweepNumber) const;
+
+    // Whether sweeps with this stimulus code, without the _DA_0 suffix, are loaded
+    bool isUsefulStimulusCode(const QString& stimulusCode) const;
+
+    // Number in a group name such as data_00011_AD0, an empty string if there is none
+    QString extractGroupNumber(const QString& groupName) const;
+
+    // Sweep number of a group path such as acquisition/data_00011_AD0, -1 if there is none
+    int extractSweepNumber(const QString& groupPath) const;
+
+    // Stim scale factor in a sweep comment, -1 if there is none
+    int extractStimScale(const std::string& comment) const;
+
+private:
+    QHash<QString, QSet<int>> _failedSweeps;
+    QSet<QString> _usefulStimulusCodes;
+
+    QRegularExpression _groupNumberPattern;
+    QRegularExpression _sweepNumberPattern;
+    std::regex _stimScalePattern;
+};
@@ -1,67 +1,70 @@
 #include "NWBLoader.h"
 
-#include "StimulusCodeMap.h"
+#include "Tracing.h"
+#include "MemoryProfiler.h"
+#include "Parallel.h"
 
-#include "EphysData/Experiment.h"
-#include "EphysData/ActionPotential.h"
+#include "NWBLoadSession.h"
+
+#include "Electrophysiology/EphysTypes.h"
 
 #include <QDebug>
-#include <iostream>
+#include <QFileInfo>
+#include <algorithm>
+#include <cmath>
 #include <string>
-#include <fstream>
-#include <regex>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
 
 #include "LEAD/NWBFile.h"
 #include "Electrophysiology/SpikeExtractor.h"
 #include "Electrophysiology/SweepProcessing.h"
-#include "Electrophysiology/FailedSweepDetector.h"
 #include "Electrophysiology/SpikeDetector.h"
-
-///
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-///
-
-#include <windows.h>
+#include "Electrophysiology/TracePyramid.h"
 
 using namespace H5;
-int failIndex = 0;
+
 namespace
 {
-    void exportToCSV(const std::vector<float>& x, const std::vector<float>& y, const std::string& filename) {
-        if (x.size() != y.size()) {
-            std::cerr << "Error: x and y vectors must be the same size." << std::endl;
-            return;
-        }
+    // HDF5 and LEAD are not safe to call from several threads at once, so files loaded in parallel take turns reading
+    // and only process their sweeps concurrently
+    std::mutex hdf5Mutex;
 
-        std::ofstream file(filename);
-        if (!file.is_open()) {
-            std::cerr << "Error: could not open file " << filename << " for writing." << std::endl;
-            return;
-        }
+    // Samples of an acquisition kept for display, a few per pixel of a wide trace view
+    constexpr size_t MAX_DISPLAY_SAMPLES = 8192;
 
-        file << "x,y\n"; // CSV header
+    // Every how many samples of a stimulus are kept for display, and of an acquisition for the spike detector, whose
+    // window is tuned to this rate
+    constexpr size_t DOWNSAMPLE_STRIDE = 4;
 
-        for (size_t i = 0; i < x.size(); i += 10) {
-            file << x[i] << "," << y[i] << "\n";
+    // A file opened under the HDF5 lock. The lock is taken again before the file is closed and destroyed, so its HDF5
+    // handles are also released under the lock when an exception is thrown while sweeps are processed without it.
+    class LockedNWBFile
+    {
+    public:
+        LockedNWBFile(const QString& filePath, std::unique_lock<std::mutex>& hdf5Lock) :
+            _hdf5Lock(hdf5Lock)
+        {
+            _file.Load(filePath.toStdString());
+            _file.Open(filePath.toStdString());
         }
 
-        file.close();
-        std::cout << "Data exported to " << filename << std::endl;
-    }
+        ~LockedNWBFile()
+        {
+            if (!_hdf5Lock.owns_lock())
+                _hdf5Lock.lock();
 
-    int extractSweepNumber(const QString& input)
-    {
-        QRegularExpression re("data_(\\d{5})_");
-        QRegularExpressionMatch match = re.match(input);
-        if (match.hasMatch()) {
-            QString numberStr = match.captured(1);
-            return numberStr.toInt();
+            _file.Close();
         }
-        return -1;  // or throw, depending on your use case
-    }
+
+        NWBFile& get() { return _file; }
+
+    private:
+        std::unique_lock<std::mutex>& _hdf5Lock;
+        NWBFile _file;
+    };
 }
 
 class RecordingPair
@@ -73,16 +76,28 @@ public:
 
 namespace
 {
+    // Adds the stimulus set counts of files loaded separately, in file order
+    void MergeStimsetCounts(const std::vector<LoadInfo>& fileInfos, LoadInfo& info)
+    {
+        for (const LoadInfo& fileInfo : fileInfos)
+        {
+            for (auto it = fileInfo.ignoredStimsets.constBegin(); it != fileInfo.ignoredStimsets.constEnd(); ++it)
+                info.ignoredStimsets[it.key()] += it.value();
+            for (auto it = fileInfo.loadedStimsets.constBegin(); it != fileInfo.loadedStimsets.constEnd(); ++it)
+                info.loadedStimsets[it.key()] += it.value();
+        }
+    }
+
     QString ExtractFileId(const QString& path)
     {
         QFileInfo fi(path);
         return fi.completeBaseName();   // filename without extension
     }
 
-    void ExtractRecordings(const Groups& groups, QHash<QString, RecordingPair>& recordingPairs)
+    void ExtractRecordings(const NWBLoadSession& session, const Groups& groups, QHash<QString, RecordingPair>& recordingPairs)
     {
         // Find acquisitions and stimuli
-        for (int i = 0; i < groups.size(); i++)
+        for (size_t i = 0; i < groups.size(); i++)
         {
             QString groupPath = QString::fromStdString(groups[i].GetName());
 
@@ -90,10 +105,8 @@ namespace
             QString groupName = groupPath.section('/', -1);
 
             // Extract the number from e.g. data_00011_AD0
-            QRegularExpression re("^.*_(\\d+)_.*$");
-            QRegularExpressionMatch match = re.match(groupName);
-            if (match.hasMatch()) {
-                QString number = match.captured(1);
+            QString number = session.extractGroupNumber(groupName);
+            if (!number.isEmpty()) {
 
                 if (!recordingPairs.contains(number))
                 {
@@ -109,13 +122,25 @@ namespace
         }
     }
 
-    LEAD::Dataset FindDataset(const Datasets& datasets, std::string datasetName)
+    // Sampling rate of a timeseries, from the rate attribute of its starting time, or 1 if it has none
+    float FindSamplingRate(NWBFile& file, const std::string& groupName)
     {
-        for (int i = 0; i < datasets.size(); i++)
+        const std::string rateDatasetName = groupName + "/starting_time";
+        for (const LEAD::Dataset& dataset : file.GetDatasets())
         {
-            if (datasets[i].GetName() == datasetName)
-                return datasets[i];
+            if (dataset.GetName() != rateDatasetName)
+                continue;
+
+            LEAD::Dataset rateDataset = dataset;
+            rateDataset.LoadAllAttributes(file.GetFileId());
+            for (const auto& attr : rateDataset.GetAttributes())
+            {
+                if (attr.GetName() == "rate")
+                    return QString::fromStdString(attr.GetValue()).toFloat();
+            }
         }
+
+        return 1;
     }
 
     bool FindStimulusDescription(NWBFile& nwbFile, LEAD::Group& group, QString& stimDescription)
@@ -156,395 +181,346 @@ namespace
         return false;
     }
 
-    int ExtractStimScale(std::string input)
+    // Reads samples [begin, end) of a one-dimensional float dataset with a hyperslab selection, so only those samples
+    // are read from the file. The range is clamped to the dataset.
+    bool ReadFloatDatasetRange(NWBFile& file, const std::string& datasetName, size_t begin, size_t end, std::vector<float>& values)
     {
-        std::regex re(R"(Stim Scale Factor:\s*([0-9]+)\.)");
-        std::smatch match;
+        hid_t dataset = H5Dopen2(file.GetFileId(), datasetName.c_str(), H5P_DEFAULT);
+        if (dataset < 0)
+            return false;
 
-        if (std::regex_search(input, match, re)) {
-            int stimScaleFactor = std::stoi(match[1]);
-            return stimScaleFactor;
-        }
-        return -1;
-    }
+        hid_t fileSpace = H5Dget_space(dataset);
+        bool success = H5Sget_simple_extent_ndims(fileSpace) == 1;
+        if (success)
+        {
+            hsize_t size = 0;
+            H5Sget_simple_extent_dims(fileSpace, &size, nullptr);
 
-    void ReadTimeseries(NWBFile& file, std::string groupName, Recording& recording)
-    {
-        //std::cout << "TIMESERIES " << groupName << std::endl;
-        std::vector<hsize_t> dims;
-        file.OpenFloatDataset(groupName + "/data", recording.GetData().ySeries, dims);
+            const hsize_t last = std::min<hsize_t>(end, size);
+            hsize_t offset = std::min<hsize_t>(begin, last);
+            hsize_t count = last - offset;
+            values.resize(count);
 
-        recording.GetData().xSeries.resize(recording.GetData().ySeries.size());
-        std::iota(recording.GetData().xSeries.begin(), recording.GetData().xSeries.end(), 0);
+            if (count > 0)
+            {
+                H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, &offset, nullptr, &count, nullptr);
+                hid_t memorySpace = H5Screate_simple(1, &count, nullptr);
+                success = H5Dread(dataset, H5T_NATIVE_FLOAT, memorySpace, fileSpace, H5P_DEFAULT, values.data()) >= 0;
+                H5Sclose(memorySpace);
+            }
+        }
 
-        // Read sampling rate for xSeries
-        std::string rateDatasetName = groupName + "/starting_time";
-        LEAD::Dataset rateDataset = FindDataset(file.GetDatasets(), rateDatasetName);
-        rateDataset.LoadAllAttributes(file.GetFileId());
-        float rate = 1;
+        H5Sclose(fileSpace);
+        H5Dclose(dataset);
+        return success;
+    }
 
-        for (const auto& attr : rateDataset.GetAttributes())
+    // Reads samples [begin, end) of the timeseries, the full timeseries if end is 0. Times are those of the full
+    // timeseries, so a range starts at begin / rate.
+    void ReadTimeseries(NWBFile& file, std::string groupName, TraceRecording& recording, size_t begin = 0, size_t end = 0)
+    {
+        std::vector<float>& samples = recording.data.ySeries;
+        if (end == 0 || !ReadFloatDatasetRange(file, groupName + "/data", begin, end, samples))
         {
-            if (attr.GetName() == "rate")
-                rate = QString::fromStdString(attr.GetValue()).toFloat();
-        }
+            std::vector<hsize_t> dims;
+            file.OpenFloatDataset(groupName + "/data", samples, dims);
 
-        float timeStep = (1 / rate);
-        std::transform(recording.GetData().xSeries.begin(), recording.GetData().xSeries.end(), recording.GetData().xSeries.begin(), [timeStep](auto& c) { return c * timeStep; });
-        //recording.GetData().downsample();
+            // A dataset that can't be read partially is cut to the range after reading
+            if (end != 0)
+            {
+                end = std::min(end, samples.size());
+                begin = std::min(begin, end);
+                samples = std::vector<float>(samples.begin() + begin, samples.begin() + end);
+            }
+        }
 
-        /////
-        //std::cout << file.GetFileName() << std::endl;
-        //if (file.GetFileName().find("H19.03.302.11.14.02.05") != std::string::npos)
-        //{
-            //QString fileName = QString::fromStdString(groupName);
-            //fileName = fileName.replace("/", "_");
+        recording.data.xSeries.resize(recording.data.ySeries.size());
+        std::iota(recording.data.xSeries.begin(), recording.data.xSeries.end(), static_cast<float>(begin));
 
-            //exportToCSV(recording.GetData().xSeries, recording.GetData().ySeries, file.GetFileName() + "-" + fileName.toStdString() + ".csv");
-        //}
-        /////
+        // Sample times from the sampling rate
+        float timeStep = 1 / FindSamplingRate(file, groupName);
+        std::transform(recording.data.xSeries.begin(), recording.data.xSeries.end(), recording.data.xSeries.begin(), [timeStep](auto& c) { return c * timeStep; });
     }
 
-    bool DetectFailedAcquisition(const Stimulus& stimulus, const Recording& acquisition)
+    // Scans the sweeps of an open file into the index, using only the group structure, stimulus descriptions and
+    // sweep numbers, no samples are read
+    void IndexSweeps(const NWBLoadSession& session, NWBFile& nwbFile, const QString& fileName, NWBFileIndex& index, LoadInfo& info)
     {
-        const TimeSeries& stimSeries = stimulus.GetRecording().GetData();
+        TRACE_SCOPE("Index sweeps");
 
-        int lastSignal = -1;
-        int failCount = 0;
-        for (int i = 0; i < stimSeries.ySeries.size(); i++)
+        QHash<QString, RecordingPair> recordingPairs;
+        ExtractRecordings(session, nwbFile.GetGroups(), recordingPairs);
+
+        for (RecordingPair& recordingPair : recordingPairs)
         {
-            if (abs(stimSeries.ySeries[i]) > 0.001f)
-                lastSignal = i;
-            //if (stimSeries.ySeries[i] > 0.001f && acquisition.GetData().ySeries[i] == 0)
-            //    failCount++;
-            bool acqFail = abs(acquisition.GetData().ySeries[i]) < 0.001f || std::isnan(acquisition.GetData().ySeries[i]);
-
-            if (acqFail && lastSignal != -1 && i - lastSignal < 2000)
-                failCount++;
-            //if (abs(stimSeries.ySeries[i]) > 0.001f && abs(acquisition.GetData().ySeries[i]) < 0.001f)
-            //    failCount++;
-        }
-        //qDebug() << "Fail count: " << failCount;
-        return failCount > 1800;
-        //if (failCount > 30)
-        //{
-        //    return true;
-        //}
-
-        //float refValue = recording.GetData().ySeries[recording.GetData().ySeries.size() / 2];
-        //for (int i = recording.GetData().ySeries.size() / 2; i < recording.GetData().ySeries.size(); i++)
-        //{
-        //    if (std::abs(recording.GetData().ySeries[i] - refValue) > 0.001f)
-        //        return false;
-        //}
-        //return true;
-    }
-}
+            // Find stimulus description
+            QString stimDescription;
+            bool stimDescriptionFound = FindStimulusDescription(nwbFile, recordingPair.acquisition, stimDescription);
 
-void NWBLoader::LoadNWB(QString filePath, Experiment& experiment, LoadInfo& info)
-{
-    NWBFile nwbFile;
-    nwbFile.Load(filePath.toStdString());
-    Groups groups = nwbFile.GetGroups();
+            if (!stimDescriptionFound)
+                continue;
 
-    nwbFile.Open(filePath.toStdString());
-    bool written = false;
+            // There is a stimulus description, chop it, and determine if we should load the associated recordings
+            stimDescription.chop(5); // Trim _DA_0
 
-    float totalSize = 0;
-    qDebug() << "Filepath: " << filePath;
+            if (!session.isUsefulStimulusCode(stimDescription))
+            {
+                if (!info.ignoredStimsets.contains(stimDescription))
+                    info.ignoredStimsets[stimDescription] = 1;
+                else
+                    info.ignoredStimsets[stimDescription]++;
+                continue;
+            }
+            else
+            {
+                if (!info.loadedStimsets.contains(stimDescription))
+                    info.loadedStimsets[stimDescription] = 1;
+                else
+                    info.loadedStimsets[stimDescription]++;
+            }
 
-    QString fileName = ExtractFileId(filePath);
+            // Extract sweep number
+            int acqSweepNumber = session.extractSweepNumber(QString::fromStdString(recordingPair.acquisition.GetName()));
+            int stimSweepNumber = session.extractSweepNumber(QString::fromStdString(recordingPair.stimulus.GetName()));
 
-    QHash<QString, QVector<int>> failedSweepDict = LoadFailedSweeps(info.failedSweepPath);
+            if (stimSweepNumber != acqSweepNumber)
+            {
+                qCritical() << "[ERROR] Stimulus has sweep number: " << stimSweepNumber << " but acquisition: " << acqSweepNumber;
+                continue;
+            }
 
-    QVector<int> failedSweeps;
-    if (failedSweepDict.contains(fileName))
-        failedSweeps = failedSweepDict[fileName];
+            // Check if sweep failed QC
+            if (session.isFailedSweep(fileName, acqSweepNumber))
+            {
+                qDebug() << "[" << fileName << "]" << "Discarding failed sweep:" << acqSweepNumber;
+                continue;
+            }
 
-    QHash<QString, RecordingPair> recordingPairs;
-    ExtractRecordings(groups, recordingPairs);
+            index.sweeps.push_back({ stimSweepNumber, stimDescription, recordingPair.acquisition.GetName(), recordingPair.stimulus.GetName() });
+        }
+    }
 
-    for (RecordingPair& recordingPair : recordingPairs)
+    // Reads and processes the indexed sweeps of an open file into the experiment. The lock is released while a sweep is
+    // processed and is held again on return.
+    void MaterializeSweeps(const NWBLoadSession& session, NWBFile& nwbFile, const NWBFileIndex& index, NWBExperiment& experiment, std::unique_lock<std::mutex>& hdf5Lock, bool buildPyramids)
     {
-        // Find stimulus description
-        QString stimDescription;
-        bool stimDescriptionFound = FindStimulusDescription(nwbFile, recordingPair.acquisition, stimDescription);
+        size_t totalBytes = 0;
 
-        if (!stimDescriptionFound)
-            continue;
+        QString fileName = ExtractFileId(index.filePath);
 
-        // There is a stimulus description, chop it, and determine if we should load the associated recordings
-        stimDescription.chop(5); // Trim _DA_0
+        std::unordered_map<std::string, const LEAD::Group*> groupsByName;
+        for (const LEAD::Group& group : nwbFile.GetGroups())
+            groupsByName[group.GetName()] = &group;
 
-        if (!USEFUL_STIM_CODES.contains(stimDescription))
-        {
-            //qWarning() << "Not loading recordings because stimulus description was: " << stimDescription; // TEMP
-            if (!info.ignoredStimsets.contains(stimDescription))
-                info.ignoredStimsets[stimDescription] = 1;
-            else
-                info.ignoredStimsets[stimDescription]++;
-            continue;
-        }
-        else
+        for (const NWBSweepEntry& entry : index.sweeps)
         {
-            if (!info.loadedStimsets.contains(stimDescription))
-                info.loadedStimsets[stimDescription] = 1;
-            else
-                info.loadedStimsets[stimDescription]++;
-        }
+            TRACE_SCOPE("Sweep");
 
-        //if (STIMULUS_CODE_NAME_MAP.contains(stimDescription))
-        //    stimDescription = STIMULUS_CODE_NAME_MAP[stimDescription];
-
-        // Extract sweep number
-        int acqSweepNumber = extractSweepNumber(QString::fromStdString(recordingPair.acquisition.GetName()));
-        int stimSweepNumber = extractSweepNumber(QString::fromStdString(recordingPair.stimulus.GetName()));
-
-        if (stimSweepNumber != acqSweepNumber)
-        {
-            qCritical() << "[ERROR] Stimulus has sweep number: " << stimSweepNumber << " but acquisition: " << acqSweepNumber;
-            continue;
-        }
+            // The previous sweep was processed without the lock
+            if (!hdf5Lock.owns_lock())
+                hdf5Lock.lock();
 
-        // Check if sweep failed QC
-        bool failedSweep = false;
-        for (const int& sweepNum : failedSweeps)
-            if (sweepNum == acqSweepNumber)
-                failedSweep = true;
+            auto acquisitionIt = groupsByName.find(entry.acquisitionGroup);
+            auto stimulusIt = groupsByName.find(entry.stimulusGroup);
+            if (acquisitionIt == groupsByName.end() || stimulusIt == groupsByName.end())
+            {
+                qWarning() << "[" << fileName << "]" << "Indexed sweep" << entry.sweepNumber << "is no longer in the file";
+                continue;
+            }
 
-        if (failedSweep)
-        {
-            qDebug() << "[" << fileName << "]" << "Discarding failed sweep:" << acqSweepNumber;
-            continue;
-        }
+            RecordingPair recordingPair;
+            recordingPair.acquisition = *acquisitionIt->second;
+            recordingPair.stimulus = *stimulusIt->second;
 
-        // Recordings should be loaded, so store stimulus description in both recordings
-        Sweep sweep;
+            const QString& stimDescription = entry.stimulusDescription;
+            const int stimSweepNumber = entry.sweepNumber;
 
-        sweep.SetSweepNumber(stimSweepNumber);
-        sweep.stimulus.SetStimulusDescription(stimDescription);
+            // Recordings should be loaded, so store stimulus description in both recordings
+            NWBSweep sweep;
 
-        // Load associated timeseries
-        // ACQUISITION
-        {
-            // Only load attributes for the acquisition if they have not been previously loaded while checking for a stim description FIXME
-            if (recordingPair.acquisition.GetAttributes().empty())
-                recordingPair.acquisition.LoadAllAttributes(nwbFile.GetFileId());
+            sweep.sweepNumber = stimSweepNumber;
+            sweep.stimulusDescription = stimDescription;
 
-            // Load all attributes
-            for (int j = 0; j < recordingPair.acquisition.GetAttributes().size(); j++)
+            // Load associated timeseries
+            // STIMULUS
             {
-                const LEAD::Attribute& attribute = recordingPair.acquisition.GetAttributes()[j];
+                recordingPair.stimulus.LoadAllAttributes(nwbFile.GetFileId());
 
-                sweep.acquisition.AddAttribute(QString::fromStdString(attribute.GetName()), QString::fromStdString(attribute.GetValue()));
+                // Load all attributes
+                for (const LEAD::Attribute& attribute : recordingPair.stimulus.GetAttributes())
+                {
+                    sweep.stimulus.attributes.insert(QString::fromStdString(attribute.GetName()), QString::fromStdString(attribute.GetValue()));
+                }
+
+                ReadTimeseries(nwbFile, recordingPair.stimulus.GetName(), sweep.stimulus);
             }
 
-            ReadTimeseries(nwbFile, recordingPair.acquisition.GetName(), sweep.acquisition);
+            // The stimulus epoch, the recordings are trimmed to it
+            std::vector<Envelope> stimEnvelopes = ComputeStimulusEnvelopes(sweep.stimulus.data.ySeries);
+            if (stimEnvelopes.empty())
+                continue;
+
+            std::pair<int, int> stimRange = { stimEnvelopes[0].startIndex, stimEnvelopes[stimEnvelopes.size() - 1].endIndex };
+            if (stimRange.first == -1)
+                continue;
 
-            totalSize += ((sweep.acquisition.GetData().xSeries.size() + sweep.acquisition.GetData().ySeries.size()) * sizeof(float)) / 1000000.0f;
+            // The action potential is extracted from the full recordings
+            const bool readFullAcquisition = stimDescription.contains("Rheo");
 
-            for (auto it = sweep.acquisition.GetAttributes().constBegin(); it != sweep.acquisition.GetAttributes().constEnd(); ++it)
+            // ACQUISITION
             {
-                totalSize += it.value().size() / 1000000.0f;
-                //qDebug() << "Attribute size: " << it.key() << " " << it.value().size();
-            }
-        }
+                // Only load attributes for the acquisition if they have not been previously loaded while checking for a stim description FIXME
+                if (recordingPair.acquisition.GetAttributes().empty())
+                    recordingPair.acquisition.LoadAllAttributes(nwbFile.GetFileId());
 
-        // STIMULUS
-        {
-            recordingPair.stimulus.LoadAllAttributes(nwbFile.GetFileId());
+                // Load all attributes
+                for (const LEAD::Attribute& attribute : recordingPair.acquisition.GetAttributes())
+                {
+                    sweep.acquisition.attributes.insert(QString::fromStdString(attribute.GetName()), QString::fromStdString(attribute.GetValue()));
+                }
 
-            // Load all attributes
-            for (int j = 0; j < recordingPair.stimulus.GetAttributes().size(); j++)
-            {
-                const LEAD::Attribute& attribute = recordingPair.stimulus.GetAttributes()[j];
+                // Only the samples of the stimulus epoch are read
+                if (readFullAcquisition)
+                    ReadTimeseries(nwbFile, recordingPair.acquisition.GetName(), sweep.acquisition);
+                else
+                    ReadTimeseries(nwbFile, recordingPair.acquisition.GetName(), sweep.acquisition, stimRange.first, stimRange.second);
 
-                sweep.stimulus.GetRecording().AddAttribute(QString::fromStdString(attribute.GetName()), QString::fromStdString(attribute.GetValue()));
+                for (auto it = sweep.acquisition.attributes.constBegin(); it != sweep.acquisition.attributes.constEnd(); ++it)
+                    totalBytes += it.value().size() * sizeof(QChar);
             }
 
-            ReadTimeseries(nwbFile, recordingPair.stimulus.GetName(), sweep.stimulus.GetRecording());
-            
+            // Both recordings are in memory, let other files read while this sweep is processed
+            hdf5Lock.unlock();
+
             // Extract action potential before downsampling
             if (stimDescription.contains("Rheo"))
             {
                 SpikeExtractor extractor;
-                ActionPotential* actionPotential = extractor.DetectActionPotential(sweep.stimulus.GetRecording().GetData(), sweep.acquisition.GetData());
-                experiment.setActionPotential(actionPotential);
+                experiment.actionPotential = extractor.DetectActionPotential(sweep.stimulus.data, sweep.acquisition.data);
+            }
 
-                for (const auto& attribute : recordingPair.stimulus.GetAttributes())
-                {
-                    if (attribute.GetName().find("comment") != std::string::npos)
-                    {
-                        int stimScale = ExtractStimScale(attribute.GetValue());
+            // Trim to the stimulus epoch, the acquisition is only read in full for the action potential
+            sweep.stimulus.data.trim(stimRange.first, stimRange.second);
+            if (readFullAcquisition)
+                sweep.acquisition.data.trim(stimRange.first, stimRange.second);
 
-                        if (true)
-                        //if (stimScale == 100)
-                        {
+            // Zooming in shows the full resolution, when it is more than the display samples
+            if (buildPyramids && sweep.acquisition.data.ySeries.size() > MAX_DISPLAY_SAMPLES)
+                sweep.acquisitionPyramid = std::make_shared<TracePyramid>(sweep.acquisition.data);
 
-                        }
-                    }
-                }
-            }
-        }
+            // The recordings that are kept for display, the stimulus is reduced the same way as the acquisition
+            Trace displayAcquisition;
+            DecimateMinMax(sweep.acquisition.data, MAX_DISPLAY_SAMPLES, displayAcquisition);
+            Trace displayStimulus;
+            DecimateMinMax(sweep.stimulus.data, MAX_DISPLAY_SAMPLES, displayStimulus);
+            sweep.stimulus.data = std::move(displayStimulus);
 
-        // Detect failed acquisitions
-        //if (stimDescription.contains("Ramp"))
-        //    qDebug() << "Ramp";
-        //if (fileName.contains("H23.06.351.11.56.01.06"))
-        //{
-        //    qDebug() << "Test" << stimSweepNumber;
-        //}
-        //if (failIndex >= 2302)
-        //{
-        //    qDebug() << "Test" << stimSweepNumber;
-        //}
-
-        //bool failed = DetectFailedAcquisition(sweep.stimulus, sweep.acquisition);
-        //if (failed)
-        //{
-        //    qDebug() << ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> Discarded failed acq " << failIndex << stimSweepNumber << stimDescription;
-
-        //    if (stimDescription.contains("ramp", Qt::CaseInsensitive))
-        //    {
-        //        exportToCSV(sweep.acquisition.GetData().xSeries, sweep.acquisition.GetData().ySeries, std::to_string(failIndex) + "_acq.csv");
-        //        exportToCSV(sweep.stimulus.GetRecording().GetData().xSeries, sweep.stimulus.GetRecording().GetData().ySeries, std::to_string(failIndex) + "_stim.csv");
-        //        failIndex += 1;
-        //    }
-
-        //    continue;
-        //}
-
-        // Downsample the recording
-        sweep.acquisition.GetData().downsample();
-        sweep.stimulus.GetRecording().GetData().downsample();
-
-        std::vector<Envelope> stimEnvelopes = ComputeStimulusEnvelopes(sweep.stimulus);
-        if (stimEnvelopes.empty())
-        {
-            qDebug() << "MMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMM Empty Envelopes";
-            continue;
-        }
+            // Downsample the acquisition
+            DecimateStride(sweep.acquisition.data, DOWNSAMPLE_STRIDE);
 
-        std::pair<int, int> stimRange = { stimEnvelopes[0].startIndex, stimEnvelopes[stimEnvelopes.size() - 1].endIndex };
-        //std::pair<int, int> stimRange = sweep.stimulus.GetRecording().GetData().FindStimulusRange();
-        if (stimRange.first != -1)
-        {
-            sweep.stimulus.GetRecording().GetData().trim(stimRange.first, stimRange.second);
-            sweep.acquisition.GetData().trim(stimRange.first, stimRange.second);
-        }
-        else
-            continue;
+            // Detect spikes, on the downsampled acquisition as before the decimation
+            std::vector<int> spikeIndices = DetectSpikes(sweep.acquisition.data);
+            sweep.acquisition.attributes.insert("NumSpikes", QString::number(static_cast<qulonglong>(spikeIndices.size())));
 
-        sweep.stimulus.GetRecording().GetData().computeExtents();
-        sweep.stimulus.CalculateStimulusAmplitude();
-        sweep.stimulus.DetectStimulusType();
-        sweep.acquisition.GetData().computeExtents();
+            sweep.acquisition.data = std::move(displayAcquisition);
 
-        // Detect spikes
-        std::vector<int> spikeIndices = DetectSpikes(sweep.acquisition.GetData());
-        sweep.acquisition.AddAttribute("NumSpikes", QString::number(static_cast<qulonglong>(spikeIndices.size())));
+            totalBytes += (sweep.acquisition.data.xSeries.size() + sweep.acquisition.data.ySeries.size()) * sizeof(float);
+            totalBytes += (sweep.stimulus.data.xSeries.size() + sweep.stimulus.data.ySeries.size()) * sizeof(float);
 
-        experiment.AddSweep(std::move(sweep));
+            experiment.sweeps.push_back(std::move(sweep));
+        }
+
+        if (!hdf5Lock.owns_lock())
+            hdf5Lock.lock();
+
+        MemoryProfiler::recordContainer(fileName + " sweeps", totalBytes);
     }
+}
+
+void NWBLoader::LoadNWB(QString filePath, NWBExperiment& experiment, LoadInfo& info)
+{
+    const NWBLoadSession session(info.failedSweepPath);
+    LoadNWB(session, filePath, experiment, info);
+}
+
+void NWBLoader::LoadNWB(const NWBLoadSession& session, QString filePath, NWBExperiment& experiment, LoadInfo& info)
+{
+    TRACE_SCOPE("NWB file", filePath);
+
+    qDebug() << "Filepath: " << filePath;
+
+    QString fileName = ExtractFileId(filePath);
+
+    std::unique_lock<std::mutex> hdf5Lock(hdf5Mutex);
+    LockedNWBFile lockedFile(filePath, hdf5Lock);
+    NWBFile& nwbFile = lockedFile.get();
+
+    NWBFileIndex index;
+    index.filePath = filePath;
+    IndexSweeps(session, nwbFile, fileName, index, info);
+    MaterializeSweeps(session, nwbFile, index, experiment, hdf5Lock, false);
+}
+
+void NWBLoader::IndexNWB(const NWBLoadSession& session, QString filePath, NWBFileIndex& index, LoadInfo& info)
+{
+    TRACE_SCOPE("NWB index", filePath);
+
+    std::unique_lock<std::mutex> hdf5Lock(hdf5Mutex);
+    LockedNWBFile lockedFile(filePath, hdf5Lock);
+
+    index.filePath = filePath;
+    index.sweeps.clear();
+    IndexSweeps(session, lockedFile.get(), ExtractFileId(filePath), index, info);
+}
+
+void NWBLoader::MaterializeNWB(const NWBLoadSession& session, const NWBFileIndex& index, NWBExperiment& experiment, bool buildPyramids)
+{
+    TRACE_SCOPE("NWB materialize", index.filePath);
+
+    std::unique_lock<std::mutex> hdf5Lock(hdf5Mutex);
+    LockedNWBFile lockedFile(index.filePath, hdf5Lock);
+
+    MaterializeSweeps(session, lockedFile.get(), index, experiment, hdf5Lock, buildPyramids);
+}
+
+void NWBLoader::LoadNWBFiles(const QStringList& filePaths, std::vector<NWBExperiment>& experiments, LoadInfo& info, unsigned int maxThreads)
+{
+    TRACE_SCOPE("NWB files");
+
+    // The failed sweeps and patterns are prepared once for all files
+    const NWBLoadSession session(info.failedSweepPath);
+
+    experiments.clear();
+    experiments.resize(filePaths.size());
+
+    // Every file counts its stimulus sets separately, so the workers don't share the counts
+    std::vector<LoadInfo> fileInfos(filePaths.size());
+    for (LoadInfo& fileInfo : fileInfos)
+        fileInfo.failedSweepPath = info.failedSweepPath;
+
+    parallelForDynamic(filePaths.size(), maxThreads, [&](size_t i)
+    {
+        LoadNWB(session, filePaths[i], experiments[i], fileInfos[i]);
+    });
+
+    MergeStimsetCounts(fileInfos, info);
+}
+
+void NWBLoader::IndexNWBFiles(const NWBLoadSession& session, const QStringList& filePaths, std::vector<NWBFileIndex>& indices, LoadInfo& info, unsigned int maxThreads)
+{
+    TRACE_SCOPE("NWB index files");
+
+    indices.clear();
+    indices.resize(filePaths.size());
+
+    std::vector<LoadInfo> fileInfos(filePaths.size());
+    for (LoadInfo& fileInfo : fileInfos)
+        fileInfo.failedSweepPath = info.failedSweepPath;
+
+    parallelForDynamic(filePaths.size(), maxThreads, [&](size_t i)
+    {
+        IndexNWB(session, filePaths[i], indices[i], fileInfos[i]);
+    });
 
-    //for (int i = 0; i < groups.size(); i++)
-    //{
-    //    QString groupName = QString::fromStdString(groups[i].GetName());
-
-    //    Recording recording;
-
-    //    // Load all acquisitions
-    //    if (groupName.startsWith("acquisition/") && groupName.contains("data"))
-    //    {
-    //        // Check stimulus description whether we should load the dataset
-    //        // Determine if the acquisition has a stimulus description, and if so load it
-    //        std::string stimulusDescriptionDatasetName = (groupName + "/stimulus_description").toStdString();
-    //        if (nwbFile.DatasetExists(stimulusDescriptionDatasetName))
-    //        {
-    //            std::vector<std::string> stimDescriptions;
-    //            nwbFile.OpenStringDataset(stimulusDescriptionDatasetName, stimDescriptions);
-    //            if (!stimDescriptions.empty())
-    //            {
-    //                QString stimDescription = QString::fromStdString(stimDescriptions[0]);
-    //                stimDescription.chop(5); // Trim _DA_0
-
-    //                if (!USEFUL_STIM_CODES.contains(stimDescription))
-    //                {
-    //                    loadedDatasets.push_back(false);
-    //                    continue;
-    //                }
-    //                
-    //                loadedDatasets.push_back(true);
-
-    //                if (STIMULUS_CODE_NAME_MAP.contains(stimDescription))
-    //                    stimDescription = STIMULUS_CODE_NAME_MAP[stimDescription];
-
-    //                recording.SetStimulusDescription(stimDescription);
-    //            }
-    //        }
-
-    //        //std::cout << i << ": " << groups[i].GetName() << std::endl;
-    //        groups[i].LoadAllAttributes(nwbFile.GetFileId());
-    //        
-    //        // Load all attributes
-    //        for (int j = 0; j < groups[i].GetAttributes().size(); j++)
-    //        {
-    //            const LEAD::Attribute& attribute = groups[i].GetAttributes()[j];
-
-    //            recording.AddAttribute(QString::fromStdString(attribute.GetName()), QString::fromStdString(attribute.GetValue()));
-    //        }
-
-    //        ReadTimeseries(nwbFile, groupName.toStdString(), recording);
-
-    //        totalSize += ((recording.GetData().xSeries.size() + recording.GetData().ySeries.size()) * sizeof(float)) / 1000000.0f;
-
-    //        for (auto it = recording.GetAttributes().constBegin(); it != recording.GetAttributes().constEnd(); ++it)
-    //        {
-    //            totalSize += it.value().size() / 1000000.0f;
-    //            //qDebug() << "Attribute size: " << it.key() << " " << it.value().size();
-    //        }
-
-    //        experiment.addAcquisition(std::move(recording));
-    //    }
-    //    // Load all stimuli
-    //    if (groupName.startsWith("stimulus/presentation/") && groupName.contains("data"))
-    //    {
-    //        //std::cout << i << ": " << groups[i].GetName() << std::endl;
-    //        groups[i].LoadAllAttributes(nwbFile.GetFileId());
-
-    //        // Load all attributes
-    //        for (int j = 0; j < groups[i].GetAttributes().size(); j++)
-    //        {
-    //            const LEAD::Attribute& attribute = groups[i].GetAttributes()[j];
-
-    //            recording.AddAttribute(QString::fromStdString(attribute.GetName()), QString::fromStdString(attribute.GetValue()));
-    //        }
-
-    //        ReadTimeseries(nwbFile, groupName.toStdString(), recording);
-
-    //        totalSize += ((recording.GetData().xSeries.size() + recording.GetData().ySeries.size()) * sizeof(float)) / 1000000.0f;
-
-    //        for (auto it = recording.GetAttributes().constBegin(); it != recording.GetAttributes().constEnd(); ++it)
-    //        {
-    //            totalSize += it.value().size() / 1000000.0f;
-    //            //qDebug() << "Attribute2 size: " << it.key() << " " << it.value().size();
-    //        }
-
-    //        experiment.addStimulus(std::move(recording));
-    //    }
-    //}
-    nwbFile.Close();
-    qDebug() << ">>>>>>>> NUM SWEEPS: " << experiment.GetSweeps().size();
-    std::cout << "Size: " << totalSize << "MB" << std::endl;
-
-    //if (experiment.getAcquisitions().size() > 0)
-    //{
-    //    const QHash<QString, QString>& attrs = experiment.getAcquisitions()[0].GetAttributes();
-    //    for (auto it = attrs.constBegin(); it != attrs.constEnd(); ++it)
-    //    {
-    //        qDebug() << "Attr: " << it.key() << "Value: " << it.value();
-    //    }
-    //}
-
-    //dataset.iterateAttrs((H5::attr_operator_t) attr_op);
+    MergeStimsetCounts(fileInfos, info);
 }
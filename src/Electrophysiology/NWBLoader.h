@@ -1,9 +1,15 @@
 #pragma once
 
 #include <QString>
+#include <QStringList>
 #include <QHash>
 
-class Experiment;
+#include <string>
+#include <vector>
+
+class NWBExperiment;
+class TraceRecording;
+class NWBLoadSession;
 
 class LoadInfo
 {
@@ -14,10 +20,46 @@ public:
     QHash<QString, int> loadedStimsets;
 };
 
+// Sweep of an NWB file that passed the stimulus code and quality control checks, found without reading its samples
+class NWBSweepEntry
+{
+public:
+    int sweepNumber = -1;
+    QString stimulusDescription;
+    std::string acquisitionGroup;
+    std::string stimulusGroup;
+};
+
+// Sweeps to load from an NWB file, in the order the full load processes them
+class NWBFileIndex
+{
+public:
+    QString filePath;
+    std::vector<NWBSweepEntry> sweeps;
+};
+
 class NWBLoader
 {
 public:
-    void LoadNWB(QString fileName, Experiment& experiment, LoadInfo& info);
+    void LoadNWB(QString fileName, NWBExperiment& experiment, LoadInfo& info);
+
+    // Loads a file with the failed sweeps and patterns of a session that is shared by several files
+    void LoadNWB(const NWBLoadSession& session, QString fileName, NWBExperiment& experiment, LoadInfo& info);
+
+    // Loads the files on a pool of at most maxThreads threads, experiments[i] holds the result of filePaths[i].
+    // The stimulus set counts of all files are added to info.
+    void LoadNWBFiles(const QStringList& filePaths, std::vector<NWBExperiment>& experiments, LoadInfo& info, unsigned int maxThreads);
+
+    // Scans the sweeps of a file into an index without reading any samples, the stimulus set counts are added to info
+    void IndexNWB(const NWBLoadSession& session, QString fileName, NWBFileIndex& index, LoadInfo& info);
+
+    // Indexes the files on a pool of at most maxThreads threads, indices[i] holds the index of filePaths[i]
+    void IndexNWBFiles(const NWBLoadSession& session, const QStringList& filePaths, std::vector<NWBFileIndex>& indices, LoadInfo& info, unsigned int maxThreads);
+
+    // Reads and processes the indexed sweeps, giving the same experiment as LoadNWB. With buildPyramids, sweeps whose
+    // display samples are decimated also get a pyramid of their acquisition, built from the stimulus epoch before the
+    // decimation. Safe to call from several threads.
+    void MaterializeNWB(const NWBLoadSession& session, const NWBFileIndex& index, NWBExperiment& experiment, bool buildPyramids = false);
 private:
 
 };
@@ -1,8 +1,10 @@
 #include "SpikeDetector.h"
 
-#include "EphysData/TimeSeries.h"
+#include "EphysTypes.h"
 
-std::vector<int> DetectSpikes(const TimeSeries& timeSeries)
+#include <cmath>
+
+std::vector<int> DetectSpikes(const Trace& timeSeries)
 {
     int windowSize = 10;
     float threshold = 3.0f;
@@ -10,7 +12,7 @@ std::vector<int> DetectSpikes(const TimeSeries& timeSeries)
     const std::vector<float>& y = timeSeries.ySeries;
     std::vector<int> spikes;
 
-    if (y.size() < windowSize * 2)
+    if (y.size() < static_cast<size_t>(windowSize) * 2)
         return spikes;
 
     for (size_t i = windowSize; i < y.size() - windowSize; ++i)
@@ -2,6 +2,6 @@
 
 #include <vector>
 
-class TimeSeries;
+class Trace;
 
-std::vector<int> DetectSpikes(const TimeSeries& timeSeries);
+std::vector<int> DetectSpikes(const Trace& timeSeries);
@@ -1,10 +1,9 @@
 #include "SpikeExtractor.h"
 
-#include <EphysData/ActionPotential.h>
-
 #include <fstream>
+#include <numeric>
 
-ActionPotential* SpikeExtractor::DetectActionPotential(const TimeSeries& stim, const TimeSeries& acq)
+ActionPotentialTrace SpikeExtractor::DetectActionPotential(const Trace& stim, const Trace& acq)
 {
     if (stim.ySeries.empty())
         ;// throw exception;
@@ -13,7 +12,7 @@ ActionPotential* SpikeExtractor::DetectActionPotential(const TimeSeries& stim, c
     int stimIndex = 0;
 
     float prevValue = stim.ySeries[0];
-    for (int i = 10000; i < stim.ySeries.size(); i++)
+    for (int i = 10000; i < static_cast<int>(stim.ySeries.size()); i++)
     {
         if (stim.ySeries[i] > prevValue)
         {
@@ -27,7 +26,7 @@ ActionPotential* SpikeExtractor::DetectActionPotential(const TimeSeries& stim, c
 
     {
         float maxValue = 0;
-        for (int i = 0; i < acq.ySeries.size(); i++)
+        for (int i = 0; i < static_cast<int>(acq.ySeries.size()); i++)
         {
             if (acq.ySeries[i] > maxValue)
             {
@@ -43,7 +42,7 @@ ActionPotential* SpikeExtractor::DetectActionPotential(const TimeSeries& stim, c
     prevValue = acq.ySeries[stimIndex];
 
     std::vector<float> actionPotential;
-    for (int i = peakIndex - 70; i < acq.ySeries.size(); i++)
+    for (int i = peakIndex - 70; i < static_cast<int>(acq.ySeries.size()); i++)
     {
         float y = acq.ySeries[i];
         dydx = (y - prevValue);
@@ -65,7 +64,7 @@ ActionPotential* SpikeExtractor::DetectActionPotential(const TimeSeries& stim, c
 
     std::vector<float> timeSeries(actionPotential.size());
     std::iota(timeSeries.begin(), timeSeries.end(), 0);
-    for (int i = 0; i < timeSeries.size(); i++)
+    for (size_t i = 0; i < timeSeries.size(); i++)
     {
         timeSeries[i] *= 0.02f;
     }
@@ -77,5 +76,5 @@ ActionPotential* SpikeExtractor::DetectActionPotential(const TimeSeries& stim, c
 
     //file.close();
 
-    return new ActionPotential(timeSeries, actionPotential, peakIndex - stimIndex);
+    return { timeSeries, actionPotential, peakIndex - stimIndex };
 }
@@ -1,13 +1,11 @@
 #pragma once
 
-#include "EphysData/TimeSeries.h"
-
-class ActionPotential;
+#include "EphysTypes.h"
 
 class SpikeExtractor
 {
 public:
-    ActionPotential* DetectActionPotential(const TimeSeries& stim, const TimeSeries& acq);
+    ActionPotentialTrace DetectActionPotential(const Trace& stim, const Trace& acq);
 private:
 
 };
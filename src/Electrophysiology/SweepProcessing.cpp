@@ -1,11 +1,46 @@
 #include "SweepProcessing.h"
 
+#include <QDebug>
+
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 namespace
 {
     constexpr float EPSILON = 1e-6f;
 
+    // Independent minima and maxima, so the compiler can compute a bucket's extrema with vector instructions
+    constexpr size_t NUM_LANES = 8;
+
+    // Minimum and maximum of the samples [begin, end), NaN samples are ignored
+    void FindExtrema(const float* samples, size_t begin, size_t end, float& minValue, float& maxValue)
+    {
+        float minLanes[NUM_LANES];
+        float maxLanes[NUM_LANES];
+        std::fill(minLanes, minLanes + NUM_LANES, std::numeric_limits<float>::infinity());
+        std::fill(maxLanes, maxLanes + NUM_LANES, -std::numeric_limits<float>::infinity());
+
+        size_t i = begin;
+        for (; i + NUM_LANES <= end; i += NUM_LANES)
+        {
+            for (size_t lane = 0; lane < NUM_LANES; lane++)
+            {
+                // A comparison with NaN is false, so the lane keeps its value
+                minLanes[lane] = samples[i + lane] < minLanes[lane] ? samples[i + lane] : minLanes[lane];
+                maxLanes[lane] = samples[i + lane] > maxLanes[lane] ? samples[i + lane] : maxLanes[lane];
+            }
+        }
+        for (; i < end; i++)
+        {
+            minLanes[0] = samples[i] < minLanes[0] ? samples[i] : minLanes[0];
+            maxLanes[0] = samples[i] > maxLanes[0] ? samples[i] : maxLanes[0];
+        }
+
+        minValue = *std::min_element(minLanes, minLanes + NUM_LANES);
+        maxValue = *std::max_element(maxLanes, maxLanes + NUM_LANES);
+    }
+
     void FindNonzeroRanges(const std::vector<float>& v, std::vector<Envelope>& envelopes)
     {
         bool inRange = false;
@@ -52,14 +87,12 @@ namespace
     }
 }
 
-std::vector<Envelope> ComputeStimulusEnvelopes(Stimulus stimulus)
+std::vector<Envelope> ComputeStimulusEnvelopes(const std::vector<float>& stimulus)
 {
-    TimeSeries& ts = stimulus.GetRecording().GetData();
-
     std::vector<Envelope> envelopes;
-    FindNonzeroRanges(ts.ySeries, envelopes);
+    FindNonzeroRanges(stimulus, envelopes);
 
-    ComputeEnvelopeAreas(envelopes, ts.ySeries);
+    ComputeEnvelopeAreas(envelopes, stimulus);
 
     if (envelopes.size() <= 1)
         return envelopes;
@@ -73,3 +106,73 @@ std::vector<Envelope> ComputeStimulusEnvelopes(Stimulus stimulus)
 
     return envelopes;
 }
+
+void DecimateMinMax(const Trace& input, size_t maxSamples, Trace& output)
+{
+    const size_t numSamples = input.ySeries.size();
+    if (numSamples <= maxSamples || maxSamples < 2)
+    {
+        output.xSeries = input.xSeries;
+        output.ySeries = input.ySeries;
+        return;
+    }
+
+    // Every bucket gives two samples
+    const size_t numBuckets = maxSamples / 2;
+    const size_t bucketSize = (numSamples + numBuckets - 1) / numBuckets;
+
+    output.xSeries.clear();
+    output.ySeries.clear();
+    output.xSeries.reserve(2 * numBuckets);
+    output.ySeries.reserve(2 * numBuckets);
+
+    const float* y = input.ySeries.data();
+    const bool hasX = input.xSeries.size() == numSamples;
+
+    for (size_t begin = 0; begin < numSamples; begin += bucketSize)
+    {
+        const size_t end = std::min(begin + bucketSize, numSamples);
+
+        float minValue, maxValue;
+        FindExtrema(y, begin, end, minValue, maxValue);
+
+        // Only NaN samples
+        if (minValue > maxValue)
+            continue;
+
+        // The extreme that occurs first is found first, the other one is searched from there on
+        const size_t first = std::find_if(y + begin, y + end, [minValue, maxValue](float value) { return value == minValue || value == maxValue; }) - y;
+        const size_t second = std::find(y + first, y + end, y[first] == minValue ? maxValue : minValue) - y;
+
+        output.xSeries.push_back(hasX ? input.xSeries[first] : static_cast<float>(first));
+        output.ySeries.push_back(y[first]);
+
+        if (second != first)
+        {
+            output.xSeries.push_back(hasX ? input.xSeries[second] : static_cast<float>(second));
+            output.ySeries.push_back(y[second]);
+        }
+    }
+}
+
+void DecimateStride(Trace& trace, size_t stride)
+{
+    if (stride <= 1)
+        return;
+
+    const size_t numSamples = trace.ySeries.size();
+    const bool hasX = trace.xSeries.size() == numSamples;
+
+    // In place, every kept sample moves to a position at or before its own
+    size_t numKept = 0;
+    for (size_t i = 0; i < numSamples; i += stride, numKept++)
+    {
+        trace.ySeries[numKept] = trace.ySeries[i];
+        if (hasX)
+            trace.xSeries[numKept] = trace.xSeries[i];
+    }
+
+    trace.ySeries.resize(numKept);
+    if (hasX)
+        trace.xSeries.resize(numKept);
+}
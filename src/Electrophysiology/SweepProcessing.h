@@ -1,6 +1,6 @@
 #pragma once
 
-#include <EphysData/Recording.h>
+#include "EphysTypes.h"
 
 class Envelope
 {
@@ -16,4 +16,13 @@ public:
     }
 };
 
-std::vector<Envelope> ComputeStimulusEnvelopes(Stimulus stimulus);
+// Envelopes of the samples of a stimulus recording
+std::vector<Envelope> ComputeStimulusEnvelopes(const std::vector<float>& stimulus);
+
+// Reduces the series to at most maxSamples samples for display, keeping the minimum and maximum of every bucket of
+// samples in the order they occur, so peaks such as action potentials are kept at any reduction. NaN samples are
+// skipped. Series that are short enough are copied as they are.
+void DecimateMinMax(const Trace& input, size_t maxSamples, Trace& output);
+
+// Keeps every stride-th sample, the plain decimation that the traces are kept at for display and spike detection
+void DecimateStride(Trace& trace, size_t stride);
@@ -0,0 +1,204 @@
+#include "TracePyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+    // Orderings in which NaN samples lose against all others, so a block's extreme is only NaN if all its samples are
+    bool IsLess(float a, float b)
+    {
+        return (a < b) | (std::isnan(b) & !std::isnan(a));
+    }
+
+    bool IsGreater(float a, float b)
+    {
+        return (a > b) | (std::isnan(b) & !std::isnan(a));
+    }
+
+    // Position of the smaller and of the larger of two samples, the first one on ties. Computed with arithmetic, the
+    // compiler turns selects into branches that noisy samples mispredict.
+    size_t MinPosition(const float* y, size_t a, size_t b)
+    {
+        return a + (b - a) * IsLess(y[b], y[a]);
+    }
+
+    size_t MaxPosition(const float* y, size_t a, size_t b)
+    {
+        return a + (b - a) * IsGreater(y[b], y[a]);
+    }
+
+    void AppendSample(const std::vector<float>& x, const std::vector<float>& y, size_t position, Trace& output)
+    {
+        output.xSeries.push_back(x[position]);
+        output.ySeries.push_back(y[position]);
+    }
+}
+
+TracePyramid::TracePyramid(const Trace& series) :
+    _y(series.ySeries)
+{
+    const size_t numSamples = _y.size();
+
+    // Series without x values are indexed by sample
+    if (series.xSeries.size() == numSamples)
+    {
+        _x = series.xSeries;
+    }
+    else
+    {
+        _x.resize(numSamples);
+        std::iota(_x.begin(), _x.end(), 0.0f);
+    }
+
+    // Up to two samples are always shown as they are
+    if (numSamples <= 2)
+        return;
+
+    // The extreme values of the level below are kept while building, so merging doesn't look them up in the samples
+    std::vector<float> minValues;
+    std::vector<float> maxValues;
+
+    // The first level scans the samples
+    const size_t blockSize = size_t(1) << FIRST_LEVEL_SHIFT;
+    const size_t numBlocks = (numSamples + blockSize - 1) / blockSize;
+
+    Level first;
+    first.minima.resize(numBlocks);
+    first.maxima.resize(numBlocks);
+    minValues.resize(numBlocks);
+    maxValues.resize(numBlocks);
+
+    const float* y = _y.data();
+    for (size_t block = 0; block < numBlocks; block++)
+    {
+        const size_t begin = block * blockSize;
+        const size_t end = std::min(begin + blockSize, numSamples);
+
+        size_t minimum = begin;
+        size_t maximum = begin;
+        if (end - begin == blockSize)
+        {
+            // A tournament of the two pairs of the four samples
+            minimum = MinPosition(y, MinPosition(y, begin, begin + 1), MinPosition(y, begin + 2, begin + 3));
+            maximum = MaxPosition(y, MaxPosition(y, begin, begin + 1), MaxPosition(y, begin + 2, begin + 3));
+        }
+        else
+        {
+            for (size_t i = begin + 1; i < end; i++)
+            {
+                minimum = MinPosition(y, minimum, i);
+                maximum = MaxPosition(y, maximum, i);
+            }
+        }
+
+        first.minima[block] = static_cast<uint32_t>(minimum);
+        first.maxima[block] = static_cast<uint32_t>(maximum);
+        minValues[block] = y[minimum];
+        maxValues[block] = y[maximum];
+    }
+    _levels.push_back(std::move(first));
+
+    // Every further level merges pairs of blocks of the level below
+    while (_levels.back().minima.size() > 1)
+    {
+        const Level& below = _levels.back();
+        const size_t numBelow = below.minima.size();
+        const size_t numMerged = numBelow / 2;
+
+        Level level;
+        level.minima.resize((numBelow + 1) / 2);
+        level.maxima.resize((numBelow + 1) / 2);
+
+        for (size_t block = 0; block < numMerged; block++)
+        {
+            const bool isLess = IsLess(minValues[2 * block + 1], minValues[2 * block]);
+            const bool isGreater = IsGreater(maxValues[2 * block + 1], maxValues[2 * block]);
+
+            level.minima[block] = below.minima[2 * block + isLess];
+            level.maxima[block] = below.maxima[2 * block + isGreater];
+
+            // The values of a block only overwrite those of blocks already merged
+            minValues[block] = minValues[2 * block + isLess];
+            maxValues[block] = maxValues[2 * block + isGreater];
+        }
+
+        // An odd block out is carried up as it is
+        if (numBelow % 2 == 1)
+        {
+            level.minima[numMerged] = below.minima[numBelow - 1];
+            level.maxima[numMerged] = below.maxima[numBelow - 1];
+            minValues[numMerged] = minValues[numBelow - 1];
+            maxValues[numMerged] = maxValues[numBelow - 1];
+        }
+
+        minValues.resize(level.minima.size());
+        maxValues.resize(level.maxima.size());
+        _levels.push_back(std::move(level));
+    }
+}
+
+void TracePyramid::query(float startTime, float endTime, int pixelWidth, Trace& output) const
+{
+    output.xSeries.clear();
+    output.ySeries.clear();
+
+    if (_y.empty() || pixelWidth <= 0 || !(startTime <= endTime))
+        return;
+
+    const size_t begin = std::lower_bound(_x.begin(), _x.end(), startTime) - _x.begin();
+    const size_t end = std::upper_bound(_x.begin(), _x.end(), endTime) - _x.begin();
+    if (begin >= end)
+        return;
+
+    // Few enough samples to show them all
+    const size_t maxBlocks = static_cast<size_t>(pixelWidth);
+    if (end - begin <= 2 * maxBlocks || _levels.empty())
+    {
+        output.xSeries.assign(_x.begin() + begin, _x.begin() + end);
+        output.ySeries.assign(_y.begin() + begin, _y.begin() + end);
+        return;
+    }
+
+    // Finest level with at most one block per pixel, the coarsest level always qualifies
+    size_t level = 0;
+    size_t firstBlock = 0;
+    size_t lastBlock = 0;
+    for (; level < _levels.size(); level++)
+    {
+        const size_t shift = level + FIRST_LEVEL_SHIFT;
+        firstBlock = begin >> shift;
+        lastBlock = (end - 1) >> shift;
+        if (lastBlock - firstBlock + 1 <= maxBlocks)
+            break;
+    }
+    level = std::min(level, _levels.size() - 1);
+
+    const Level& blocks = _levels[level];
+
+    output.xSeries.reserve(2 * (lastBlock - firstBlock + 1));
+    output.ySeries.reserve(2 * (lastBlock - firstBlock + 1));
+
+    for (size_t block = firstBlock; block <= lastBlock; block++)
+    {
+        const uint32_t minimum = blocks.minima[block];
+        const uint32_t maximum = blocks.maxima[block];
+
+        // Only NaN samples
+        if (std::isnan(_y[minimum]))
+            continue;
+
+        AppendSample(_x, _y, std::min(minimum, maximum), output);
+        if (minimum != maximum)
+            AppendSample(_x, _y, std::max(minimum, maximum), output);
+    }
+}
+
+size_t TracePyramid::byteSize() const
+{
+    size_t size = (_x.size() + _y.size()) * sizeof(float);
+    for (const Level& level : _levels)
+        size += (level.minima.size() + level.maxima.size()) * sizeof(uint32_t);
+    return size;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "EphysTypes.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Multi-resolution min/max pyramid of a trace for zoomable viewing. Level l holds the positions of the minimum and
+// maximum of every block of 2^(l + 2) samples, each level is built from the one below it, so the pyramid is built in
+// a single pass over the samples and takes half as much memory again as the samples themselves. A query picks the
+// finest level that still fits the pixel width of the view, so its cost follows the width instead of the time window.
+class TracePyramid
+{
+public:
+    TracePyramid() = default;
+
+    // Pyramid of a series whose x values ascend, NaN samples are skipped by the queries
+    explicit TracePyramid(const Trace& series);
+
+    // Samples of the time window [startTime, endTime] for a view of pixelWidth pixels, at most two per pixel. These
+    // are the samples themselves when the window holds few enough of them, otherwise the minimum and maximum of every
+    // block of the chosen level in the order they occur, the window is then widened to whole blocks.
+    void query(float startTime, float endTime, int pixelWidth, Trace& output) const;
+
+    bool isEmpty() const { return _y.empty(); }
+    size_t numSamples() const { return _y.size(); }
+    size_t numLevels() const { return _levels.size(); }
+
+    // Memory held by the samples and the levels
+    size_t byteSize() const;
+
+private:
+    // The first level has blocks of four samples, a min/max pair of fewer samples is no smaller than the samples
+    static constexpr size_t FIRST_LEVEL_SHIFT = 2;
+
+    struct Level
+    {
+        std::vector<uint32_t> minima;       // Sample positions of the minimum of every block
+        std::vector<uint32_t> maxima;       // Sample positions of the maximum of every block
+    };
+
+    std::vector<float> _x;
+    std::vector<float> _y;
+    std::vector<Level> _levels;             // From fine to coarse, the last one has a single block
+};
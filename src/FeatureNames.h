@@ -1,7 +1,9 @@
 ﻿#pragma once
 
 #include <QString>
+#include <QStringList>
 
+#include <unordered_map>
 #include <vector>
 
 static std::unordered_map<QString, QString> properFeatureNames = {
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QString>
+
+#include <stdexcept>
+
+// Thrown when an input file can not be loaded. Kept free of the ManiVault plugin interface, so the parsing code
+// also builds without it.
+class LoadException : public std::runtime_error
+{
+public:
+    LoadException(const QString& filePath, const QString& reason) :
+        std::runtime_error((filePath + ": " + reason).toStdString()),
+        _filePath(filePath),
+        _reason(reason)
+    {
+
+    }
+
+    const QString& getFilePath() const { return _filePath; }
+    const QString& getReason() const { return _reason; }
+
+private:
+    QString _filePath;
+    QString _reason;
+};
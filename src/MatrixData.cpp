@@ -1,25 +1,304 @@
 #include "MatrixData.h"
 
+#include "Parallel.h"
+#include "Analysis/NearestNeighbors.h"
+
 #include <QDebug>
+#include <QFile>
+#include <QTextStream>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
 #include <unordered_set>
 
+namespace
+{
+    // Minimum number of rows handed to a worker thread by the row-streaming kernels
+    constexpr size_t ROWS_PER_BLOCK = 256;
+
+    // Median of the non-missing values of every column, columns are processed in parallel
+    std::vector<float> computeColumnMedians(const MatrixData& matrix)
+    {
+        std::vector<float> medians(matrix.numCols, 0);
+
+        parallelFor(matrix.numCols, 1, [&matrix, &medians](size_t col)
+        {
+            std::vector<float> values;
+            values.reserve(matrix.numRows);
+            for (size_t row = 0; row < matrix.numRows; row++)
+            {
+                float v = matrix.data[row * matrix.numCols + col];
+                if (v != MISSING_VALUE)
+                    values.push_back(v);
+            }
+
+            if (values.empty())
+                return;
+
+            size_t mid = values.size() / 2;
+            std::nth_element(values.begin(), values.begin() + mid, values.end());
+            float median = values[mid];
+
+            // Average the two middle values for an even number of values
+            if (values.size() % 2 == 0)
+                median = (median + *std::max_element(values.begin(), values.begin() + mid)) / 2;
+
+            medians[col] = median;
+        });
+
+        return medians;
+    }
+
+    // Fraction of the columns the loess fit of the variance of the highly variable column selection is local to, and
+    // the number of points it is evaluated at. The fit in between is interpolated linearly, like R's loess does.
+    constexpr double LOESS_SPAN = 0.3;
+    constexpr size_t LOESS_NUM_VERTICES = 512;
+
+    // Local quadratic regression of y on the sorted x at x0, weighted by the tricube kernel over the numNeighbors points
+    // nearest to x0 (R's loess with degree 2)
+    double fitLoessAt(const std::vector<double>& x, const std::vector<double>& y, size_t numNeighbors, double x0)
+    {
+        const size_t n = x.size();
+
+        // The window of the nearest points around x0
+        size_t position = std::lower_bound(x.begin(), x.end(), x0) - x.begin();
+        size_t lo = std::min(position > numNeighbors / 2 ? position - numNeighbors / 2 : 0, n - numNeighbors);
+        while (lo > 0 && x0 - x[lo - 1] < x[lo + numNeighbors - 1] - x0)
+            lo--;
+        while (lo + numNeighbors < n && x[lo + numNeighbors] - x0 < x0 - x[lo])
+            lo++;
+        const size_t hi = lo + numNeighbors;
+        const double maxDistance = std::max(x0 - x[lo], x[hi - 1] - x0);
+
+        // Weighted sums of the powers of the offsets scaled to the window, the fit at x0 is the constant term
+        double s[5] = { 0, 0, 0, 0, 0 };
+        double t[3] = { 0, 0, 0 };
+        for (size_t i = lo; i < hi; i++)
+        {
+            const double u = maxDistance > 0 ? (x[i] - x0) / maxDistance : 0;
+            const double r = std::abs(u);
+            const double w = maxDistance > 0 ? std::pow(1 - r * r * r, 3) : 1;
+            s[0] += w; s[1] += w * u; s[2] += w * u * u; s[3] += w * u * u * u; s[4] += w * u * u * u * u;
+            t[0] += w * y[i]; t[1] += w * u * y[i]; t[2] += w * u * u * y[i];
+        }
+        if (s[0] <= 0)
+            return std::accumulate(y.begin() + lo, y.begin() + hi, 0.0) / numNeighbors;
+
+        // Quadratic, or linear or constant when the window has too few distinct points
+        const double det3 = s[0] * (s[2] * s[4] - s[3] * s[3]) - s[1] * (s[1] * s[4] - s[3] * s[2]) + s[2] * (s[1] * s[3] - s[2] * s[2]);
+        if (std::abs(det3) > 1e-9 * s[0] * s[2] * s[4])
+            return (t[0] * (s[2] * s[4] - s[3] * s[3]) - s[1] * (t[1] * s[4] - s[3] * t[2]) + s[2] * (t[1] * s[3] - s[2] * t[2])) / det3;
+
+        const double det2 = s[0] * s[2] - s[1] * s[1];
+        if (std::abs(det2) > 1e-9 * s[0] * s[2])
+            return (t[0] * s[2] - s[1] * t[1]) / det2;
+
+        return t[0] / s[0];
+    }
+
+    // Loess fit of y on the sorted x at every x
+    std::vector<double> fitLoess(const std::vector<double>& x, const std::vector<double>& y, double span)
+    {
+        const size_t n = x.size();
+        if (n == 0)
+            return {};
+
+        const size_t numNeighbors = std::clamp<size_t>(static_cast<size_t>(std::ceil(span * n)), std::min<size_t>(n, 3), n);
+
+        // Vertices at evenly spaced quantiles of x, so they are densest where the points are
+        const size_t numVertices = std::min(n, LOESS_NUM_VERTICES);
+        std::vector<double> vertexX(numVertices);
+        std::vector<double> vertexY(numVertices);
+        parallelFor(numVertices, 16, [&](size_t v)
+        {
+            vertexX[v] = x[numVertices > 1 ? v * (n - 1) / (numVertices - 1) : 0];
+            vertexY[v] = fitLoessAt(x, y, numNeighbors, vertexX[v]);
+        });
+
+        std::vector<double> fitted(n);
+        size_t v = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            while (v + 2 < numVertices && vertexX[v + 1] < x[i])
+                v++;
+
+            const size_t next = std::min(v + 1, numVertices - 1);
+            const double width = vertexX[next] - vertexX[v];
+            const double f = width > 0 ? std::clamp((x[i] - vertexX[v]) / width, 0.0, 1.0) : 0;
+            fitted[i] = vertexY[v] + f * (vertexY[next] - vertexY[v]);
+        }
+
+        return fitted;
+    }
+
+    // The counts of a row, of which the values are log1p of the counts when logCounts
+    void toCounts(const float* row, size_t numCols, bool logCounts, float* counts)
+    {
+        for (size_t c = 0; c < numCols; c++)
+            counts[c] = logCounts && row[c] != MISSING_VALUE ? std::expm1(row[c]) : row[c];
+    }
+
+    // Candidates fetched from the neighbour index per requested neighbour, so enough of them have every missing column
+    constexpr size_t CANDIDATES_PER_NEIGHBOR = 8;
+    constexpr size_t MIN_CANDIDATES = 64;
+
+    // k-nearest-neighbour imputation in the spirit of scikit-learn's KNNImputer. Distances are euclidean over the
+    // standardized features both rows have, scaled up by the fraction of features that were available. Every missing
+    // value becomes the mean of that column over the k nearest rows which do have it, or the column mean if none do.
+    // Candidate rows come from an HNSW index over the standardized rows with missing values at the column mean, and are
+    // ranked by the distance over the shared features, so the search doesn't compare every pair of rows.
+    void imputeNearestNeighbors(MatrixData& matrix, int numNeighbors)
+    {
+        const size_t numRows = matrix.numRows;
+        const size_t numCols = matrix.numCols;
+
+        ColumnStatistics stats = matrix.computeColumnStatistics();
+        const std::vector<float> means = stats.means();
+        const std::vector<float> stdDevs = stats.stdDevs();
+
+        // Standardized value, so every feature weighs equally in the distance. A missing value is at the column mean.
+        auto standardize = [&](float v, size_t col)
+        {
+            return v != MISSING_VALUE && stdDevs[col] != 0 ? (v - means[col]) / stdDevs[col] : 0.0f;
+        };
+
+        std::vector<size_t> rowsWithMissingValues;
+        for (size_t row = 0; row < numRows; row++)
+        {
+            const float* rowValues = matrix.data.data() + row * numCols;
+            if (std::find(rowValues, rowValues + numCols, MISSING_VALUE) != rowValues + numCols)
+                rowsWithMissingValues.push_back(row);
+        }
+
+        if (rowsWithMissingValues.empty())
+            return;
+
+        // The index keeps its own copy of the standardized rows, so they are only held while building it. The rows of
+        // a file-backed matrix are file-backed too.
+        const bool isFileBacked = matrix.data.isFileBacked();
+        HNSWIndex index(numCols);
+        {
+            MatrixStorage standardized;
+            if (isFileBacked)
+            {
+                standardized.mapFile();
+                index.useFileStorage();
+            }
+            standardized.resize(matrix.data.size());
+            parallelFor(numRows, ROWS_PER_BLOCK, [&](size_t row)
+            {
+                for (size_t col = 0; col < numCols; col++)
+                    standardized[row * numCols + col] = standardize(matrix.data[row * numCols + col], col);
+            });
+
+            index.build(standardized.data(), numRows);
+        }
+
+        const size_t numCandidates = std::max(MIN_CANDIDATES, CANDIDATES_PER_NEIGHBOR * static_cast<size_t>(numNeighbors));
+
+        // Imputed values are gathered first and written afterwards, so donors always contribute their original values
+        std::vector<std::vector<std::pair<size_t, float>>> imputedValues(rowsWithMissingValues.size());
+
+        parallelFor(rowsWithMissingValues.size(), 1, [&](size_t i)
+        {
+            const size_t row = rowsWithMissingValues[i];
+            const float* rowValues = matrix.data.data() + row * numCols;
+
+            std::vector<float> query(numCols);
+            for (size_t col = 0; col < numCols; col++)
+                query[col] = standardize(rowValues[col], col);
+
+            // Candidates ranked by their distance over the features both rows have
+            std::vector<std::pair<float, size_t>> neighbours;
+            neighbours.reserve(numCandidates);
+            for (const auto& [indexDistance, other] : index.search(query.data(), numCandidates + 1, numCandidates + 1))
+            {
+                if (other == row)
+                    continue;
+
+                const float* otherValues = matrix.data.data() + static_cast<size_t>(other) * numCols;
+
+                float sumSq = 0;
+                size_t numShared = 0;
+                for (size_t col = 0; col < numCols; col++)
+                {
+                    if (rowValues[col] == MISSING_VALUE || otherValues[col] == MISSING_VALUE)
+                        continue;
+                    float diff = query[col] - standardize(otherValues[col], col);
+                    sumSq += diff * diff;
+                    numShared++;
+                }
+
+                if (numShared > 0)
+                    neighbours.emplace_back(sumSq * numCols / numShared, other);
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+
+            for (size_t col = 0; col < numCols; col++)
+            {
+                if (rowValues[col] != MISSING_VALUE)
+                    continue;
+
+                float sum = 0;
+                int numDonors = 0;
+                for (const auto& [distance, other] : neighbours)
+                {
+                    float v = matrix.data[other * numCols + col];
+                    if (v == MISSING_VALUE)
+                        continue;
+
+                    sum += v;
+                    if (++numDonors == numNeighbors)
+                        break;
+                }
+
+                imputedValues[i].emplace_back(col, numDonors > 0 ? sum / numDonors : means[col]);
+            }
+        });
+
+        for (size_t i = 0; i < rowsWithMissingValues.size(); i++)
+        {
+            for (const auto& [col, value] : imputedValues[i])
+                matrix.data[rowsWithMissingValues[i] * numCols + col] = value;
+        }
+    }
+}
+
+bool MatrixData::useFileStorage(const QString& filePath)
+{
+    return data.mapFile(filePath);
+}
+
 void MatrixData::removeRow(int row)
 {
-    data.erase(data.begin() + (row * numCols + 0), data.begin() + (row * numCols + numCols));
-    numRows--;
+    removeRows({ row });
 }
 
 void MatrixData::removeRows(const std::vector<int>& rowsToDelete)
 {
-    int rowsRemoved = 0;
-    // Delete bad rows from both the dataframe and the matrix
-    for (int rowToDelete : rowsToDelete)
+    if (rowsToDelete.empty())
+        return;
+
+    std::vector<bool> deleteRow(numRows, false);
+    for (int row : rowsToDelete)
+        deleteRow[row] = true;
+
+    // Compact the kept rows to the front in a single streaming pass, rows only ever move towards the start
+    size_t numKept = 0;
+    for (size_t row = 0; row < numRows; row++)
     {
-        rowToDelete -= rowsRemoved;
-        removeRow(rowToDelete);
-        rowsRemoved++;
+        if (deleteRow[row])
+            continue;
+
+        if (numKept != row)
+            std::copy_n(data.data() + row * numCols, numCols, data.data() + numKept * numCols);
+        numKept++;
     }
+
+    numRows = numKept;
+    data.resize(numRows * numCols);
 }
 
 void MatrixData::removeCols(const std::vector<int>& colsToDelete)
@@ -30,83 +309,86 @@ void MatrixData::removeCols(const std::vector<int>& colsToDelete)
     std::unordered_set<int> deleteSet(colsToDelete.begin(), colsToDelete.end());
 
     std::vector<int> colsToKeep;
-    for (int i = 0; i < numCols; i++)
+    for (size_t i = 0; i < numCols; i++)
     {
         if (!deleteSet.count(i))
             colsToKeep.push_back(i);
     }
 
-    // Only include cols to be kept in the new data
-    std::vector<float> newData;
-    for (int row = 0; row < numRows; row++)
+    keepCols(colsToKeep);
+}
+
+void MatrixData::keepCols(const std::vector<int>& colsToKeep)
+{
+    const size_t numKeptCols = colsToKeep.size();
+
+    // Compact every row in place through a row buffer. Row r is written to [r * numKeptCols, (r + 1) * numKeptCols),
+    // which never reaches past the start of row r + 1, so unread rows are never overwritten.
+    std::vector<float> rowBuffer(numCols);
+    for (size_t row = 0; row < numRows; row++)
     {
-        for (int j = 0; j < colsToKeep.size(); j++)
-        {
-            int col = colsToKeep[j];
-            newData.push_back(data[row * numCols + col]);
-        }
+        const float* rowData = data.data() + row * numCols;
+        std::copy_n(rowData, numCols, rowBuffer.begin());
+
+        float* keptRowData = data.data() + row * numKeptCols;
+        for (size_t j = 0; j < numKeptCols; j++)
+            keptRowData[j] = rowBuffer[colsToKeep[j]];
     }
+    data.resize(numRows * numKeptCols);
 
     // Only include headers to be kept
     std::vector<QString> newHeaders;
-    for (int j = 0; j < colsToKeep.size(); j++)
+    for (size_t j = 0; j < colsToKeep.size(); j++)
     {
         int col = colsToKeep[j];
         newHeaders.push_back(headers[col]);
     }
 
     headers = newHeaders;
-    data = newData;
-    numCols = colsToKeep.size();
+    numCols = numKeptCols;
 }
 
 void MatrixData::fillMissingValues(float fillValue)
 {
-    // Compute means, ignoring missing values
-    for (int col = 0; col < numCols; col++)
+    fillMissingValues(std::vector<float>(numCols, fillValue));
+}
+
+void MatrixData::imputeMissingValues(ImputationStrategy strategy, int numNeighbors)
+{
+    switch (strategy)
     {
-        // Set the imputed value for the rows with missing values
-        for (int row = 0; row < numRows; row++)
+    case ImputationStrategy::ZERO: fillMissingValues(0); break;
+    case ImputationStrategy::MEAN: fillMissingValues(computeColumnStatistics().means()); break;
+    case ImputationStrategy::MEDIAN: fillMissingValues(computeColumnMedians(*this)); break;
+    case ImputationStrategy::KNN:
+        if (numNeighbors > 0)
         {
-            float v = data[row * numCols + col];
-            if (v == MISSING_VALUE)
-                data[row * numCols + col] = fillValue;
+            imputeNearestNeighbors(*this, numNeighbors);
+            break;
         }
+        qWarning() << "Nearest neighbour imputation needs at least one neighbour, got" << numNeighbors << "- imputing the column means instead";
+        fillMissingValues(computeColumnStatistics().means());
+        break;
     }
 }
 
-void MatrixData::imputeMissingValues()
+void MatrixData::fillMissingValues(const std::vector<float>& columnFillValues)
 {
-    // Compute means, ignoring missing values
-    for (int col = 0; col < numCols; col++)
+    // Set the imputed value for the rows with missing values
+    parallelFor(numRows, ROWS_PER_BLOCK, [this, &columnFillValues](size_t row)
     {
-        // Compute the mean
-        float mean = 0;
-        int numContributions = 0;
-        for (int row = 0; row < numCols; row++)
+        float* rowData = data.data() + row * numCols;
+        for (size_t col = 0; col < numCols; col++)
         {
-            float v = data[row * numCols + col];
-            if (v == MISSING_VALUE)
-                continue;
-            mean += v;
-            numContributions++;
+            if (rowData[col] == MISSING_VALUE)
+                rowData[col] = columnFillValues[col];
         }
-        if (numContributions > 0)
-            mean /= numContributions;
-
-        // Set the imputed value for the rows with missing values
-        for (int row = 0; row < numRows; row++)
-        {
-            float v = data[row * numCols + col];
-            if (v == MISSING_VALUE)
-                data[row * numCols + col] = mean;
-        }
-    }
+    });
 }
 
 int MatrixData::getColumnIndex(QString columnName) const
 {
-    for (int i = 0; i < headers.size(); i++)
+    for (size_t i = 0; i < headers.size(); i++)
     {
         if (headers[i] == columnName)
             return i;
@@ -122,7 +404,7 @@ std::vector<float> MatrixData::operator[](QString columnName) const
 
     std::vector<float> column;
 
-    for (int row = 0; row < numRows; row++)
+    for (size_t row = 0; row < numRows; row++)
     {
         column.push_back(data[row * numCols + columnIndex]);
     }
@@ -130,51 +412,147 @@ std::vector<float> MatrixData::operator[](QString columnName) const
     return column;
 }
 
-namespace
+ColumnStatistics MatrixData::computeColumnStatistics(bool ofExpm1) const
 {
-    // Function to compute the mean of each column
-    std::vector<float> computeColumnMeans(const std::vector<float>& matrix, int rows, int cols) {
-        std::vector<float> means(cols, 0.0f);
-        for (int c = 0; c < cols; ++c) {
-            float sum = 0.0f;
-            for (int r = 0; r < rows; ++r) {
-                sum += matrix[r * cols + c];
-            }
-            means[c] = sum / rows;
+    // Every block of rows is streamed into its own accumulator, the partial results are merged afterwards
+    std::vector<ColumnStatistics> blockStats(numParallelBlocks(numRows, ROWS_PER_BLOCK), ColumnStatistics(numCols));
+
+    parallelForBlocks(numRows, ROWS_PER_BLOCK, [this, &blockStats, ofExpm1](size_t block, size_t begin, size_t end)
+    {
+        if (!ofExpm1)
+        {
+            blockStats[block].addRows(data.data() + begin * numCols, end - begin);
+            return;
         }
-        return means;
-    }
 
-    // Function to compute the standard deviation of each column
-    std::vector<float> computeColumnStdDevs(const std::vector<float>& matrix, const std::vector<float>& means, int rows, int cols) {
-        std::vector<float> stdDevs(cols, 0.0f);
-        for (int c = 0; c < cols; ++c) {
-            float sumSqDiffs = 0.0f;
-            for (int r = 0; r < rows; ++r) {
-                float diff = matrix[r * cols + c] - means[c];
-                sumSqDiffs += diff * diff;
-            }
-            stdDevs[c] = std::sqrt(sumSqDiffs / rows);
+        std::vector<float> counts(numCols);
+        for (size_t row = begin; row < end; row++)
+        {
+            toCounts(data.data() + row * numCols, numCols, true, counts.data());
+            blockStats[block].addRow(counts.data());
         }
-        return stdDevs;
-    }
+    });
+
+    ColumnStatistics stats(numCols);
+    for (const ColumnStatistics& partial : blockStats)
+        stats.merge(partial);
+
+    return stats;
 }
 
 void MatrixData::standardize()
 {
-    std::vector<float> means = computeColumnMeans(data, numRows, numCols);
-    std::vector<float> stdDevs = computeColumnStdDevs(data, means, numRows, numCols);
+    ColumnStatistics stats = computeColumnStatistics();
 
-    for (int c = 0; c < numCols; ++c) {
-        for (int r = 0; r < numRows; ++r) {
-            int index = r * numCols + c;
+    std::vector<float> means = stats.means();
+    std::vector<float> invStdDevs(numCols);
+    for (size_t c = 0; c < numCols; c++)
+    {
+        float stdDev = stats.stdDev(c);
+        invStdDevs[c] = stdDev != 0 ? 1.0f / stdDev : 1.0f; // Avoid division by zero
+    }
 
-            if (stdDevs[c] != 0) {
-                data[index] = (data[index] - means[c]) / stdDevs[c];
-            }
-            else {
-                data[index] = data[index] - means[c]; // Avoid division by zero
+    parallelFor(numRows, ROWS_PER_BLOCK, [this, &means, &invStdDevs](size_t row)
+    {
+        float* rowData = data.data() + row * numCols;
+        for (size_t c = 0; c < numCols; c++)
+        {
+            float v = rowData[c];
+            rowData[c] = v == MISSING_VALUE ? v : (v - means[c]) * invStdDevs[c];
+        }
+    });
+}
+
+std::vector<int> MatrixData::findHighlyVariableColumns(size_t numTop, bool logCounts) const
+{
+    return findHighlyVariableColumns(computeColumnStatistics(logCounts), numTop, logCounts);
+}
+
+std::vector<int> MatrixData::findHighlyVariableColumns(const ColumnStatistics& countStats, size_t numTop, bool logCounts) const
+{
+    if (numTop >= numCols)
+    {
+        std::vector<int> allCols(numCols);
+        std::iota(allCols.begin(), allCols.end(), 0);
+        return allCols;
+    }
+
+    // Fit the log variance of the counts of the non-constant columns against their log mean
+    std::vector<int> fitCols;
+    std::vector<double> logMeans;
+    std::vector<double> logVariances;
+    for (size_t col = 0; col < numCols; col++)
+    {
+        if (countStats.mean(col) > 0 && countStats.variance(col) > 0)
+            fitCols.push_back(static_cast<int>(col));
+    }
+    std::sort(fitCols.begin(), fitCols.end(), [&countStats](int a, int b) { return countStats.mean(a) < countStats.mean(b); });
+    for (int col : fitCols)
+    {
+        logMeans.push_back(std::log10(static_cast<double>(countStats.mean(col))));
+        logVariances.push_back(std::log10(static_cast<double>(countStats.variance(col))));
+    }
+    std::vector<double> fittedLogVariances = fitLoess(logMeans, logVariances, LOESS_SPAN);
+
+    // Expected standard deviation of every column, counts above the mean plus the square root of the number of
+    // values times it are clipped
+    std::vector<double> means(numCols, 0);
+    std::vector<double> expectedStdDevs(numCols, 0);
+    std::vector<double> clipMaxs(numCols, 0);
+    for (size_t i = 0; i < fitCols.size(); i++)
+    {
+        const int col = fitCols[i];
+        means[col] = countStats.mean(col);
+        expectedStdDevs[col] = std::sqrt(std::pow(10.0, fittedLogVariances[i]));
+        clipMaxs[col] = means[col] + std::sqrt(static_cast<double>(countStats.numValues(col))) * expectedStdDevs[col];
+    }
+
+    // Sum of the squared deviations of the clipped counts from the mean, per block of rows
+    std::vector<std::vector<double>> blockSums(numParallelBlocks(numRows, ROWS_PER_BLOCK), std::vector<double>(numCols, 0));
+    parallelForBlocks(numRows, ROWS_PER_BLOCK, [&](size_t block, size_t begin, size_t end)
+    {
+        std::vector<float> counts(numCols);
+        double* sums = blockSums[block].data();
+        for (size_t row = begin; row < end; row++)
+        {
+            toCounts(data.data() + row * numCols, numCols, logCounts, counts.data());
+            for (size_t c = 0; c < numCols; c++)
+            {
+                if (counts[c] == MISSING_VALUE)
+                    continue;
+
+                const double deviation = std::min(static_cast<double>(counts[c]), clipMaxs[c]) - means[c];
+                sums[c] += deviation * deviation;
             }
         }
+    });
+
+    // Variance of the standardized clipped counts, constant columns get none
+    std::vector<double> standardizedVariances(numCols, 0);
+    for (int col : fitCols)
+    {
+        const size_t numValues = countStats.numValues(col);
+        if (numValues < 2 || expectedStdDevs[col] <= 0)
+            continue;
+
+        double sum = 0;
+        for (const std::vector<double>& sums : blockSums)
+            sum += sums[col];
+        standardizedVariances[col] = sum / ((numValues - 1) * expectedStdDevs[col] * expectedStdDevs[col]);
     }
+
+    // Pick the columns with the highest standardized variance
+    std::vector<int> order(numCols);
+    std::iota(order.begin(), order.end(), 0);
+    std::partial_sort(order.begin(), order.begin() + numTop, order.end(), [&standardizedVariances](int a, int b)
+    {
+        if (standardizedVariances[a] != standardizedVariances[b])
+            return standardizedVariances[a] > standardizedVariances[b];
+        return a < b;
+    });
+
+    std::vector<int> highlyVariableCols(order.begin(), order.begin() + numTop);
+    std::sort(highlyVariableCols.begin(), highlyVariableCols.end());
+
+    return highlyVariableCols;
 }
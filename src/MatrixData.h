@@ -1,5 +1,8 @@
 #pragma once
 
+#include "ColumnStatistics.h"
+#include "MatrixStorage.h"
+
 #include <QString>
 
 #include <vector>
@@ -7,18 +10,44 @@
 // Magic number that represents a missing value, to be imputed
 constexpr float MISSING_VALUE = 1234567.0f;
 
+// How missing values are filled in by MatrixData::imputeMissingValues
+enum class ImputationStrategy
+{
+    ZERO,   // Replace by zero
+    MEAN,   // Replace by the column mean
+    MEDIAN, // Replace by the column median
+    KNN     // Replace by the mean of the column values of the nearest rows that have the column
+};
+
 class MatrixData
 {
 public:
+    // Keep the values in a memory-mapped file rather than in memory, for matrices that do not fit in RAM.
+    // Pass an empty path for a temporary file. All operations stream over the rows, so they work on either storage.
+    bool useFileStorage(const QString& filePath = QString());
+
     void removeRow(int row);
     void removeRows(const std::vector<int>& rowsToDelete);
     void removeCols(const std::vector<int>& colsToDelete);
+    void keepCols(const std::vector<int>& colsToKeep);
     //void removeRowsWithColumnValue(QString column, float val)
 
     void fillMissingValues(float fillValue);
-    void imputeMissingValues();
+    void fillMissingValues(const std::vector<float>& columnFillValues);
+    // numNeighbors is only used by KNN, which imputes the column means when it is not positive
+    void imputeMissingValues(ImputationStrategy strategy = ImputationStrategy::MEAN, int numNeighbors = 5);
     void standardize();
 
+    // Mean, variance, min, max and missing count of every column in a single pass over the rows, of expm1 of the
+    // values when ofExpm1
+    ColumnStatistics computeColumnStatistics(bool ofExpm1 = false) const;
+
+    // Indices of the numTop most highly variable columns in ascending order, ranked by the variance of their counts
+    // standardized by the variance a loess fit over the column means expects and clipped, like Seurat v3's vst.
+    // The values are counts, or log1p of them when logCounts. countStats are the statistics of the counts.
+    std::vector<int> findHighlyVariableColumns(size_t numTop, bool logCounts = false) const;
+    std::vector<int> findHighlyVariableColumns(const ColumnStatistics& countStats, size_t numTop, bool logCounts = false) const;
+
     std::vector<float> operator[](QString columnName) const;
 
 private:
@@ -26,7 +55,7 @@ private:
 
 public:
     std::vector<QString> headers;
-    std::vector<float> data; // Store row-major
-    size_t numRows;
-    size_t numCols;
+    MatrixStorage data; // Store row-major
+    size_t numRows = 0;
+    size_t numCols = 0;
 };
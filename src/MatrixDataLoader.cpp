@@ -1,21 +1,183 @@
 #include "MatrixDataLoader.h"
 
 #include "MatrixData.h"
-
-#include <LoaderPlugin.h>
-#include <util/Timer.h>
-#include <Task.h>
-
+#include "LoadException.h"
+#include "Tracing.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QStringList>
 
+#include <algorithm>
+#include <string>
+
 #include "csv.h"
 
 const char* DELIMITER = ",";
 
 namespace
 {
+    constexpr quint32 CACHE_FILE_MAGIC = 0x434D5350; // "PSMC"
+    constexpr quint32 CACHE_FILE_VERSION = 1;
+
+    // Rows streamed between a cache file and the matrix at once
+    constexpr size_t CACHE_ROWS_PER_CHUNK = 1024;
+
+    // Cache files are named by a hash of everything the parsed values depend on, so an edited file or other transforms
+    // never pick up a stale cache
+    QString CacheFilePath(const QString& cacheDir, const QFileInfo& fileInfo, int numMetaCols, bool handleMissingValues, const TransformPipeline& transforms)
+    {
+        std::string key = fileInfo.absoluteFilePath().toStdString();
+        key += ";" + std::to_string(fileInfo.size()) + ";" + std::to_string(fileInfo.lastModified().toMSecsSinceEpoch());
+        key += ";" + std::to_string(numMetaCols) + ";" + std::to_string(handleMissingValues);
+        for (const MatrixTransform& transform : transforms.getTransforms())
+            key += ";" + std::to_string(static_cast<int>(transform.type)) + "," + std::to_string(transform.param0) + "," + std::to_string(transform.param1);
+
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+
+        return QDir(cacheDir).filePath(QString("%1.psmc").arg(hash, 16, 16, QChar('0')));
+    }
+
+    void WriteStrings(QDataStream& out, const std::vector<QString>& strings)
+    {
+        out << quint64(strings.size());
+        for (const QString& string : strings)
+            out << string;
+    }
+
+    bool ReadStrings(QDataStream& in, std::vector<QString>& strings)
+    {
+        quint64 numStrings = 0;
+        in >> numStrings;
+        for (quint64 i = 0; i < numStrings && in.status() == QDataStream::Ok; i++)
+        {
+            QString string;
+            in >> string;
+            strings.push_back(string);
+        }
+        return in.status() == QDataStream::Ok;
+    }
+
+    // Writes to a temporary file that replaces the cache file once complete, so an interrupted write is never read
+    void WriteCache(const QString& cachePath, DataFrame& df, const MatrixData& matrix)
+    {
+        TRACE_SCOPE("Matrix cache write", cachePath);
+
+        if (!QDir().mkpath(QFileInfo(cachePath).absolutePath()))
+            return;
+
+        const QString partialPath = cachePath + ".partial";
+        {
+            QFile file(partialPath);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            {
+                qWarning() << "Failed to write the matrix cache:" << cachePath;
+                return;
+            }
+
+            QDataStream out(&file);
+            out.setByteOrder(QDataStream::LittleEndian);
+            out << CACHE_FILE_MAGIC << CACHE_FILE_VERSION << quint64(matrix.numRows) << quint64(matrix.numCols);
+
+            // The values stream out of the matrix a chunk of rows at a time, mapped pages are only read once
+            for (size_t row = 0; row < matrix.numRows && out.status() == QDataStream::Ok; row += CACHE_ROWS_PER_CHUNK)
+            {
+                const size_t numChunkRows = std::min(CACHE_ROWS_PER_CHUNK, matrix.numRows - row);
+                out.writeRawData(reinterpret_cast<const char*>(matrix.data.data() + row * matrix.numCols), static_cast<int>(numChunkRows * matrix.numCols * sizeof(float)));
+            }
+
+            WriteStrings(out, matrix.headers);
+            WriteStrings(out, df.getHeaders());
+            for (const std::vector<QString>& row : df.getData())
+                WriteStrings(out, row);
+
+            if (out.status() != QDataStream::Ok)
+            {
+                qWarning() << "Failed to write the matrix cache:" << cachePath;
+                file.close();
+                QFile::remove(partialPath);
+                return;
+            }
+        }
+
+        QFile::remove(cachePath);
+        if (!QFile::rename(partialPath, cachePath))
+            QFile::remove(partialPath);
+    }
+
+    // Streams a cache file into the matrix, which keeps its storage. Returns false, with the matrix and the data frame
+    // emptied, if the file is missing or doesn't hold a complete matrix.
+    bool ReadCache(const QString& cachePath, DataFrame& df, MatrixData& matrix)
+    {
+        QFile file(cachePath);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+
+        TRACE_SCOPE("Matrix cache read", cachePath);
+
+        QDataStream in(&file);
+        in.setByteOrder(QDataStream::LittleEndian);
+
+        quint32 magic, version;
+        quint64 numRows, numCols;
+        in >> magic >> version >> numRows >> numCols;
+
+        // The values must fit in the file before they are read
+        const bool isConsistent = in.status() == QDataStream::Ok && magic == CACHE_FILE_MAGIC && version == CACHE_FILE_VERSION
+            && numCols > 0 && numRows <= static_cast<quint64>(file.size()) / (numCols * sizeof(float));
+
+        bool isComplete = isConsistent;
+        if (isConsistent)
+        {
+            matrix.numRows = numRows;
+            matrix.numCols = numCols;
+
+            std::vector<float> chunk(CACHE_ROWS_PER_CHUNK * numCols);
+            for (size_t row = 0; row < numRows && in.status() == QDataStream::Ok; row += CACHE_ROWS_PER_CHUNK)
+            {
+                const size_t numChunkValues = std::min<size_t>(CACHE_ROWS_PER_CHUNK, numRows - row) * numCols;
+                in.readRawData(reinterpret_cast<char*>(chunk.data()), static_cast<int>(numChunkValues * sizeof(float)));
+                matrix.data.append(chunk.data(), numChunkValues);
+            }
+
+            std::vector<QString> dfHeaders;
+            isComplete = ReadStrings(in, matrix.headers) && ReadStrings(in, dfHeaders) && matrix.headers.size() == numCols;
+            for (const QString& header : dfHeaders)
+                df.addHeader(header);
+
+            for (quint64 row = 0; row < numRows && isComplete; row++)
+            {
+                std::vector<QString> dfRow;
+                isComplete = ReadStrings(in, dfRow) && dfRow.size() == dfHeaders.size();
+                df.getData().push_back(std::move(dfRow));
+            }
+        }
+
+        if (!isComplete)
+        {
+            qWarning() << "Ignoring an incomplete matrix cache:" << cachePath;
+            matrix.data.clear();
+            matrix.headers.clear();
+            matrix.numRows = 0;
+            matrix.numCols = 0;
+            df = DataFrame();
+        }
+
+        return isComplete;
+    }
+
     void ReadHeader(QString fileName, DataFrame& df, MatrixData& matrix, int numMetaColumns)
     {
         QFile inputFile(fileName);
@@ -23,7 +185,7 @@ namespace
         // Check if file can open, if not throw an exception
         if (!inputFile.open(QIODevice::ReadOnly))
         {
-            throw mv::plugin::DataLoadException(fileName, "Failed to open file at location.");
+            throw LoadException(fileName, "Failed to open file at location.");
         }
 
         QTextStream in(&inputFile);
@@ -111,7 +273,7 @@ namespace
         }
     }
 
-    void ReadBody(QString fileName, DataFrame& df, MatrixData& matrix, int numMetaColumns, bool handleMissingValues)
+    void ReadBody(QString fileName, DataFrame& df, MatrixData& matrix, int numMetaColumns, bool handleMissingValues, TransformPipeline& transforms)
     {
         std::vector<QString> metadataRow(numMetaColumns);
         std::vector<float> dataRow(matrix.numCols);
@@ -119,13 +281,15 @@ namespace
         // Open file again
         io::LineReader fin(fileName.toStdString());
 
-        // Define variables
-        char* token;
         int lineCount = 0;
 
         // Skip header
         fin.next_line();
-        
+
+        bool hasTransforms = !transforms.isEmpty();
+        if (hasTransforms)
+            transforms.begin(matrix.numCols);
+
         // Process data line-by-line
         while (char* line = fin.next_line())
         {
@@ -134,12 +298,19 @@ namespace
             else
                 FastLineRead(line, metadataRow, dataRow, numMetaColumns);
 
+            // Transform the row while it is still in cache
+            if (hasTransforms)
+                transforms.transformRow(dataRow.data());
+
             df.getData().push_back(metadataRow);
-            matrix.data.insert(matrix.data.end(), dataRow.begin(), dataRow.end());
+            matrix.data.append(dataRow.data(), dataRow.size());
 
             lineCount++;
         }
         matrix.numRows = lineCount;
+
+        if (hasTransforms)
+            transforms.finish(matrix);
     }
 }
 
@@ -149,13 +320,27 @@ void MatrixDataLoader::LoadMatrixData(QString fileName, DataFrame& df, MatrixDat
     QFileInfo fileInfo(fileName);
     if (!fileInfo.exists())
     {
-        throw mv::plugin::DataLoadException(fileName, "File was not found at location.");
+        throw LoadException(fileName, "File was not found at location.");
     }
 
     // Measure time
-    Timer timer("Data Load [" + fileName + "]");
+    QElapsedTimer timer;
+    timer.start();
+    TRACE_SCOPE("CSV parse", fileName);
+
+    const QString cachePath = _cacheDir.isEmpty() ? QString() : CacheFilePath(_cacheDir, fileInfo, numMetaCols, _handleMissingValues, _transforms);
+    if (!cachePath.isEmpty() && ReadCache(cachePath, df, matrix))
+    {
+        qDebug() << "Data Load [" + fileName + "] from cache:" << timer.elapsed() << "ms";
+        return;
+    }
 
     // File is open
     ReadHeader(fileName, df, matrix, numMetaCols);
-    ReadBody(fileName, df, matrix, numMetaCols, _handleMissingValues);
+    ReadBody(fileName, df, matrix, numMetaCols, _handleMissingValues, _transforms);
+
+    if (!cachePath.isEmpty())
+        WriteCache(cachePath, df, matrix);
+
+    qDebug() << "Data Load [" + fileName + "]:" << timer.elapsed() << "ms";
 }
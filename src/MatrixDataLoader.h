@@ -1,11 +1,9 @@
 #pragma once
 
 #include "DataFrame.h"
+#include "MatrixTransforms.h"
 
-namespace mv
-{
-    class ModalTask;
-}
+#include <QString>
 
 class MatrixData;
 
@@ -18,8 +16,18 @@ public:
 
     }
 
+    // Transforms applied to the matrix values while they are being parsed
+    void setTransforms(const TransformPipeline& transforms) { _transforms = transforms; }
+    const TransformPipeline& getTransforms() const { return _transforms; }
+
+    // Directory parsed matrices are cached in, none if empty. A file that was parsed before with the same transforms
+    // is streamed from its cache into the matrix instead, so file-backed matrices stay out of memory either way.
+    void setCacheDir(const QString& cacheDir) { _cacheDir = cacheDir; }
+
     void LoadMatrixData(QString fileName, DataFrame& df, MatrixData& matrix, int numMetaCols);
 
 private:
     bool _handleMissingValues = false;
+    TransformPipeline _transforms;
+    QString _cacheDir;
 };
@@ -0,0 +1,228 @@
+#include "MatrixStorage.h"
+
+#include "LoadException.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QTemporaryFile>
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Minimum number of values a mapped file grows by, so appending rows one at a time does not remap every row
+    constexpr size_t MIN_FILE_CAPACITY = 1 << 20;
+
+    qint64 fileSize(size_t capacity)
+    {
+        return static_cast<qint64>(capacity * sizeof(float));
+    }
+}
+
+MatrixStorage::MatrixStorage(const MatrixStorage& other)
+{
+    *this = other;
+}
+
+MatrixStorage::MatrixStorage(MatrixStorage&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MatrixStorage::~MatrixStorage()
+{
+    close();
+}
+
+MatrixStorage& MatrixStorage::operator=(const MatrixStorage& other)
+{
+    if (this == &other)
+        return *this;
+
+    *this = MatrixStorage();
+
+    if (other.isFileBacked())
+        mapFile();
+
+    append(other.data(), other.size());
+
+    return *this;
+}
+
+MatrixStorage& MatrixStorage::operator=(MatrixStorage&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    close();
+
+    _memory = std::move(other._memory);
+    _file = std::move(other._file);
+    _mapping = other._mapping;
+    _size = other._size;
+    _capacity = other._capacity;
+    _values = _file ? other._values : _memory.data();
+
+    other._mapping = nullptr;
+    other._values = nullptr;
+    other._size = 0;
+    other._capacity = 0;
+
+    return *this;
+}
+
+bool MatrixStorage::mapFile(const QString& filePath)
+{
+    std::unique_ptr<QFile> file;
+    if (filePath.isEmpty())
+    {
+        auto temporaryFile = std::make_unique<QTemporaryFile>();
+        if (!temporaryFile->open())
+        {
+            qWarning() << "Failed to create a temporary file for the matrix values";
+            return false;
+        }
+        file = std::move(temporaryFile);
+    }
+    else
+    {
+        file = std::make_unique<QFile>(filePath);
+        if (!file->open(QIODevice::ReadWrite | QIODevice::Truncate))
+        {
+            qWarning() << "Failed to open matrix storage file:" << filePath;
+            return false;
+        }
+    }
+
+    // Move the values gathered so far into the file
+    std::vector<float> values = isFileBacked() ? toVector() : std::move(_memory);
+    *this = MatrixStorage();
+
+    _file = std::move(file);
+    if (!remap(std::max(values.size(), MIN_FILE_CAPACITY)))
+    {
+        _file.reset();
+        _memory = std::move(values);
+        _values = _memory.data();
+        _size = _memory.size();
+        return false;
+    }
+
+    std::memcpy(_values, values.data(), values.size() * sizeof(float));
+    _size = values.size();
+
+    return true;
+}
+
+QString MatrixStorage::getFilePath() const
+{
+    return _file ? _file->fileName() : QString();
+}
+
+void MatrixStorage::append(const float* values, size_t count)
+{
+    if (_file)
+        reserve(_size + count);
+
+    if (!_file)
+    {
+        _memory.insert(_memory.end(), values, values + count);
+        _values = _memory.data();
+        _size = _memory.size();
+        return;
+    }
+
+    std::memcpy(_values + _size, values, count * sizeof(float));
+    _size += count;
+}
+
+void MatrixStorage::resize(size_t size)
+{
+    if (_file)
+        reserve(size);
+
+    if (!_file)
+    {
+        _memory.resize(size);
+        _values = _memory.data();
+        _size = size;
+        return;
+    }
+
+    if (size > _size)
+        std::fill(_values + _size, _values + size, 0.0f);
+    _size = size;
+}
+
+void MatrixStorage::reserve(size_t capacity)
+{
+    if (capacity <= _capacity)
+        return;
+
+    // Grow geometrically so appending is amortized constant time
+    if (!remap(std::max({ capacity, _capacity * 2, MIN_FILE_CAPACITY })))
+    {
+        qWarning() << "Failed to grow matrix storage file, keeping the values in memory:" << _file->fileName();
+        moveToMemory();
+    }
+}
+
+bool MatrixStorage::remap(size_t capacity)
+{
+    unmap();
+
+    if (_file->size() < fileSize(capacity) && !_file->resize(fileSize(capacity)))
+        return false;
+
+    _mapping = _file->map(0, fileSize(capacity));
+    if (_mapping == nullptr)
+    {
+        qWarning() << "Failed to map matrix storage file:" << _file->fileName() << _file->errorString();
+        return false;
+    }
+
+    _values = reinterpret_cast<float*>(_mapping);
+    _capacity = capacity;
+
+    return true;
+}
+
+void MatrixStorage::unmap()
+{
+    if (_mapping != nullptr)
+        _file->unmap(_mapping);
+
+    _mapping = nullptr;
+    _values = nullptr;
+    _capacity = 0;
+}
+
+void MatrixStorage::moveToMemory()
+{
+    // The file holds the values written through the mapping, which the failed remap already unmapped
+    std::vector<float> values(_size);
+    const qint64 numBytes = static_cast<qint64>(_size * sizeof(float));
+    if (!_file->seek(0) || _file->read(reinterpret_cast<char*>(values.data()), numBytes) != numBytes)
+        throw LoadException(_file->fileName(), "Failed to read back the matrix values: " + _file->errorString());
+
+    unmap();
+    _file.reset();
+
+    _memory = std::move(values);
+    _values = _memory.data();
+}
+
+void MatrixStorage::close()
+{
+    if (!_file)
+        return;
+
+    // Leave a named file trimmed to its values
+    unmap();
+    if (dynamic_cast<QTemporaryFile*>(_file.get()) == nullptr)
+        _file->resize(fileSize(_size));
+
+    _file.reset();
+    _size = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QFile>
+#include <QString>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Contiguous float storage of a row-major matrix. By default the values live in memory, after mapFile() they live
+// in a memory-mapped file instead, so matrices larger than RAM can be parsed and processed by streaming over the rows
+// while the operating system pages them in and out. If the file can't grow, the values move back into memory.
+class MatrixStorage
+{
+public:
+    MatrixStorage() = default;
+    MatrixStorage(const MatrixStorage& other);
+    MatrixStorage(MatrixStorage&& other) noexcept;
+    ~MatrixStorage();
+
+    // Copies of file-backed storage are backed by a temporary file of their own
+    MatrixStorage& operator=(const MatrixStorage& other);
+    MatrixStorage& operator=(MatrixStorage&& other) noexcept;
+
+    // Moves the values into a memory-mapped file, which is created or truncated. Pass an empty path for a temporary file.
+    bool mapFile(const QString& filePath = QString());
+
+    bool isFileBacked() const { return _file != nullptr; }
+    QString getFilePath() const;
+
+    float* data() { return _values; }
+    const float* data() const { return _values; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    float& operator[](size_t index) { return _values[index]; }
+    const float& operator[](size_t index) const { return _values[index]; }
+
+    float* begin() { return _values; }
+    float* end() { return _values + _size; }
+    const float* begin() const { return _values; }
+    const float* end() const { return _values + _size; }
+
+    void append(const float* values, size_t count);
+    void resize(size_t size);
+    void clear() { resize(0); }
+
+    // Copy of the values in memory, for consumers that need a vector
+    std::vector<float> toVector() const { return std::vector<float>(begin(), end()); }
+
+private:
+    void reserve(size_t capacity);
+    bool remap(size_t capacity);
+    void unmap();
+    void moveToMemory();
+    void close();
+
+private:
+    std::vector<float> _memory;
+
+    std::unique_ptr<QFile> _file;
+    uchar* _mapping = nullptr;
+
+    float* _values = nullptr;
+    size_t _size = 0;
+    size_t _capacity = 0;
+};
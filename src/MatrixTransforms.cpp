@@ -0,0 +1,94 @@
+#include "MatrixTransforms.h"
+
+#include "MatrixData.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+void MatrixTransform::applyToRow(float* row, size_t numCols, const float* means, const float* invStdDevs) const
+{
+    switch (type)
+    {
+    case TransformType::LIBRARY_SIZE_NORMALIZE:
+    {
+        double librarySize = 0;
+        for (size_t c = 0; c < numCols; c++)
+            librarySize += row[c] != MISSING_VALUE ? row[c] : 0;
+
+        if (librarySize == 0)
+            break;
+
+        const float scale = static_cast<float>(param0 / librarySize);
+        for (size_t c = 0; c < numCols; c++)
+            row[c] = row[c] != MISSING_VALUE ? row[c] * scale : row[c];
+        break;
+    }
+    case TransformType::LOG1P:
+        for (size_t c = 0; c < numCols; c++)
+            row[c] = row[c] != MISSING_VALUE ? std::log1p(row[c]) : row[c];
+        break;
+    case TransformType::CLIP:
+        for (size_t c = 0; c < numCols; c++)
+            row[c] = row[c] != MISSING_VALUE ? std::clamp(row[c], param0, param1) : row[c];
+        break;
+    case TransformType::ZSCORE:
+        for (size_t c = 0; c < numCols; c++)
+            row[c] = row[c] != MISSING_VALUE ? (row[c] - means[c]) * invStdDevs[c] : row[c];
+        break;
+    }
+}
+
+TransformPipeline& TransformPipeline::add(const MatrixTransform& transform)
+{
+    _transforms.push_back(transform);
+
+    // Find the prefix of row transforms that can run while parsing
+    _numFusedTransforms = 0;
+    while (_numFusedTransforms < _transforms.size() && !_transforms[_numFusedTransforms].isColumnTransform())
+        _numFusedTransforms++;
+
+    return *this;
+}
+
+void TransformPipeline::begin(size_t numCols)
+{
+    _numCols = numCols;
+    _stats = ColumnStatistics(numCols);
+}
+
+void TransformPipeline::transformRow(float* row)
+{
+    for (size_t i = 0; i < _numFusedTransforms; i++)
+        _transforms[i].applyToRow(row, _numCols, nullptr, nullptr);
+
+    _stats.addRow(row);
+}
+
+void TransformPipeline::finish(MatrixData& matrix)
+{
+    // The remaining transforms run in segments that start at a column transform. The first uses the statistics
+    // gathered while parsing, every later one those of the output of the segment before it.
+    for (size_t begin = _numFusedTransforms; begin < _transforms.size();)
+    {
+        size_t end = begin + 1;
+        while (end < _transforms.size() && !_transforms[end].isColumnTransform())
+            end++;
+
+        const ColumnStatistics stats = begin == _numFusedTransforms ? _stats : matrix.computeColumnStatistics();
+        _means = stats.means();
+        _invStdDevs = stats.stdDevs();
+        for (float& v : _invStdDevs)
+            v = v != 0 ? 1.0f / v : 1.0f; // Avoid division by zero
+
+        parallelFor(matrix.numRows, 256, [this, &matrix, begin, end](size_t row)
+        {
+            float* rowData = matrix.data.data() + row * matrix.numCols;
+
+            for (size_t i = begin; i < end; i++)
+                _transforms[i].applyToRow(rowData, matrix.numCols, _means.data(), _invStdDevs.data());
+        });
+
+        begin = end;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ColumnStatistics.h"
+
+#include <vector>
+
+class MatrixData;
+
+enum class TransformType
+{
+    LIBRARY_SIZE_NORMALIZE, // Scale every row to sum up to a target (e.g. 1e6 for CPM)
+    LOG1P,                  // Natural logarithm of one plus the value
+    CLIP,                   // Clamp values to a range
+    ZSCORE                  // Center and scale every column to unit variance
+};
+
+class MatrixTransform
+{
+public:
+    static MatrixTransform libraryNormalize(float targetSum = 1e6f) { return { TransformType::LIBRARY_SIZE_NORMALIZE, targetSum, 0 }; }
+    static MatrixTransform log1p() { return { TransformType::LOG1P, 0, 0 }; }
+    static MatrixTransform clip(float min, float max) { return { TransformType::CLIP, min, max }; }
+    static MatrixTransform zScore() { return { TransformType::ZSCORE, 0, 0 }; }
+
+    // Column transforms need statistics over all rows, row transforms only need the row itself
+    bool isColumnTransform() const { return type == TransformType::ZSCORE; }
+
+    // Column transforms use the column means and inverse standard deviations, row transforms ignore them
+    void applyToRow(float* row, size_t numCols, const float* means, const float* invStdDevs) const;
+
+public:
+    TransformType type;
+    float param0;
+    float param1;
+};
+
+// Chain of transforms that MatrixDataLoader applies while parsing. Row transforms up to the first
+// column transform run fused on every parsed row while it is still in cache, and column statistics
+// of their output are accumulated along the way. The remaining transforms run in a single pass over
+// the matrix once parsing is done, using those statistics. Every further column transform takes
+// another pass to gather the statistics of the values before it.
+class TransformPipeline
+{
+public:
+    TransformPipeline& add(const MatrixTransform& transform);
+
+    bool isEmpty() const { return _transforms.empty(); }
+    bool endsWith(TransformType type) const { return !_transforms.empty() && _transforms.back().type == type; }
+    const std::vector<MatrixTransform>& getTransforms() const { return _transforms; }
+
+    void begin(size_t numCols);
+    void transformRow(float* row);
+    void finish(MatrixData& matrix);
+
+    // Statistics of the values after the fused row transforms
+    const ColumnStatistics& getColumnStatistics() const { return _stats; }
+
+private:
+    std::vector<MatrixTransform> _transforms;
+    size_t _numFusedTransforms = 0;
+
+    size_t _numCols = 0;
+    ColumnStatistics _stats;
+    std::vector<float> _means;
+    std::vector<float> _invStdDevs;
+};
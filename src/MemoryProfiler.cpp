@@ -0,0 +1,280 @@
+#include "MemoryProfiler.h"
+
+#include "json.hpp"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+using json = nlohmann::json;
+
+namespace
+{
+    constexpr std::chrono::milliseconds SAMPLE_INTERVAL(5);
+
+    // Number of largest containers listed per stage
+    constexpr size_t NUM_REPORTED_CONTAINERS = 5;
+
+    struct StageRecord
+    {
+        QString name;
+        int depth = 0;
+        size_t rssBegin = 0;
+        size_t rssEnd = 0;
+        size_t rssPeak = 0;
+        size_t processPeakBegin = 0;
+        bool finished = false;
+        std::vector<std::pair<QString, size_t>> containers;
+    };
+
+    std::mutex stageMutex;
+    std::vector<StageRecord> stages;
+    std::vector<int> activeStages;                  // Indices of the stages that are running on any thread, in the order they began
+    thread_local std::vector<int> threadStages;     // Indices of the nested stages running on this thread, innermost last
+
+    // The sampler runs while any stage does. It is started and stopped under its own mutex, so a stage that begins while
+    // the sampler of the previous one is being joined waits for it rather than racing it.
+    std::mutex samplerMutex;
+    int numSamplerUsers = 0;
+    std::thread sampler;
+    std::condition_variable samplerCondition;
+    bool stopSampler = false;
+
+    const bool enabled = !qEnvironmentVariableIsEmpty("PATCHSEQ_MEMORY_REPORT");
+
+    void sampleRss()
+    {
+        std::unique_lock<std::mutex> lock(stageMutex);
+        while (!stopSampler)
+        {
+            lock.unlock();
+            size_t rss = MemoryProfiler::currentRss();
+            lock.lock();
+
+            for (int stage : activeStages)
+                stages[stage].rssPeak = std::max(stages[stage].rssPeak, rss);
+
+            samplerCondition.wait_for(lock, SAMPLE_INTERVAL, [] { return stopSampler; });
+        }
+    }
+
+    void acquireSampler()
+    {
+        std::lock_guard<std::mutex> samplerLock(samplerMutex);
+        if (numSamplerUsers++ > 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(stageMutex);
+            stopSampler = false;
+        }
+        sampler = std::thread(sampleRss);
+    }
+
+    void releaseSampler()
+    {
+        std::lock_guard<std::mutex> samplerLock(samplerMutex);
+        if (--numSamplerUsers > 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(stageMutex);
+            stopSampler = true;
+        }
+        samplerCondition.notify_all();
+        sampler.join();
+    }
+
+    double toMegabytes(double bytes)
+    {
+        return bytes / (1024.0 * 1024.0);
+    }
+}
+
+bool MemoryProfiler::isEnabled()
+{
+    return enabled;
+}
+
+size_t MemoryProfiler::currentRss()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+        return info.resident_size;
+    return 0;
+#else
+    long pages = 0;
+    FILE* file = std::fopen("/proc/self/statm", "r");
+    if (file == nullptr)
+        return 0;
+    if (std::fscanf(file, "%*s %ld", &pages) != 1)
+        pages = 0;
+    std::fclose(file);
+    return static_cast<size_t>(pages) * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+size_t MemoryProfiler::peakRss()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+void MemoryProfiler::recordContainer(const QString& name, size_t bytes)
+{
+    if (!enabled)
+        return;
+
+    // A worker thread without a stage of its own records into the stage that began last, which started its work
+    std::lock_guard<std::mutex> lock(stageMutex);
+    if (!threadStages.empty())
+        stages[threadStages.back()].containers.emplace_back(name, bytes);
+    else if (!activeStages.empty())
+        stages[activeStages.back()].containers.emplace_back(name, bytes);
+}
+
+void MemoryProfiler::report()
+{
+    if (!enabled)
+        return;
+
+    json stageList = json::array();
+    {
+        std::lock_guard<std::mutex> lock(stageMutex);
+        for (StageRecord& stage : stages)
+        {
+            if (!stage.finished)
+                continue;
+
+            std::sort(stage.containers.begin(), stage.containers.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+            if (stage.containers.size() > NUM_REPORTED_CONTAINERS)
+                stage.containers.resize(NUM_REPORTED_CONTAINERS);
+
+            const size_t peakBytes = stage.rssPeak - stage.rssBegin;
+            const int64_t retainedBytes = static_cast<int64_t>(stage.rssEnd) - static_cast<int64_t>(stage.rssBegin);
+
+            qDebug().noquote() << QString(stage.depth * 2, ' ') + stage.name << "peak" << toMegabytes(peakBytes) << "MB, retained" << toMegabytes(retainedBytes) << "MB, RSS" << toMegabytes(stage.rssEnd) << "MB";
+
+            json containers = json::array();
+            for (const auto& [name, bytes] : stage.containers)
+            {
+                qDebug().noquote() << QString(stage.depth * 2 + 4, ' ') + name << toMegabytes(bytes) << "MB";
+                containers.push_back({ { "name", name.toStdString() }, { "bytes", bytes } });
+            }
+
+            stageList.push_back({
+                { "name", stage.name.toStdString() },
+                { "depth", stage.depth },
+                { "rssBeginBytes", stage.rssBegin },
+                { "rssEndBytes", stage.rssEnd },
+                { "rssPeakBytes", stage.rssPeak },
+                { "peakBytes", peakBytes },
+                { "retainedBytes", retainedBytes },
+                { "largestContainers", containers }
+            });
+        }
+    }
+
+    QString filePath = qEnvironmentVariable("PATCHSEQ_MEMORY_REPORT");
+    std::ofstream file(filePath.toStdString());
+    if (!file)
+    {
+        qWarning() << "Failed to write memory report to" << filePath;
+        return;
+    }
+
+    file << json({ { "peakRssBytes", peakRss() }, { "stages", stageList } }).dump(2);
+    qDebug() << "Wrote memory report to" << filePath;
+}
+
+MemoryStage::MemoryStage(const char* name)
+{
+    if (!enabled)
+        return;
+
+    StageRecord stage;
+    stage.name = name;
+    stage.rssBegin = MemoryProfiler::currentRss();
+    stage.rssPeak = stage.rssBegin;
+    stage.processPeakBegin = MemoryProfiler::peakRss();
+
+    // Stages nest within the stages of their own thread
+    stage.depth = static_cast<int>(threadStages.size());
+    {
+        std::lock_guard<std::mutex> lock(stageMutex);
+        _stage = static_cast<int>(stages.size());
+        stages.push_back(std::move(stage));
+        activeStages.push_back(_stage);
+    }
+    threadStages.push_back(_stage);
+
+    acquireSampler();
+}
+
+MemoryStage::~MemoryStage()
+{
+    if (_stage < 0)
+        return;
+
+    const size_t rss = MemoryProfiler::currentRss();
+    const size_t processPeak = MemoryProfiler::peakRss();
+
+    {
+        std::lock_guard<std::mutex> lock(stageMutex);
+        StageRecord& stage = stages[_stage];
+        stage.rssEnd = rss;
+        stage.rssPeak = std::max(stage.rssPeak, rss);
+
+        // A new process peak during the stage is a peak of the stage, even if it fell between two samples
+        if (processPeak > stage.processPeakBegin)
+            stage.rssPeak = std::max(stage.rssPeak, processPeak);
+
+        stage.finished = true;
+        activeStages.erase(std::find(activeStages.begin(), activeStages.end(), _stage));
+    }
+    threadStages.erase(std::find(threadStages.begin(), threadStages.end(), _stage));
+
+    releaseSampler();
+}
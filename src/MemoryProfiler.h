@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QString>
+
+#include <cstddef>
+
+// Per-stage memory accounting of the loader. A MemoryStage samples the resident set size (RSS) of the process when it
+// begins and ends, and a background thread samples it every few milliseconds in between, which gives the peak and
+// retained bytes of the stage. Stages nest within the stages of the thread they run on, stages on other threads run
+// side by side. Stages list the sizes of their largest containers with recordContainer().
+// Profiling is enabled by setting the PATCHSEQ_MEMORY_REPORT environment variable to the path of the JSON report.
+namespace MemoryProfiler
+{
+    bool isEnabled();
+
+    // Resident set size of the process and its peak so far, in bytes
+    size_t currentRss();
+    size_t peakRss();
+
+    // Records the size of a container held by the innermost active stage of the calling thread, or by the stage that
+    // began last if the thread runs none
+    void recordContainer(const QString& name, size_t bytes);
+
+    // Records the memoryUsage() of a container, which is only computed when profiling is enabled
+    template<typename Container>
+    void recordContainer(const QString& name, const Container& container)
+    {
+        if (isEnabled())
+            recordContainer(name, container.memoryUsage());
+    }
+
+    // Logs the stages finished so far and writes them to the JSON report
+    void report();
+}
+
+class MemoryStage
+{
+public:
+    explicit MemoryStage(const char* name);
+    ~MemoryStage();
+
+    MemoryStage(const MemoryStage&) = delete;
+    MemoryStage& operator=(const MemoryStage&) = delete;
+
+private:
+    int _stage = -1;    // Index of the stage in the report, -1 when profiling is disabled
+};
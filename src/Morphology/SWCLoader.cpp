@@ -1,8 +1,6 @@
 #include "SWCLoader.h"
 
-#include "CellMorphologyData/CellMorphology.h"
-
-#include <graphics/Vector3f.h>
+#include "Tracing.h"
 
 #include <fstream>
 #include <sstream>
@@ -13,6 +11,9 @@
 
 namespace
 {
+    // Structure identifier of the soma nodes in the SWC format
+    constexpr int SWC_SOMA_TYPE = 1;
+
     void loadCellContentsFromFile(QString filePath, std::string& result)
     {
         std::ifstream file(filePath.toStdString());
@@ -27,8 +28,10 @@ namespace
 
 }
 
-void SWCLoader::LoadSWC(QString filePath, CellMorphology& cellMorphology)
+void SWCLoader::LoadSWC(QString filePath, SWCMorphology& cellMorphology)
 {
+    TRACE_SCOPE("SWC file", filePath);
+
     std::string fileContents;
     loadCellContentsFromFile(filePath, fileContents);
 
@@ -63,7 +66,7 @@ void SWCLoader::LoadSWC(QString filePath, CellMorphology& cellMorphology)
                 float y = stof(token);
                 getline(ss, token, ' ');
                 float z = stof(token);
-                cellMorphology.positions.emplace_back(x, y, z);
+                cellMorphology.positions.push_back({ x, y, z });
                 break;
             }
             case 3: cellMorphology.radii.push_back(stof(token)); break;
@@ -75,20 +78,18 @@ void SWCLoader::LoadSWC(QString filePath, CellMorphology& cellMorphology)
     }
 
     // Compute id to index map
-    for (int i = 0; i < cellMorphology.ids.size(); i++)
+    for (size_t i = 0; i < cellMorphology.ids.size(); i++)
     {
         int id = cellMorphology.ids[i];
         cellMorphology.idMap[id] = i;
     }
 
     // Find soma
-    for (int i = 0; i < cellMorphology.ids.size(); i++)
+    for (size_t i = 0; i < cellMorphology.ids.size(); i++)
     {
-        mv::Vector3f position = cellMorphology.positions.at(i);
-
-        if (cellMorphology.types.at(i) == (int) CellMorphology::Type::Soma)
+        if (cellMorphology.types.at(i) == SWC_SOMA_TYPE)
         {
-            cellMorphology.somaPosition = position;
+            cellMorphology.somaPosition = cellMorphology.positions.at(i);
             break;
         }
     }
@@ -2,12 +2,32 @@
 
 #include <QString>
 
-class CellMorphology;
+#include <unordered_map>
+#include <vector>
+
+// Nodes of a reconstruction as read from an SWC file, the plugin converts them to its CellMorphology type
+class SWCMorphology
+{
+public:
+    struct Position
+    {
+        float x, y, z;
+    };
+
+    std::vector<int> ids;
+    std::vector<int> types;
+    std::vector<Position> positions;
+    std::vector<float> radii;
+    std::vector<int> parents;
+
+    std::unordered_map<int, int> idMap;     // Node ID to index
+    Position somaPosition = { 0, 0, 0 };
+};
 
 class SWCLoader
 {
 public:
-    void LoadSWC(QString filePath, CellMorphology& cellMorphology);
+    void LoadSWC(QString filePath, SWCMorphology& cellMorphology);
 private:
 
 };
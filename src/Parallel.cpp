@@ -0,0 +1,139 @@
+#include "Parallel.h"
+
+#include <condition_variable>
+#include <deque>
+
+namespace
+{
+    // Tasks of one runParallelTasks() call, claimed by index by the pool threads and the calling thread
+    struct Job
+    {
+        const std::function<void(size_t)>* task = nullptr;
+        size_t numTasks = 0;
+
+        std::atomic<size_t> nextTask{ 0 };
+        size_t numFinished = 0;                 // Guarded by the pool mutex
+        size_t numPoolThreads = 0;              // Pool threads that hold the job, guarded by the pool mutex
+        std::exception_ptr exception;           // Guarded by the pool mutex
+
+        bool isDone() const { return numFinished == numTasks && numPoolThreads == 0; }
+    };
+
+    class ThreadPool
+    {
+    public:
+        ThreadPool()
+        {
+            // The thread that runs a job is one of its workers
+            const unsigned int numThreads = numWorkerThreads() - 1;
+            for (unsigned int t = 0; t < numThreads; t++)
+                _threads.emplace_back([this]() { work(); });
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _jobAdded.notify_all();
+
+            for (std::thread& thread : _threads)
+                thread.join();
+        }
+
+        void run(Job& job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _jobs.push_back(&job);
+            }
+            _jobAdded.notify_all();
+
+            runTasks(job);
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobFinished.wait(lock, [&job]() { return job.isDone(); });
+        }
+
+    private:
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _jobAdded.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+                if (_stopping)
+                    return;
+
+                // The job stays alive until its pool threads let go of it
+                Job* job = _jobs.front();
+                job->numPoolThreads++;
+                lock.unlock();
+                runTasks(*job);
+                lock.lock();
+
+                job->numPoolThreads--;
+                if (job->isDone())
+                    _jobFinished.notify_all();
+            }
+        }
+
+        // Runs tasks of the job until all of them are claimed
+        void runTasks(Job& job)
+        {
+            for (size_t i = job.nextTask++; i < job.numTasks; i = job.nextTask++)
+            {
+                // Once all tasks are claimed no other thread needs to find the job
+                if (i + 1 == job.numTasks)
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _jobs.erase(std::find(_jobs.begin(), _jobs.end(), &job));
+                }
+
+                std::exception_ptr exception;
+                try
+                {
+                    (*job.task)(i);
+                }
+                catch (...)
+                {
+                    exception = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (exception && !job.exception)
+                    job.exception = exception;
+
+                job.numFinished++;
+                if (job.isDone())
+                    _jobFinished.notify_all();
+            }
+        }
+
+        std::vector<std::thread> _threads;
+
+        std::mutex _mutex;
+        std::condition_variable _jobAdded;
+        std::condition_variable _jobFinished;
+        std::deque<Job*> _jobs;
+        bool _stopping = false;
+    };
+}
+
+void runParallelTasks(size_t numTasks, const std::function<void(size_t)>& task)
+{
+    static ThreadPool pool;
+
+    if (numTasks == 0)
+        return;
+
+    Job job;
+    job.task = &task;
+    job.numTasks = numTasks;
+
+    pool.run(job);
+
+    if (job.exception)
+        std::rethrow_exception(job.exception);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of worker threads used by the data-parallel kernels
+inline unsigned int numWorkerThreads()
+{
+    unsigned int numThreads = std::thread::hardware_concurrency();
+    return numThreads == 0 ? 1 : numThreads;
+}
+
+// Size of the contiguous blocks that parallelForBlocks() splits a range of count elements into
+inline size_t parallelBlockSize(size_t count, size_t minBlockSize)
+{
+    minBlockSize = std::max<size_t>(minBlockSize, 1);
+
+    size_t numBlocks = std::clamp<size_t>((count + minBlockSize - 1) / minBlockSize, 1, numWorkerThreads());
+
+    return std::max<size_t>((count + numBlocks - 1) / numBlocks, 1);
+}
+
+// Number of blocks parallelForBlocks() will run for a range of count elements, so callers can allocate per-block partial results up front
+inline size_t numParallelBlocks(size_t count, size_t minBlockSize)
+{
+    if (count == 0)
+        return 0;
+
+    size_t blockSize = parallelBlockSize(count, minBlockSize);
+    return (count + blockSize - 1) / blockSize;
+}
+
+// Calls task(i) for every i in [0, numTasks) on the threads of a pool that lives as long as the process, and returns once
+// all tasks finished. The calling thread runs tasks as well, so calls may be nested or come from several threads at once.
+// The first exception thrown by a task is rethrown on the calling thread.
+void runParallelTasks(size_t numTasks, const std::function<void(size_t)>& task);
+
+// Splits the range [0, count) into contiguous blocks of at least minBlockSize elements, and calls fn(blockIndex, begin, end)
+// for every block on the worker pool. Blocks are ordered, so merging partial results by block index is deterministic.
+template<typename Function>
+size_t parallelForBlocks(size_t count, size_t minBlockSize, Function fn)
+{
+    size_t numBlocks = numParallelBlocks(count, minBlockSize);
+    if (numBlocks == 0)
+        return 0;
+
+    size_t blockSize = parallelBlockSize(count, minBlockSize);
+
+    // A single block doesn't need the pool
+    if (numBlocks == 1)
+    {
+        fn(size_t(0), size_t(0), count);
+        return 1;
+    }
+
+    runParallelTasks(numBlocks, [&fn, count, blockSize](size_t b)
+    {
+        size_t begin = b * blockSize;
+        fn(b, begin, std::min(count, begin + blockSize));
+    });
+
+    return numBlocks;
+}
+
+// Calls fn(i) for every i in [0, count), distributing contiguous ranges over the worker threads
+template<typename Function>
+void parallelFor(size_t count, size_t minBlockSize, Function fn)
+{
+    parallelForBlocks(count, minBlockSize, [&fn](size_t, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            fn(i);
+    });
+}
+
+// Calls fn(i) for every i in [0, count) on at most maxThreads threads of its own, each of which takes the next index as
+// soon as it finished the previous one. Meant for coarse items of very different cost that may block, such as whole files,
+// the threads are started for every call and don't take workers from the pool of the kernels. The first exception
+// thrown by fn stops the remaining items and is rethrown on the calling thread once all workers finished.
+template<typename Function>
+void parallelForDynamic(size_t count, unsigned int maxThreads, Function fn)
+{
+    size_t numThreads = std::min<size_t>(count, std::max(maxThreads, 1u));
+    if (numThreads == 0)
+        return;
+
+    std::atomic<size_t> nextIndex(0);
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+
+    auto work = [&]()
+    {
+        for (size_t i = nextIndex++; i < count; i = nextIndex++)
+        {
+            try
+            {
+                fn(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(exceptionMutex);
+                if (!exception)
+                    exception = std::current_exception();
+                nextIndex = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(numThreads - 1);
+    for (size_t t = 1; t < numThreads; t++)
+        workers.emplace_back(work);
+
+    // The calling thread is one of the workers
+    work();
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
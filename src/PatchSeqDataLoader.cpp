@@ -4,13 +4,21 @@
 
 #include "MatrixDataLoader.h"
 #include "MatrixData.h"
+#include "PatchSeqStages.h"
+#include "Analysis/NearestNeighbors.h"
 
 #include "EphysData/Experiment.h"
+#include "EphysData/ActionPotential.h"
 #include "Electrophysiology/NWBLoader.h"
+#include "Electrophysiology/EphysTypes.h"
 
 #include "Taxonomy.h"
 #include "Morphology/SWCLoader.h"
 #include "FeatureNames.h"
+#include "Tracing.h"
+#include "MemoryProfiler.h"
+#include "LoadException.h"
+#include "Parallel.h"
 
 #include <util/Timer.h>
 
@@ -24,7 +32,9 @@
 #include <QtDebug>
 #include <QFileDialog>
 #include <QDir>
+#include <QStandardPaths>
 
+#include <charconv>
 #include <cstdlib>
 #include <fstream>
 #include <sstream>
@@ -34,6 +44,8 @@
 #include <algorithm>
 #include <unordered_set>
 #include <map>
+#include <limits>
+#include <mutex>
 
 Q_PLUGIN_METADATA(IID "studio.manivault.PatchSeqDataLoader")
 
@@ -72,6 +84,11 @@ Q_PLUGIN_METADATA(IID "studio.manivault.PatchSeqDataLoader")
 #define METADATA_CLUSTER_LABEL "Group_name"
 #define METADATA_SUBCLASS_LABEL "Subclass_name"
 
+#define EPHYS_IMPUTATION_STRATEGY ImputationStrategy::KNN
+
+// The gene expression file already holds counts per million
+#define TX_TRANSFORMS TransformPipeline().add(MatrixTransform::log1p())
+
 #define TX_PATH "D:/Dropbox/Julian/Patchseq/Supplied_Data/Data_June_Macaque/20250519_RSC-204-387_macaque_patchseq_star2.7_cpm_samples_by_genes_cell_ids.csv"
 #define EPHYS_PATH "D:/Dropbox/Julian/Patchseq/Supplied_Data/Data_June_Macaque/NHP_ephys_features_20250520.csv"
 #define MORPHO_PATH "D:/Dropbox/Julian/Patchseq/Supplied_Data/Data_June_Macaque/RawFeatureWide_dend_20250616.csv"
@@ -108,73 +125,248 @@ Q_PLUGIN_METADATA(IID "studio.manivault.PatchSeqDataLoader")
 
 #endif
 
+// The dataset blocks above can override the defaults of the processing stages in StageSettings with TX_TRANSFORMS,
+// TX_IMPUTATION_STRATEGY, EPHYS_IMPUTATION_STRATEGY, MORPHO_IMPUTATION_STRATEGY, NUM_HIGHLY_VARIABLE_GENES,
+// NUM_PCA_COMPONENTS, NUM_KNN_NEIGHBORS, NUM_MARKER_GENES_PER_CLUSTER, FILE_BACKED_MATRIX_THRESHOLD and
+// GENE_FEATURE_CORRELATION
+
+// Link the selections of all datasets through precomputed row maps, which select every row of a cell, instead of the
+// key based selection group, which selects one row per cell ID
+#ifndef INDEX_SELECTION_LINKING
+#define INDEX_SELECTION_LINKING 1
+#endif
+
+// Copy the ephys and morphology features into the metadata as text columns. Set to 0 to reference their datasets from
+// the "FeatureSources" property instead, once the viewers read it.
+#ifndef NUMERIC_METADATA_AS_TEXT
+#define NUMERIC_METADATA_AS_TEXT 1
+#endif
+
+// Maximum number of NWB files loaded at once, every file in flight holds its sweeps at full resolution
+#ifndef NUM_NWB_LOADER_THREADS
+#define NUM_NWB_LOADER_THREADS 8
+#endif
+
+// Only index the NWB files at load time, the sweeps of a cell are read when its traces are first selected
+#ifndef LAZY_EPHYS_TRACES
+#define LAZY_EPHYS_TRACES 1
+#endif
+
+// Maximum number of cells whose sweeps are read for one selection, the remaining cells are read by later selections
+#ifndef MAX_TRACES_READ_PER_SELECTION
+#define MAX_TRACES_READ_PER_SELECTION 32
+#endif
+
+// Time the selection of the ephys traces has to stay unchanged before their sweeps are read, brushing changes it on
+// every mouse move
+#ifndef EPHYS_TRACE_READ_DELAY_MS
+#define EPHYS_TRACE_READ_DELAY_MS 250
+#endif
+
+// Memory of the trace pyramids of the read sweeps, kept for zooming in. Beyond it the least recently viewed sweeps are
+// dropped and only show their display samples.
+#ifndef TRACE_PYRAMID_CACHE_BYTES
+#define TRACE_PYRAMID_CACHE_BYTES (256ll << 20)
+#endif
+
 using namespace mv;
 using namespace mv::gui;
 
 namespace
 {
-    void addPointsToTextDataset(Dataset<Points>& points, Dataset<Text>& text, std::vector<uint32_t>& indexMapping)
+    // Proper name of a feature if there is one
+    QString getProperFeatureName(const QString& name)
     {
-        for (int d = 0; d < points->getNumDimensions(); d++)
-        {
-            std::vector<QString> column(text->getNumRows(), "?");
-            QString dimName = points->getDimensionNames()[d];
+        auto it = properFeatureNames.find(name);
+        return it != properFeatureNames.end() ? it->second : name;
+    }
 
-            // Get a proper name if possible
-            QString properHeaderName = dimName;
-            if (properFeatureNames.find(dimName) != properFeatureNames.end())
-                properHeaderName = properFeatureNames[dimName];
+    StageSettings makeStageSettings()
+    {
+        StageSettings settings;
+        settings.cellIdTag = CELL_ID_TAG;
+#ifdef TX_TRANSFORMS
+        settings.geneTransforms = TX_TRANSFORMS;
+#endif
+#ifdef TX_IMPUTATION_STRATEGY
+        settings.geneImputation = TX_IMPUTATION_STRATEGY;
+#endif
+#ifdef EPHYS_IMPUTATION_STRATEGY
+        settings.ephysImputation = EPHYS_IMPUTATION_STRATEGY;
+#endif
+#ifdef MORPHO_IMPUTATION_STRATEGY
+        settings.morphologyImputation = MORPHO_IMPUTATION_STRATEGY;
+#endif
+#ifdef NUM_HIGHLY_VARIABLE_GENES
+        settings.numHighlyVariableGenes = NUM_HIGHLY_VARIABLE_GENES;
+#endif
+#ifdef NUM_PCA_COMPONENTS
+        settings.numPcaComponents = NUM_PCA_COMPONENTS;
+#endif
+#ifdef NUM_KNN_NEIGHBORS
+        settings.numKnnNeighbors = NUM_KNN_NEIGHBORS;
+#endif
+#ifdef NUM_MARKER_GENES_PER_CLUSTER
+        settings.numMarkerGenesPerCluster = NUM_MARKER_GENES_PER_CLUSTER;
+#endif
+#ifdef FILE_BACKED_MATRIX_THRESHOLD
+        settings.fileBackedMatrixThreshold = FILE_BACKED_MATRIX_THRESHOLD;
+#endif
+#ifdef GENE_FEATURE_CORRELATION
+        settings.geneFeatureCorrelation = GENE_FEATURE_CORRELATION;
+#endif
 
-            for (size_t i = 0; i < indexMapping.size(); i++)
-            {
-                uint32_t row = indexMapping[i];
-                column[row] = QString::number(points->getValueAt(i * points->getNumDimensions() + d));
-            }
-            text->addColumn(properHeaderName, column);
-        }
+        // Nearest neighbour indices are cached with the application, so reloading a dataset doesn't rebuild them
+        settings.knnCacheDir = QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("hnsw");
+        settings.matrixCacheDir = QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("matrices");
+
+        return settings;
     }
 
-    void removeRowsNotInMetadata(DataFrame& df, QString columnToCheck, DataFrame& metadata, MatrixData& matrix)
+#if !INDEX_SELECTION_LINKING
+    // Selection group mapping of a dataset, from the cell indices of its rows. Keys are the interned cell IDs,
+    // rows without a cell map to -1.
+    BiMap makeBiMap(const CellRegistry& registry, const std::vector<uint32_t>& rowCells)
     {
-        std::vector<QString> metaColumn = metadata[columnToCheck];
-        // Make a unique set out of meta column
-        std::unordered_set<QString> uniqueValues;
-        for (int i = 0; i < metaColumn.size(); i++)
+        std::vector<QString> keys(rowCells.size());
+        std::vector<uint32_t> values(rowCells.size());
+        for (uint32_t row = 0; row < rowCells.size(); row++)
         {
-            uniqueValues.insert(metaColumn[i]);
+            // Copies of the interned IDs share their data
+            bool hasCell = rowCells[row] != CellRegistry::INVALID_CELL;
+            keys[row] = hasCell ? registry.getCellId(rowCells[row]) : QString();
+            values[row] = hasCell ? row : CellRegistry::INVALID_CELL;
         }
 
-        // For every value in df column, check if its in metadata
-        std::vector<QString> dfColumn = df[columnToCheck];
-        std::vector<int> rowsToRemove;
-        for (int i = 0; i < dfColumn.size(); i++)
+        BiMap biMap;
+        biMap.addKeyValuePairs(keys, values);
+
+        return biMap;
+    }
+#endif
+
+    void addPointsToTextDataset(Dataset<Points>& points, Dataset<Text>& text, const RowMap& indexMapping)
+    {
+        TRACE_SCOPE("Metadata features");
+
+        char buffer[32];
+        for (int d = 0; d < points->getNumDimensions(); d++)
         {
-            QString row = dfColumn[i];
-            if (uniqueValues.find(row) == uniqueValues.end())
+            std::vector<QString> column(text->getNumRows(), "?");
+
+            for (size_t i = 0; i < indexMapping.numSourceRows(); i++)
             {
-                // Remove row because its not in the metadata
-                rowsToRemove.push_back(i);
+                // Same format as QString::number, without going through the locale
+                float value = points->getValueAt(i * points->getNumDimensions() + d);
+                auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
+                for (uint32_t row : indexMapping.targetRows(i))
+                    column[row] = QString::fromLatin1(buffer, result.ptr - buffer);
             }
+            text->addColumn(getProperFeatureName(points->getDimensionNames()[d]), column);
         }
-        qDebug() << "Removing " << rowsToRemove.size() << " rows because they are not found in metadata";
-
-        df.removeRows(rowsToRemove);
-        matrix.removeRows(rowsToRemove);
     }
 
-    void removeFeatures(MatrixData& matrix, QStringList features)
+    // Makes the dimensions of the points datasets numeric columns of the metadata, by reference instead of copying them.
+    // For every source the metadata lists its dataset, the names of its columns and, in metadataToSourceRows, the source
+    // row of every metadata row as native uint32 values, INVALID_CELL for cells without one. Formatting the values is
+    // left to whoever displays them.
+    void addMetadataFeatureReferences(Dataset<Text>& metadata, const std::vector<Dataset<Points>>& sources, const std::vector<RowMap>& metadataToSourceRows)
     {
-        std::vector<int> colsToDelete;
-        for (int i = 0; i < matrix.headers.size(); i++)
+        TRACE_SCOPE("Metadata features");
+        MemoryStage memoryStage("Metadata features");
+
+        QStringList names;
+        QVariantList featureSources;
+        for (size_t s = 0; s < sources.size(); s++)
         {
-            for (int j = 0; j < features.size(); j++)
-            {
-                if (matrix.headers[i] == features[j])
-                    colsToDelete.push_back(i);
-            }
+            const Dataset<Points>& points = sources[s];
+            if (!points.isValid())
+                continue;
+
+            QStringList columns;
+            for (const QString& dimName : points->getDimensionNames())
+                columns.append(getProperFeatureName(dimName));
+
+            // Features are deduplicated by cell, so a metadata row has at most one source row
+            const RowMap& rowMap = metadataToSourceRows[s];
+            QByteArray rows(static_cast<qsizetype>(rowMap.numSourceRows() * sizeof(uint32_t)), Qt::Uninitialized);
+            uint32_t* sourceRows = reinterpret_cast<uint32_t*>(rows.data());
+            for (size_t i = 0; i < rowMap.numSourceRows(); i++)
+                sourceRows[i] = rowMap.firstTargetRow(i);
+            MemoryProfiler::recordContainer("Metadata feature rows", rows.size());
+
+            QVariantMap featureSource;
+            featureSource["DatasetId"] = points->getId();
+            featureSource["Columns"] = columns;
+            featureSource["Rows"] = rows;
+            featureSources.append(featureSource);
+
+            names.append(columns);
         }
 
-        matrix.removeCols(colsToDelete);
+        metadata->setProperty("FeatureSources", featureSources);
+        metadata->setProperty("NumericColumns", names);
+    }
+
+    void addPCADataset(Dataset<Points> parent, const Embedding& embedding)
+    {
+        QVariantList explainedVarianceList;
+        for (float variance : embedding.explainedVariance)
+            explainedVarianceList.append(variance);
+
+        const MatrixData& scores = embedding.pcaScores;
+
+        Dataset<Points> pcaDataset = mv::data().createDataset("Points", "PCA", parent, "", false);
+        pcaDataset->setData(scores.data.data(), scores.numRows, scores.numCols);
+        pcaDataset->setDimensionNames(scores.headers);
+        pcaDataset->setProperty("ExplainedVariance", explainedVarianceList);
+
+        events().notifyDatasetAdded(pcaDataset);
+        events().notifyDatasetDataChanged(pcaDataset);
+    }
+
+    // Adds the kNN graph of all cells as a child of the modality dataset, the neighbours are stored as row indices
+    Dataset<Points> addNearestNeighborDataset(Dataset<Points> parent, const Embedding& embedding, size_t numNeighbors)
+    {
+        std::vector<QString> dimensionNames;
+        for (size_t i = 0; i < numNeighbors; i++)
+            dimensionNames.push_back(QString("Neighbor %1").arg(i + 1));
+
+        Dataset<Points> knnDataset = mv::data().createDataset("Points", "kNN Graph", parent, "", false);
+        knnDataset->setProperty("PatchSeqType", "KnnGraph");
+        knnDataset->setData(embedding.knnGraph, numNeighbors);
+        knnDataset->setDimensionNames(dimensionNames);
+
+        events().notifyDatasetAdded(knnDataset);
+        events().notifyDatasetDataChanged(knnDataset);
+
+        return knnDataset;
+    }
+
+    // Adds the PCA and kNN graph of a modality as children of its dataset, returns the kNN graph dataset
+    Dataset<Points> addEmbeddingDatasets(Dataset<Points> parent, const Embedding& embedding, const StageSettings& settings)
+    {
+        addPCADataset(parent, embedding);
+        return addNearestNeighborDataset(parent, embedding, settings.numKnnNeighbors);
+    }
+
+    // Adds the gene x feature correlation matrix as a child of the gene expression dataset
+    void addCorrelationDataset(Dataset<Points> parent, QString name, const GeneExpression& genes, const FeatureData& features, const StageSettings& settings)
+    {
+        Timer timer(name);
+
+        MatrixData correlations;
+        size_t numCells = CorrelateGenesWithFeatures(genes, features, settings, correlations);
+        qDebug() << name << "over" << numCells << "cells";
+
+        Dataset<Points> correlationDataset = mv::data().createDataset("Points", name, parent, "", false);
+        correlationDataset->setProperty("PatchSeqType", "Correlation");
+        correlationDataset->setProperty("GeneNames", QStringList(genes.matrix.headers.begin(), genes.matrix.headers.end()));
+        correlationDataset->setData(correlations.data.data(), correlations.numRows, correlations.numCols);
+        correlationDataset->setDimensionNames(correlations.headers);
+
+        events().notifyDatasetAdded(correlationDataset);
+        events().notifyDatasetDataChanged(correlationDataset);
     }
 
     std::map<QString, std::vector<unsigned int>> makeClustersFromList(std::vector<QString> list)
@@ -189,44 +381,46 @@ namespace
         return clusterData;
     }
 
-    void removeRowsWithAllDataMissing(DataFrame& df, MatrixData& matrix)
+    // Marker genes of the clusters the cells of the gene expression data are assigned to in the metadata, as a Text dataset
+    // with the top genes of every cluster
+    void addMarkerGeneDataset(Dataset<Points> parent, QString name, const GeneExpression& genes, const std::vector<QString>& clusterNames, const StageSettings& settings)
     {
-        int numRows = matrix.numRows;
+        Timer timer(name);
 
-        // Identify rows with all missing values
-        std::vector<int> badRowIndices;
-        for (int row = 0; row < numRows; row++)
-        {
-            bool badRow = true;
-            for (int col = 0; col < matrix.numCols; col++)
-            {
-                if (matrix.data[row * matrix.numCols + col] != MISSING_VALUE)
-                {
-                    badRow = false;
-                }
-            }
+        ClusterMarkers clusterMarkers;
+        FindMarkerGenes(genes, clusterNames, settings, clusterMarkers);
 
-            if (badRow)
+        std::vector<QString> clusterColumn, geneColumn, meanInColumn, meanOutColumn, fractionInColumn, fractionOutColumn, foldChangeColumn, pValueColumn, adjustedPValueColumn;
+        for (size_t c = 0; c < clusterMarkers.markers.size(); c++)
+        {
+            for (const MarkerGene& marker : clusterMarkers.markers[c])
             {
-                badRowIndices.push_back(row);
+                clusterColumn.push_back(clusterMarkers.clusters[c]);
+                geneColumn.push_back(genes.matrix.headers[marker.gene]);
+                meanInColumn.push_back(QString::number(marker.meanIn, 'g', 4));
+                meanOutColumn.push_back(QString::number(marker.meanOut, 'g', 4));
+                fractionInColumn.push_back(QString::number(marker.fractionIn, 'g', 4));
+                fractionOutColumn.push_back(QString::number(marker.fractionOut, 'g', 4));
+                foldChangeColumn.push_back(QString::number(marker.log2FoldChange, 'g', 4));
+                pValueColumn.push_back(QString::number(marker.pValue, 'g', 4));
+                adjustedPValueColumn.push_back(QString::number(marker.adjustedPValue, 'g', 4));
             }
         }
 
-        df.removeRows(badRowIndices);
-        matrix.removeRows(badRowIndices);
-    }
-
-    void removeDuplicateRows(DataFrame& df, QString columnToCheck, MatrixData& matrix)
-    {
-        std::vector<int> duplicateRows = df.findDuplicateRows(columnToCheck);
-        qDebug() << "Removing duplicate rows: " << duplicateRows.size();
-        for (int i = 0; i < duplicateRows.size(); i++)
-        {
-            qDebug() << df[columnToCheck][duplicateRows[i]];
-        }
-
-        df.removeRows(duplicateRows);
-        matrix.removeRows(duplicateRows);
+        Dataset<Text> markerDataset = mv::data().createDataset<Text>("Text", name, parent, "", false);
+        markerDataset->setProperty("PatchSeqType", "MarkerGenes");
+        markerDataset->addColumn("Cluster", clusterColumn);
+        markerDataset->addColumn("Gene", geneColumn);
+        markerDataset->addColumn("Mean In", meanInColumn);
+        markerDataset->addColumn("Mean Out", meanOutColumn);
+        markerDataset->addColumn("Fraction In", fractionInColumn);
+        markerDataset->addColumn("Fraction Out", fractionOutColumn);
+        markerDataset->addColumn("Log2 Fold Change", foldChangeColumn);
+        markerDataset->addColumn("P Value", pValueColumn);
+        markerDataset->addColumn("Adjusted P Value", adjustedPValueColumn);
+
+        events().notifyDatasetAdded(markerDataset);
+        events().notifyDatasetDataChanged(markerDataset);
     }
 
     QColor hexToQColor(const QString& hex)
@@ -248,6 +442,8 @@ namespace
 
     void addColorizedClusters(Dataset<Points> umapDataset, DataFrame& umapDf, QString columnName)
     {
+        TRACE_SCOPE("Cluster building", columnName);
+
         // Create a list of clusters and their indices from the list of cluster names
         Dataset<Clusters> clusterData = mv::data().createDataset<Clusters>("Cluster", columnName, umapDataset);
 
@@ -269,24 +465,20 @@ namespace
         mv::events().notifyDatasetDataDimensionsChanged(clusterData);
     }
 
-    void addColorizedClustersFromMetadata(Dataset<Text>& metadata, Dataset<Points>& umap, KeyBasedSelectionGroup& selectionGroup, QString columnName, QHash<QString, QColor> cellTypeColors = QHash<QString, QColor>())
+    // Clusters of the points by a metadata column, metadataRows maps every point to its metadata row
+    void addColorizedClustersFromMetadata(Dataset<Text>& metadata, Dataset<Points>& umap, const RowMap& metadataRows, QString columnName, QHash<QString, QColor> cellTypeColors = QHash<QString, QColor>())
     {
-        const BiMap& umapBiMap = selectionGroup.getBiMap(umap);
-        const BiMap& metadataBiMap = selectionGroup.getBiMap(metadata);
-
-        std::vector<uint32_t> allVals(umap->getNumPoints());
-        std::iota(allVals.begin(), allVals.end(), 0);
-        std::vector<QString> keys = umapBiMap.getKeysByValues(allVals);
-        std::vector<int> metaIndices = metadataBiMap.getValuesByKeysWithMissingValue(keys, -1);
+        TRACE_SCOPE("Cluster building", columnName);
 
         // Create a list of clusters and their indices from the list of cluster names
         Dataset<Clusters> clusterData = mv::data().createDataset<Clusters>("Cluster", columnName, umap);
 
         const std::vector<QString>& column = metadata->getColumn(columnName);
         std::vector<QString> clusterKeys;
-        for (int idx : metaIndices)
+        for (size_t i = 0; i < metadataRows.numSourceRows(); i++)
         {
-            clusterKeys.push_back(column[idx]);
+            uint32_t row = metadataRows.firstTargetRow(i);
+            clusterKeys.push_back(row != CellRegistry::INVALID_CELL ? column[row] : QString());
         }
 
         std::map<QString, std::vector<unsigned int>> clusterMap = makeClustersFromList(clusterKeys);
@@ -306,13 +498,22 @@ namespace
         Cluster::colorizeClusters(clusterData->getClusters(), 0);
 
         // Assign unassigned indices to unknown cluster
-        std::unordered_set<uint32_t> unassignedIndicesSet(allVals.begin(), allVals.end());
+        std::vector<bool> isAssigned(umap->getNumPoints(), false);
         for (const Cluster& cluster : clusterData->getClusters())
         {
-            for (const auto& value : cluster.getIndices()) {
-                unassignedIndicesSet.erase(value);
+            for (uint32_t index : cluster.getIndices())
+            {
+                if (index < isAssigned.size())
+                    isAssigned[index] = true;
             }
         }
+
+        std::vector<uint32_t> unassignedIndices;
+        for (uint32_t index = 0; index < isAssigned.size(); index++)
+        {
+            if (!isAssigned[index])
+                unassignedIndices.push_back(index);
+        }
         //if (columnName != "lobe")
         {
             Cluster cluster;
@@ -322,7 +523,6 @@ namespace
             else
                 cluster.setName("TemL (ref)");
 
-            std::vector<uint32_t> unassignedIndices(unassignedIndicesSet.begin(), unassignedIndicesSet.end());
             cluster.setIndices(unassignedIndices);
             cluster.setColor(hexToQColor("#DDDDDD"));
 
@@ -381,6 +581,63 @@ namespace
         mv::events().notifyDatasetDataChanged(clusterData);
         mv::events().notifyDatasetDataDimensionsChanged(clusterData);
     }
+
+    // The core loaders fill plain value types, which are converted to the types of the data plugins here
+
+    void ToEphysRecording(TraceRecording&& traceRecording, Recording& recording)
+    {
+        for (auto it = traceRecording.attributes.constBegin(); it != traceRecording.attributes.constEnd(); ++it)
+            recording.AddAttribute(it.key(), it.value());
+
+        recording.GetData().xSeries = std::move(traceRecording.data.xSeries);
+        recording.GetData().ySeries = std::move(traceRecording.data.ySeries);
+        recording.GetData().computeExtents();
+    }
+
+    // Adds the sweeps and action potential of a loaded NWB file to the experiment
+    void ToEphysExperiment(NWBExperiment&& nwbExperiment, Experiment& experiment)
+    {
+        for (NWBSweep& nwbSweep : nwbExperiment.sweeps)
+        {
+            Sweep sweep;
+            sweep.SetSweepNumber(nwbSweep.sweepNumber);
+            sweep.stimulus.SetStimulusDescription(nwbSweep.stimulusDescription);
+
+            ToEphysRecording(std::move(nwbSweep.stimulus), sweep.stimulus.GetRecording());
+            ToEphysRecording(std::move(nwbSweep.acquisition), sweep.acquisition);
+
+            sweep.stimulus.CalculateStimulusAmplitude();
+            sweep.stimulus.DetectStimulusType();
+
+            experiment.AddSweep(std::move(sweep));
+        }
+
+        if (nwbExperiment.actionPotential)
+        {
+            const ActionPotentialTrace& actionPotential = *nwbExperiment.actionPotential;
+            experiment.setActionPotential(new ActionPotential(actionPotential.time, actionPotential.voltage, actionPotential.stimulusOffset));
+        }
+    }
+
+    void ToCellMorphology(const SWCMorphology& swcMorphology, CellMorphology& cellMorphology)
+    {
+        for (int id : swcMorphology.ids)
+            cellMorphology.ids.push_back(id);
+        for (int type : swcMorphology.types)
+            cellMorphology.types.push_back(type);
+        for (const SWCMorphology::Position& position : swcMorphology.positions)
+            cellMorphology.positions.emplace_back(position.x, position.y, position.z);
+        for (float radius : swcMorphology.radii)
+            cellMorphology.radii.push_back(radius);
+        for (int parent : swcMorphology.parents)
+            cellMorphology.parents.push_back(parent);
+
+        for (const auto& [id, index] : swcMorphology.idMap)
+            cellMorphology.idMap[id] = index;
+
+        const SWCMorphology::Position& soma = swcMorphology.somaPosition;
+        cellMorphology.somaPosition.set(soma.x, soma.y, soma.z);
+    }
 }
 
 // =============================================================================
@@ -389,7 +646,9 @@ namespace
 
 PatchSeqDataLoader::~PatchSeqDataLoader(void)
 {
-
+    // The reader's results are dropped with the plugin
+    if (_ephysTraceReader.joinable())
+        _ephysTraceReader.join();
 }
 
 void PatchSeqDataLoader::init()
@@ -409,38 +668,11 @@ int extractLayerNumber(const QString& str)
 
 void PatchSeqDataLoader::addTaxonomyClustersForDf(DataFrame& df, DataFrame& metadata, TaxonomyLevel level, QString name, mv::Dataset<mv::DatasetImpl> parent, QString metaLabel)
 {
-    // Get the available cluster labels from the metadata df
-    const std::vector<QString>& treeCluster = metadata[metaLabel];
+    TRACE_SCOPE("Cluster building", metaLabel);
 
     Dataset<Clusters> treeClusterData = mv::data().createDataset<Clusters>("Cluster", properFeatureNames[metaLabel], parent);
 
-    //std::unordered_map<QString, std::vector<unsigned int>> clusterData;
-
-    const std::vector<QString>& metadataCellIds = metadata[CELL_ID_TAG];
-    const std::vector<QString>& dataCellIds = df[CELL_ID_TAG];
-    std::vector<QString> clusterNames(dataCellIds.size());
-
-    // FIXME Do this more efficiently
-    for (int i = 0; i < dataCellIds.size(); i++)
-    {
-        const QString& cellId = dataCellIds[i];
-
-        bool foundMatch = false;
-        for (int j = 0; j < metadataCellIds.size(); j++)
-        {
-            const QString& metaCellId = metadataCellIds[j];
-
-            if (cellId == metaCellId)
-            {
-                clusterNames[i] = treeCluster.at(j);
-                foundMatch = true;
-            }
-        }
-        if (!foundMatch)
-        {
-            clusterNames[i] = "Undefined";
-        }
-    }
+    std::vector<QString> clusterNames = LookupClusterNames(df, metadata, CELL_ID_TAG, metaLabel);
 
     // Create a list of clusters and their indices from the list of cluster names
     std::map<QString, std::vector<unsigned int>> clusterData = makeClustersFromList(clusterNames);
@@ -492,6 +724,8 @@ void PatchSeqDataLoader::addTaxonomyClustersForDf(DataFrame& df, DataFrame& meta
 
 void PatchSeqDataLoader::createClusterData(std::vector<QString> stringList, QString dataName, mv::Dataset<mv::DatasetImpl> parent)
 {
+    TRACE_SCOPE("Cluster building", dataName);
+
     Dataset<Clusters> clusterData = mv::data().createDataset<Points>("Cluster", dataName, parent);
 
     std::map<QString, std::vector<unsigned int>> clusterMap = makeClustersFromList(stringList);
@@ -518,6 +752,19 @@ void PatchSeqDataLoader::createClusterData(std::vector<QString> stringList, QStr
 }
 
 void PatchSeqDataLoader::loadData()
+{
+    // The core loaders don't depend on the plugin interface, report their failures the way ManiVault expects
+    try
+    {
+        loadDataSets();
+    }
+    catch (const LoadException& e)
+    {
+        throw DataLoadException(e.getFilePath(), e.getReason());
+    }
+}
+
+void PatchSeqDataLoader::loadDataSets()
 {
     Q_INIT_RESOURCE(met_loader_resources);
 
@@ -562,6 +809,11 @@ void PatchSeqDataLoader::loadData()
     //    return;
     //}
 
+    _settings = makeStageSettings();
+
+    // The trace of this load leaves out whatever was traced since the previous one
+    Tracing::clear();
+
     _task.setEnabled(true);
     _task.setRunning();
     QCoreApplication::processEvents();
@@ -584,6 +836,7 @@ void PatchSeqDataLoader::loadData()
     // Read metadata file
     _metadataDf.readFromFile(filePaths.metadataFilePath);
     _metadataDf.removeDuplicateRows(CELL_ID_TAG);
+    _metadataCells = _cellRegistry.registerCells(_metadataDf[CELL_ID_TAG]);
 
     // Gene expression data
     if (filePaths.hasGeneExpressions())
@@ -595,19 +848,20 @@ void PatchSeqDataLoader::loadData()
         loadGeneExpressionData(filePaths.gexprFilePath, _metadataDf);
         _task.setSubtaskFinished("Loading Transcriptomics");
 
-        BiMap gexprBiMap;
-        std::vector<uint32_t> gexprIndices(_geneExpressionData->getNumPoints());
-        std::iota(gexprIndices.begin(), gexprIndices.end(), 0);
-        gexprBiMap.addKeyValuePairs(_transcriptomicsDf[CELL_ID_TAG], gexprIndices);
-        qDebug() << "Gexpr: " << _transcriptomicsDf[CELL_ID_TAG].size() << gexprIndices.size();
+        _geneExpressionCells = _cellRegistry.registerCells(_geneExpression.df[CELL_ID_TAG]);
+        qDebug() << "Gexpr: " << _geneExpressionCells.size() << _geneExpressionData->getNumPoints();
+
+        linkDataset(_geneExpressionData, _geneExpressionCells);
 
-        _selectionGroup.addDataset(_geneExpressionData, gexprBiMap);
+        _gexprMetadata = DataFrame::subsetAndReorderByColumn(_metadataDf, _geneExpression.df, CELL_ID_TAG, CELL_ID_TAG);
 
-        //_gexprMetadata = DataFrame::subsetAndReorderByColumn(_metadataDf, _transcriptomicsDf, CELL_ID_TAG, CELL_ID_TAG);
+        // Add cluster meta data
+        addTaxonomyClustersForDf(_geneExpression.df, _gexprMetadata, TaxonomyLevel::GROUP, QFileInfo(filePaths.gexprFilePath).baseName(), _geneExpressionData, METADATA_CLUSTER_LABEL);
+        addTaxonomyClustersForDf(_geneExpression.df, _gexprMetadata, TaxonomyLevel::SUBCLASS, QFileInfo(filePaths.gexprFilePath).baseName(), _geneExpressionData, METADATA_SUBCLASS_LABEL);
 
-        //// Add cluster meta data
-        //addTaxonomyClustersForDf(_transcriptomicsDf, _gexprMetadata, _taxonomyDf, QFileInfo(filePaths.gexprFilePath).baseName(), _geneExpressionData, METADATA_CLUSTER_LABEL);
-        //addTaxonomyClustersForDf(_transcriptomicsDf, _gexprMetadata, _taxonomyDf, QFileInfo(filePaths.gexprFilePath).baseName(), _geneExpressionData, METADATA_SUBCLASS_LABEL);
+        // Marker genes of those clusters
+        addMarkerGeneDataset(_geneExpressionData, "Group Marker Genes", _geneExpression, LookupClusterNames(_geneExpression.df, _gexprMetadata, CELL_ID_TAG, METADATA_CLUSTER_LABEL), _settings);
+        addMarkerGeneDataset(_geneExpressionData, "Subclass Marker Genes", _geneExpression, LookupClusterNames(_geneExpression.df, _gexprMetadata, CELL_ID_TAG, METADATA_SUBCLASS_LABEL), _settings);
 #endif
     }
 
@@ -616,59 +870,70 @@ void PatchSeqDataLoader::loadData()
         qDebug() << "Load electrophysiology feature data..";
         // Read electrophysiology file
         loadEphysData(filePaths.ephysFilePath, _metadataDf);
-        qDebug() << "bee";
+        _ephysCells = _cellRegistry.registerCells(_ephysFeatures.df[CELL_ID_TAG]);
+
         // Subset and reorder the metadata
-        _ephysMetadata = DataFrame::subsetAndReorderByColumn(_metadataDf, _ephysDf, CELL_ID_TAG, CELL_ID_TAG);
-        qDebug() << "bee1";
+        _ephysMetadata = DataFrame::subsetAndReorderByColumn(_metadataDf, _ephysFeatures.df, CELL_ID_TAG, CELL_ID_TAG);
     }
 
     if (filePaths.hasMorphologyFeatures())
     {
-        qDebug() << "bee4";
         loadMorphologyData(filePaths.morphoFilePath, _metadataDf);
+        _morphoCells = _cellRegistry.registerCells(_morphoFeatures.df[CELL_ID_TAG]);
     }
 
+    // Relate the genes to the features of the other modalities
+    if (_geneExpression.matrix.numRows > 0)
+    {
+        if (_ephysFeatures.matrix.numRows > 0)
+            addCorrelationDataset(_geneExpressionData, "Gene-Ephys Correlation", _geneExpression, _ephysFeatures, _settings);
+        if (_morphoFeatures.matrix.numRows > 0)
+            addCorrelationDataset(_geneExpressionData, "Gene-Morphology Correlation", _geneExpression, _morphoFeatures, _settings);
+    }
+
+    // The datasets hold their own copies of the values, the matrices were only kept for the correlations and marker genes
+    _geneExpression = GeneExpression();
+    _ephysFeatures.matrix = MatrixData();
+    _morphoFeatures.matrix = MatrixData();
+
     _task.setFinished();
-    qDebug() << "bee5";
+
     //----------------------------------------------------------------------------------------------------------------------
     // Make a metadata text dataset and adds its columns, tries to assign a proper header name if possible 
     //----------------------------------------------------------------------------------------------------------------------
-    _metadata = mv::data().createDataset<Text>("Text", "Cell Metadata", mv::Dataset<DatasetImpl>(), "", false);
-    _metadata->setProperty("PatchSeqType", "Metadata");
-    qDebug() << "bee6";
-    for (int i = 0; i < _metadataDf.getHeaders().size(); i++)
     {
-        const QString& header = _metadataDf.getHeaders()[i];
+        TRACE_SCOPE("Metadata dataset");
+        MemoryStage memoryStage("Metadata dataset");
+        _metadata = mv::data().createDataset<Text>("Text", "Cell Metadata", mv::Dataset<DatasetImpl>(), "", false);
+        _metadata->setProperty("PatchSeqType", "Metadata");
 
-        // Get a proper name if possible
-        QString properHeaderName = header;
-        if (properFeatureNames.find(header) != properFeatureNames.end())
-            properHeaderName = properFeatureNames[header];
+        for (int i = 0; i < _metadataDf.getHeaders().size(); i++)
+        {
+            const QString& header = _metadataDf.getHeaders()[i];
 
-        std::vector<QString> column = _metadataDf[header];
-        _metadata->addColumn(properHeaderName, column);
+            // Get a proper name if possible
+            QString properHeaderName = header;
+            if (properFeatureNames.find(header) != properFeatureNames.end())
+                properHeaderName = properFeatureNames[header];
+
+            std::vector<QString> column = _metadataDf[header];
+            _metadata->addColumn(properHeaderName, column);
+        }
+        MemoryProfiler::recordContainer("Metadata data frame", _metadataDf);
     }
-    qDebug() << "bee7";
+
     //----------------------------------------------------------------------------------------------------------------------
     // Link up all the datasets
     //----------------------------------------------------------------------------------------------------------------------
-    // Take columns from ephys and morpho data and order them correctly, filling in missing data
-    BiMap metadataBiMap;
-    std::vector<uint32_t> metaCellIdIndices(_metadataDf.numRows());
-    std::iota(metaCellIdIndices.begin(), metaCellIdIndices.end(), 0);
-    metadataBiMap.addKeyValuePairs(_metadataDf[CELL_ID_TAG], metaCellIdIndices);
-
-    qDebug() << "bee8";
-    std::vector<QString> ephysCellIdColumn = _ephysMetadata[CELL_ID_TAG];
-    std::vector<uint32_t> ephysToMetaIndices = metadataBiMap.getValuesByKeys(ephysCellIdColumn);
-
-    std::vector<QString> morphoCellIdColumn = _morphoMetadata[CELL_ID_TAG];
-    std::vector<uint32_t> morphoToMetaIndices = metadataBiMap.getValuesByKeys(morphoCellIdColumn);
-    qDebug() << "bee9";
     // Add ephys and morpho data to metadata dataset
-    addPointsToTextDataset(_ephysData, _metadata, ephysToMetaIndices); qDebug() << "bee10";
-    addPointsToTextDataset(_morphoData, _metadata, morphoToMetaIndices);
-    qDebug() << "bee11";
+#if NUMERIC_METADATA_AS_TEXT
+    // Take columns from ephys and morpho data and order them correctly, filling in missing data
+    addPointsToTextDataset(_ephysData, _metadata, _cellRegistry.mapRows(_ephysCells, _metadataCells));
+    addPointsToTextDataset(_morphoData, _metadata, _cellRegistry.mapRows(_morphoCells, _metadataCells));
+#else
+    addMetadataFeatureReferences(_metadata, { _ephysData, _morphoData }, { _cellRegistry.mapRows(_metadataCells, _ephysCells), _cellRegistry.mapRows(_metadataCells, _morphoCells) });
+#endif
+
     events().notifyDatasetAdded(_metadata);
     events().notifyDatasetDataDimensionsChanged(_metadata);
 
@@ -679,14 +944,14 @@ void PatchSeqDataLoader::loadData()
     
     qDebug() << ">>>>>>>>>>>>>> Loading ephys cells";
 
-    //if (filePaths.hasEphysTraces())
-    //    loadEphysTraces(ephysTracesDir);
-    //else
-    //    qDebug() << "No ephys traces directory set, skipping loading..";
+    if (filePaths.hasEphysTraces())
+        loadEphysTraces(ephysTracesDir);
+    else
+        qDebug() << "No ephys traces directory set, skipping loading..";
 
     qDebug() << ">>>>>>>>>>>>>> Making selection group";
     // Make selection group
-    _selectionGroup.addDataset(_metadata, metadataBiMap);
+    linkDataset(_metadata, _metadataCells);
 
     if (filePaths.hasGeneExpressions())
     {
@@ -694,8 +959,8 @@ void PatchSeqDataLoader::loadData()
         //BiMap gexprBiMap;
         //std::vector<uint32_t> gexprIndices(_geneExpressionData->getNumPoints());
         //std::iota(gexprIndices.begin(), gexprIndices.end(), 0);
-        //gexprBiMap.addKeyValuePairs(_transcriptomicsDf[CELL_ID_TAG], gexprIndices);
-        //qDebug() << "Gexpr: " << _transcriptomicsDf[CELL_ID_TAG].size() << gexprIndices.size();
+        //gexprBiMap.addKeyValuePairs(_geneExpression.df[CELL_ID_TAG], gexprIndices);
+        //qDebug() << "Gexpr: " << _geneExpression.df[CELL_ID_TAG].size() << gexprIndices.size();
 
         //_selectionGroup.addDataset(_geneExpressionData, gexprBiMap);
     }
@@ -703,83 +968,58 @@ void PatchSeqDataLoader::loadData()
     if (filePaths.hasEphysFeatures())
     {
         // Ephys data
-        BiMap ephysBiMap;
-        std::vector<uint32_t> ephysIndices(_ephysData->getNumPoints());
-        std::iota(ephysIndices.begin(), ephysIndices.end(), 0);
         _ephysMetadata.removeDuplicateRows(CELL_ID_TAG);
-        ephysBiMap.addKeyValuePairs(_ephysDf[CELL_ID_TAG], ephysIndices);
-        qDebug() << "Ephys: " << _ephysMetadata[CELL_ID_TAG].size() << ephysIndices.size();
+        qDebug() << "Ephys: " << _ephysMetadata[CELL_ID_TAG].size() << _ephysCells.size();
 
         // Ephys UMAP
         if (filePaths.hasEphysUMap())
-            loadUMap(filePaths.ephysUMapFilePath, _ephysData, "Ephys UMAP", ephysBiMap);
+            loadUMap(filePaths.ephysUMapFilePath, _ephysData, "Ephys UMAP");
 
-        _selectionGroup.addDataset(_ephysData, ephysBiMap);
+        linkDataset(_ephysData, _ephysCells);
 
         // Add cluster meta data
-        addTaxonomyClustersForDf(_ephysDf, _ephysMetadata, TaxonomyLevel::GROUP, QFileInfo(filePaths.ephysFilePath).baseName(), _ephysData, METADATA_CLUSTER_LABEL); qDebug() << "bee2";
-        addTaxonomyClustersForDf(_ephysDf, _ephysMetadata, TaxonomyLevel::SUBCLASS, QFileInfo(filePaths.ephysFilePath).baseName(), _ephysData, METADATA_SUBCLASS_LABEL); qDebug() << "bee3";
+        addTaxonomyClustersForDf(_ephysFeatures.df, _ephysMetadata, TaxonomyLevel::GROUP, QFileInfo(filePaths.ephysFilePath).baseName(), _ephysData, METADATA_CLUSTER_LABEL);
+        addTaxonomyClustersForDf(_ephysFeatures.df, _ephysMetadata, TaxonomyLevel::SUBCLASS, QFileInfo(filePaths.ephysFilePath).baseName(), _ephysData, METADATA_SUBCLASS_LABEL);
 #ifdef DALLEYLEE
-        addColorizedClustersFromMetadata(_metadata, _ephysData, _selectionGroup, "paradigm");
-        addColorizedClustersFromMetadata(_metadata, _ephysData, _selectionGroup, "lobe");
+        RowMap metadataRows = _cellRegistry.mapRows(_ephysCells, _metadataCells);
+        addColorizedClustersFromMetadata(_metadata, _ephysData, metadataRows, "paradigm");
+        addColorizedClustersFromMetadata(_metadata, _ephysData, metadataRows, "lobe");
 #endif
     }
 
     if (filePaths.hasMorphologyFeatures())
     {
         // Morphology data
-        BiMap morphBiMap;
-        std::vector<uint32_t> morphoIndices(_morphoData->getNumPoints());
-        std::iota(morphoIndices.begin(), morphoIndices.end(), 0);
-        morphBiMap.addKeyValuePairs(_morphologyDf[CELL_ID_TAG], morphoIndices);
-        qDebug() << "Morph: " << _morphoMetadata[CELL_ID_TAG].size() << morphoIndices.size();
+        qDebug() << "Morph: " << _morphoMetadata[CELL_ID_TAG].size() << _morphoCells.size();
 
         // Morphology UMAP
         if (filePaths.hasMorphoUMap())
         {
-            loadUMap(filePaths.morphoUMapFilePath, _morphoData, "Morpho UMAP", morphBiMap);
+            loadUMap(filePaths.morphoUMapFilePath, _morphoData, "Morpho UMAP");
         }
 
-        _selectionGroup.addDataset(_morphoData, morphBiMap);
+        linkDataset(_morphoData, _morphoCells);
 
         // Add cluster meta data
-        addTaxonomyClustersForDf(_morphologyDf, _morphoMetadata, TaxonomyLevel::GROUP, QFileInfo(filePaths.morphoFilePath).baseName(), _morphoData, METADATA_CLUSTER_LABEL);
-        addTaxonomyClustersForDf(_morphologyDf, _morphoMetadata, TaxonomyLevel::SUBCLASS, QFileInfo(filePaths.morphoFilePath).baseName(), _morphoData, METADATA_SUBCLASS_LABEL);
+        addTaxonomyClustersForDf(_morphoFeatures.df, _morphoMetadata, TaxonomyLevel::GROUP, QFileInfo(filePaths.morphoFilePath).baseName(), _morphoData, METADATA_CLUSTER_LABEL);
+        addTaxonomyClustersForDf(_morphoFeatures.df, _morphoMetadata, TaxonomyLevel::SUBCLASS, QFileInfo(filePaths.morphoFilePath).baseName(), _morphoData, METADATA_SUBCLASS_LABEL);
 #ifdef DALLEYLEE
-        addColorizedClustersFromMetadata(_metadata, _morphoData, _selectionGroup, "paradigm");
-        addColorizedClustersFromMetadata(_metadata, _morphoData, _selectionGroup, "lobe");
+        RowMap metadataRows = _cellRegistry.mapRows(_morphoCells, _metadataCells);
+        addColorizedClustersFromMetadata(_metadata, _morphoData, metadataRows, "paradigm");
+        addColorizedClustersFromMetadata(_metadata, _morphoData, metadataRows, "lobe");
 #endif
     }
 
     if (filePaths.hasEphysTraces())
     {
         // Ephys traces mapping
-        BiMap ephysTraceBiMap;
-        std::vector<uint32_t> ephysTraceIndices(_ephysTraceCellIds.size());
-        std::iota(ephysTraceIndices.begin(), ephysTraceIndices.end(), 0);
-        ephysTraceBiMap.addKeyValuePairs(_ephysTraceCellIds, ephysTraceIndices);
-
-        _selectionGroup.addDataset(_ephysTraces, ephysTraceBiMap);
+        linkDataset(_ephysTraces, _cellRegistry.registerCells(_ephysTraceCellIds));
     }
 
-    // Cell ID data
-    BiMap cellIdBiMap;
-    std::vector<uint32_t> cellIdIndices(_metadata->getNumRows());
-    std::iota(cellIdIndices.begin(), cellIdIndices.end(), 0);
-    cellIdBiMap.addKeyValuePairs(_metadataDf[CELL_ID_TAG], cellIdIndices);
-    qDebug() << "Metadata: " << _metadataDf[CELL_ID_TAG].size() << cellIdIndices.size();
+    qDebug() << "Metadata: " << _metadataCells.size() << _metadata->getNumRows();
 
     // Morphology mapping
-    BiMap cellMorphologyBiMap;
-    std::vector<uint32_t> cmIndices(_cellMorphoData->getData().size());
-    std::iota(cmIndices.begin(), cmIndices.end(), 0);
-    QStringList cmCellIds = _cellMorphoData->getCellIdentifiers();
-    std::vector<QString> cmCellIdVector(cmCellIds.size());
-    for (int i = 0; i < cmCellIdVector.size(); i++)
-    {
-        cmCellIdVector[i] = cmCellIds[i];
-    }
-    cellMorphologyBiMap.addKeyValuePairs(cmCellIdVector, cmIndices);
+    std::vector<uint32_t> cellMorphologyCells = _cellRegistry.registerCells(_cellMorphoData->getCellIdentifiers());
 
     // ME UMAP
     if (filePaths.hasMEUMap())
@@ -791,25 +1031,22 @@ void PatchSeqDataLoader::loadData()
 
         // Create dataset
         Dataset<Points> umapDataset = mv::data().createDataset("Points", "MorphoElectric UMAP", mv::Dataset<DatasetImpl>(), "", false);
-        umapDataset->setData(umapData.data, umapData.numCols);
+        umapDataset->setData(umapData.data.data(), umapData.numRows, umapData.numCols);
         umapDataset->setDimensionNames(umapData.headers);
 
         events().notifyDatasetAdded(umapDataset);
         events().notifyDatasetDataChanged(umapDataset);
 
-        // UMAP BiMap
-        BiMap umapBiMap;
-        std::vector<uint32_t> indices(umapDf[CELL_ID_TAG].size());
-        std::iota(indices.begin(), indices.end(), 0);
-        umapBiMap.addKeyValuePairs(umapDf[CELL_ID_TAG], indices);
-
-        _selectionGroup.addDataset(umapDataset, umapBiMap);
+        // Link the selection
+        std::vector<uint32_t> umapCells = _cellRegistry.registerCells(umapDf[CELL_ID_TAG]);
+        linkDataset(umapDataset, umapCells);
 
 #ifdef DALLEYLEE
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "Supertype", _cellTypeColors);
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "Subclass", _cellTypeColors);
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "paradigm");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "lobe");
+        RowMap metadataRows = _cellRegistry.mapRows(umapCells, _metadataCells);
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "Supertype", _cellTypeColors);
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "Subclass", _cellTypeColors);
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "paradigm");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "lobe");
 #endif
     }
 
@@ -842,26 +1079,15 @@ void PatchSeqDataLoader::loadData()
         
         // Create dataset
         Dataset<Points> umapDataset = mv::data().createDataset("Points", "Tx UMAP", mv::Dataset<DatasetImpl>(), "", false);
-        umapDataset->setData(umapData.data, umapData.numCols);
+        umapDataset->setData(umapData.data.data(), umapData.numRows, umapData.numCols);
         umapDataset->setDimensionNames(umapData.headers);
 
         events().notifyDatasetAdded(umapDataset);
         events().notifyDatasetDataChanged(umapDataset);
 
         // Transcriptomics UMAP BiMap
-        BiMap txUmapBiMap;
-        std::vector<uint32_t> indices(umapDf[CELL_ID_TAG].size());
-        std::iota(indices.begin(), indices.end(), 0);
-        const std::vector<QString>& keys = umapDf[CELL_ID_TAG];
-        for (int i = 0; i < keys.size(); i++)
-        {
-            if (keys[i].isNull() || keys[i].isEmpty())
-                indices[i] = -1;
-        }
-
-        txUmapBiMap.addKeyValuePairs(keys, indices);
-
-        _selectionGroup.addDataset(umapDataset, txUmapBiMap);
+        std::vector<uint32_t> umapCells = _cellRegistry.registerCells(umapDf[CELL_ID_TAG]);
+        linkDataset(umapDataset, umapCells);
 
 #ifdef DALLEYDEE
         // Annotation metadata
@@ -924,40 +1150,34 @@ void PatchSeqDataLoader::loadData()
         }
 
 #ifdef DALLEYLEE
-        //addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "Supertype", _cellTypeColors);
-        //addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "Subclass", _cellTypeColors);
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "paradigm");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "days_in_culture");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "patched_cell_container");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "donor_name");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "medical_conditions");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "lobe");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "age_label(yrs)");
-        addColorizedClustersFromMetadata(_metadata, umapDataset, _selectionGroup, "sex");
+        RowMap metadataRows = _cellRegistry.mapRows(umapCells, _metadataCells);
+        //addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "Supertype", _cellTypeColors);
+        //addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "Subclass", _cellTypeColors);
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "paradigm");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "days_in_culture");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "patched_cell_container");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "donor_name");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "medical_conditions");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "lobe");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "age_label(yrs)");
+        addColorizedClustersFromMetadata(_metadata, umapDataset, metadataRows, "sex");
 #endif
 #endif
     }
 
     // Set cell morphology colors
     {
-        // Get std::vector of cell ids of morphologies
-        QStringList ids = _cellMorphoData->getCellIdentifiers();
-        std::vector<QString> cellIds(ids.size());
-        for (int i = 0; i < ids.size(); i++)
-        {
-            cellIds[i] = ids[i];
-        }
-
-        // Map these cell ids to metadata indices
-        std::vector<int> indices = cellIdBiMap.getValuesByKeysWithMissingValue(cellIds, -1);
+        // Map the cell morphologies to metadata rows
+        RowMap indices = _cellRegistry.mapRows(cellMorphologyCells, _metadataCells);
 
         std::vector<QString> clusterLabels = _metadataDf[METADATA_CLUSTER_LABEL];
 
-        for (int i = 0; i < indices.size(); i++)
+        for (int i = 0; i < indices.numSourceRows(); i++)
         {
-            if (indices[i] == -1) continue;
+            uint32_t metadataRow = indices.firstTargetRow(i);
+            if (metadataRow == CellRegistry::INVALID_CELL) continue;
 
-            QString label = clusterLabels[indices[i]];
+            QString label = clusterLabels[metadataRow];
 
 #if defined(DALLEYLEE) || defined(WALEBOER)
             QColor color = _cellTypeColors[label];
@@ -969,56 +1189,81 @@ void PatchSeqDataLoader::loadData()
         }
     }
 
-    _selectionGroup.addDataset(_metadata, cellIdBiMap);
-    _selectionGroup.addDataset(_cellMorphoData, cellMorphologyBiMap);
+    linkDataset(_cellMorphoData, cellMorphologyCells);
 
+    // Only one of the two propagates selections, both would notify every brush twice
+#if INDEX_SELECTION_LINKING
+    _selectionLinker.link(_cellRegistry);
+#else
     events().addSelectionGroup(_selectionGroup);
+#endif
+
+    // The cell IDs and clusters of the rows are registered with the datasets by now
+    _ephysFeatures = FeatureData();
+    _morphoFeatures = FeatureData();
+    _gexprMetadata = DataFrame();
+    _ephysMetadata = DataFrame();
+    _morphoMetadata = DataFrame();
+
+    Tracing::write();
+    MemoryProfiler::report();
+}
+
+void PatchSeqDataLoader::linkDataset(mv::Dataset<mv::DatasetImpl> dataset, const std::vector<uint32_t>& rowCells)
+{
+    TRACE_SCOPE("Link dataset");
+
+#if INDEX_SELECTION_LINKING
+    _selectionLinker.addDataset(dataset, rowCells);
+#else
+    BiMap biMap = makeBiMap(_cellRegistry, rowCells);
+    _selectionGroup.addDataset(dataset, biMap);
+#endif
 }
 
 void PatchSeqDataLoader::loadGeneExpressionData(QString filePath, const DataFrame& metadata)
 {
     qDebug() << "Loading transcriptomic data..";
 
-    MatrixData matrixData;
-    MatrixDataLoader matrixDataLoader;
-    matrixDataLoader.LoadMatrixData(filePath, _transcriptomicsDf, matrixData, 1);
-    //matrixData.standardize();
+    LoadGeneExpression(filePath, _settings, _geneExpression);
+    _geneExpression.df.printFirstFewDimensionsOfDataFrame();
 
-    removeDuplicateRows(_transcriptomicsDf, CELL_ID_TAG, matrixData);
+    const MatrixData& matrixData = _geneExpression.matrix;
 
-    _transcriptomicsDf.printFirstFewDimensionsOfDataFrame();
+    {
+        TRACE_SCOPE("Gene expression dataset");
+        _geneExpressionData = mv::data().createDataset<Points>("Points", QFileInfo(filePath).baseName(), mv::Dataset<DatasetImpl>(), "", false);
+        _geneExpressionData->setProperty("PatchSeqType", "T");
+        _geneExpressionData->setProperty("AllGeneNames", _geneExpression.allGeneNames);
+        _geneExpressionData->setData(matrixData.data.data(), matrixData.numRows, matrixData.numCols);
+        _geneExpressionData->setDimensionNames(matrixData.headers);
+
+        events().notifyDatasetAdded(_geneExpressionData);
+        events().notifyDatasetDataChanged(_geneExpressionData);
+        events().notifyDatasetDataDimensionsChanged(_geneExpressionData);
+    }
 
-    _geneExpressionData = mv::data().createDataset<Points>("Points", QFileInfo(filePath).baseName(), mv::Dataset<DatasetImpl>(), "", false);
-    _geneExpressionData->setProperty("PatchSeqType", "T");
-    _geneExpressionData->setData(matrixData.data, matrixData.numCols);
-    _geneExpressionData->setDimensionNames(matrixData.headers);
+    Embedding embedding;
+    EmbedGeneExpression(matrixData, _settings, embedding);
 
-    events().notifyDatasetAdded(_geneExpressionData);
-    events().notifyDatasetDataChanged(_geneExpressionData);
-    events().notifyDatasetDataDimensionsChanged(_geneExpressionData);
+    TRACE_SCOPE("Gene expression embedding datasets");
+    addNeighborQueries(addEmbeddingDatasets(_geneExpressionData, embedding, _settings), embedding);
 }
 
 void PatchSeqDataLoader::loadEphysData(QString filePath, const DataFrame& metadata)
 {
     qDebug() << "Loading electrophysiology data..";
 
-    MatrixData matrixData;
-    MatrixDataLoader matrixDataLoader(true);
-    matrixDataLoader.LoadMatrixData(filePath, _ephysDf, matrixData, 2);
+    LoadEphysFeatures(filePath, metadata, featuresToDelete, _settings, _ephysFeatures);
+    _ephysFeatures.df.printFirstFewDimensionsOfDataFrame();
 
-    removeDuplicateRows(_ephysDf, CELL_ID_TAG, matrixData);
-    removeRowsNotInMetadata(_ephysDf, CELL_ID_TAG, _metadataDf, matrixData);
-    removeFeatures(matrixData, featuresToDelete);
-    //removeRowsWithAllDataMissing(_ephysDf, matrixData);
-    matrixData.imputeMissingValues();
-    //matrixData.standardize();
+    MatrixData& matrixData = _ephysFeatures.matrix;
 
-    _ephysDf.printFirstFewDimensionsOfDataFrame();
     qDebug() << "PreCreate";
     _ephysData = mv::data().createDataset<Points>("Points", "Ephys Feature Data", mv::Dataset<DatasetImpl>(), "", false); //QFileInfo(filePath).baseName()
     qDebug() << "PostCreate";
     _ephysData->setProperty("PatchSeqType", "E");
-    _ephysData->setData(matrixData.data, matrixData.numCols);
+    _ephysData->setData(matrixData.data.data(), matrixData.numRows, matrixData.numCols);
 
     // Replace feature names with proper names
     for (int i = 0; i < matrixData.headers.size(); i++)
@@ -1035,6 +1280,10 @@ void PatchSeqDataLoader::loadEphysData(QString filePath, const DataFrame& metada
     events().notifyDatasetAdded(_ephysData);
     events().notifyDatasetDataChanged(_ephysData);
     events().notifyDatasetDataDimensionsChanged(_ephysData);
+
+    Embedding embedding;
+    EmbedFeatures(matrixData, _settings, embedding);
+    addNeighborQueries(addEmbeddingDatasets(_ephysData, embedding, _settings), embedding);
     qDebug() << "PostAdd";
 }
 
@@ -1042,24 +1291,13 @@ void PatchSeqDataLoader::loadMorphologyData(QString filePath, const DataFrame& m
 {
     qDebug() << "Loading morphology data..";
 
-    MatrixData matrixData;
-    MatrixDataLoader matrixDataLoader(true);
-    matrixDataLoader.LoadMatrixData(filePath, _morphologyDf, matrixData, 1);
-
-    // Find 
-    std::vector<int> badRows;
-    //badRows.push_back(_morphologyDf.findRowWithColumnValue("cell_id", "770268110"));
+    LoadMorphologyFeatures(filePath, _settings, _morphoFeatures);
 
-    _morphologyDf.removeRows(badRows);
-    matrixData.removeRows(badRows);
-
-    removeDuplicateRows(_morphologyDf, CELL_ID_TAG, matrixData);
-    matrixData.fillMissingValues(0);
-    //matrixData.standardize();
+    MatrixData& matrixData = _morphoFeatures.matrix;
 
     _morphoData = mv::data().createDataset<Points>("Points", "Morphology Feature Data", mv::Dataset<DatasetImpl>(), "", false); //QFileInfo(filePath).baseName()
     _morphoData->setProperty("PatchSeqType", "M");
-    _morphoData->setData(matrixData.data, matrixData.numCols);
+    _morphoData->setData(matrixData.data.data(), matrixData.numRows, matrixData.numCols);
 
     // Replace feature names with proper names
     for (int i = 0; i < matrixData.headers.size(); i++)
@@ -1076,8 +1314,13 @@ void PatchSeqDataLoader::loadMorphologyData(QString filePath, const DataFrame& m
     events().notifyDatasetDataChanged(_morphoData);
     events().notifyDatasetDataDimensionsChanged(_morphoData);
 
+    Embedding embedding;
+    EmbedFeatures(matrixData, _settings, embedding);
+    addNeighborQueries(addEmbeddingDatasets(_morphoData, embedding, _settings), embedding);
+
     // Subset and reorder the metadata
-    _morphoMetadata = DataFrame::subsetAndReorderByColumn(metadata, _morphologyDf, CELL_ID_TAG, CELL_ID_TAG);
+    _morphoMetadata = DataFrame::subsetAndReorderByColumn(metadata, _morphoFeatures.df, CELL_ID_TAG, CELL_ID_TAG);
+    MemoryProfiler::recordContainer("Morphology metadata copy", _morphoMetadata);
 
     qDebug() << "Successfully loaded" << _morphoData->getNumPoints() << "cell morphologies";
 }
@@ -1085,6 +1328,8 @@ void PatchSeqDataLoader::loadMorphologyData(QString filePath, const DataFrame& m
 void PatchSeqDataLoader::loadMorphologyCells(QDir dir)
 {
     Timer timer("SWC Morphology Loading");
+    TRACE_SCOPE("SWC morphologies", dir.path());
+    MemoryStage memoryStage("SWC morphologies");
 
     // Load morphology cells
     _cellMorphoData = mv::data().createDataset<CellMorphologies>("Cell Morphology Data", "Cell Morphologies", mv::Dataset<DatasetImpl>(), "", false);
@@ -1106,7 +1351,9 @@ void PatchSeqDataLoader::loadMorphologyCells(QDir dir)
         QString swcFile = swcFiles[i];
         CellMorphology& cellMorphology = cellMorphologies[i];
 
-        loader.LoadSWC(morphologyDir.filePath(swcFile), cellMorphology);
+        SWCMorphology swcMorphology;
+        loader.LoadSWC(morphologyDir.filePath(swcFile), swcMorphology);
+        ToCellMorphology(swcMorphology, cellMorphology);
 
         cellMorphology.findCentroid();
         cellMorphology.findExtents();
@@ -1125,6 +1372,9 @@ void PatchSeqDataLoader::loadMorphologyCells(QDir dir)
 
 void PatchSeqDataLoader::loadEphysTraces(QDir dir)
 {
+    TRACE_SCOPE("NWB traces", dir.path());
+    MemoryStage memoryStage("NWB traces");
+
     // Create ephys dataset
     _ephysTraces = mv::data().createDataset<EphysExperiments>("Electrophysiology Data", "Ephys Traces", mv::Dataset<DatasetImpl>(), "", false);
     _ephysTraces->setProperty("PatchSeqType", "EphysTraces");
@@ -1144,19 +1394,27 @@ void PatchSeqDataLoader::loadEphysTraces(QDir dir)
 
     qDebug() << "Found" << nwbFiles.size() << "NWB files, attempting to load them..";
 
-    // Load NWB files and add them to dataset
+    QStringList nwbFilePaths;
+    for (const QString& fileName : nwbFiles)
+        nwbFilePaths.append(ephysTracesDir.filePath(fileName));
+
+    // Load NWB files in parallel
     LoadInfo loadInfo;
     loadInfo.failedSweepPath = FAILED_SWEEP_PATH;
     NWBLoader loader;
+#if LAZY_EPHYS_TRACES
+    _ephysTraceSession = std::make_unique<NWBLoadSession>(loadInfo.failedSweepPath);
+    std::vector<NWBFileIndex> indices;
+    loader.IndexNWBFiles(*_ephysTraceSession, nwbFilePaths, indices, loadInfo, std::min<unsigned int>(numWorkerThreads(), NUM_NWB_LOADER_THREADS));
+#else
+    std::vector<NWBExperiment> experiments;
+    loader.LoadNWBFiles(nwbFilePaths, experiments, loadInfo, std::min<unsigned int>(numWorkerThreads(), NUM_NWB_LOADER_THREADS));
+#endif
+
+    // Add them to the dataset in file order, so the experiment order doesn't depend on the thread timing
     for (int i = 0; i < nwbFiles.size(); i++)
     {
-        Experiment experiment;
-
         QString fileName = nwbFiles[i];
-        
-        qDebug() << "Loading NWB file: " << ephysTracesDir.filePath(fileName);
-
-        loader.LoadNWB(ephysTracesDir.filePath(fileName), experiment, loadInfo);
 
         QString specimenName = fileName;
         specimenName.chop(4); // Cut off the .nwb part
@@ -1166,9 +1424,36 @@ void PatchSeqDataLoader::loadEphysTraces(QDir dir)
 
         _ephysTraceCellIds.push_back(specimenNameToCellId[specimenName]);
         qDebug() << "Cell ID: " << _ephysTraceCellIds[_ephysTraceCellIds.size()-1];
+#if LAZY_EPHYS_TRACES
+        // Without sweeps until the cell is selected
+        _ephysTraces->addExperiment(Experiment());
+        _ephysTraceIndices.push_back(std::move(indices[i]));
+#else
+        Experiment experiment;
+        ToEphysExperiment(std::move(experiments[i]), experiment);
         _ephysTraces->addExperiment(std::move(experiment));
+#endif
     }
 
+#if LAZY_EPHYS_TRACES
+    _ephysTraceReadStates.assign(_ephysTraceIndices.size(), TraceReadState::UNREAD);
+    _ephysTracePyramids.setMaxCost(TRACE_PYRAMID_CACHE_BYTES);
+
+    // The viewer zooms into the sweeps through queryEphysTrace, which it finds on the dataset
+    _ephysTraces->setProperty("TraceQueryProvider", QVariant::fromValue(static_cast<QObject*>(this)));
+
+    _ephysTraceReadTimer.setSingleShot(true);
+    _ephysTraceReadTimer.setInterval(EPHYS_TRACE_READ_DELAY_MS);
+    connect(&_ephysTraceReadTimer, &QTimer::timeout, this, &PatchSeqDataLoader::readSelectedEphysTraces);
+
+    _eventListener.addSupportedEventType(static_cast<std::uint32_t>(mv::EventType::DatasetDataSelectionChanged));
+    _eventListener.registerDataEvent([this](mv::DatasetEvent* dataEvent)
+    {
+        if (dataEvent->getType() == mv::EventType::DatasetDataSelectionChanged && dataEvent->getDataset()->getId() == _ephysTraces->getId())
+            _ephysTraceReadTimer.start();
+    });
+#endif
+
     qDebug() << "Ignored stimsets: " << loadInfo.ignoredStimsets;
     qDebug() << "Loaded stimsets: " << loadInfo.loadedStimsets;
 
@@ -1176,8 +1461,187 @@ void PatchSeqDataLoader::loadEphysTraces(QDir dir)
     events().notifyDatasetDataChanged(_ephysTraces);
 }
 
-void PatchSeqDataLoader::loadUMap(QString filePath, mv::Dataset<Points> parent, QString datasetName, BiMap& bimap)
+void PatchSeqDataLoader::readSelectedEphysTraces()
 {
+    if (_ephysTraceReader.joinable())
+    {
+        _ephysTraceReadPending = true;
+        return;
+    }
+
+    // Evicted rows first as the viewer is waiting on them, then in the order of the selection, which is the order the
+    // viewer shows the cells in. Rows are marked as reading when they are queued, so a row is never queued twice.
+    std::vector<uint32_t> rows;
+    auto queueRow = [this, &rows](uint32_t row)
+    {
+        if (row < _ephysTraceReadStates.size() && _ephysTraceReadStates[row] == TraceReadState::UNREAD && rows.size() < MAX_TRACES_READ_PER_SELECTION)
+        {
+            _ephysTraceReadStates[row] = TraceReadState::READING;
+            rows.push_back(row);
+        }
+    };
+
+    for (uint32_t row : _ephysTraceRereadRows)
+        queueRow(row);
+    _ephysTraceRereadRows.clear();
+
+    for (uint32_t row : _ephysTraces->getSelectionIndices())
+    {
+        if (rows.size() == MAX_TRACES_READ_PER_SELECTION)
+            break;
+        queueRow(row);
+    }
+
+    if (rows.empty())
+        return;
+
+    _ephysTraceReader = std::thread([this, rows]()
+    {
+        TRACE_SCOPE("Read NWB traces");
+
+        auto succeeded = std::make_shared<std::vector<char>>(rows.size(), 0);
+        auto experiments = std::make_shared<std::vector<Experiment>>(rows.size());
+        auto pyramids = std::make_shared<std::vector<SweepPyramid>>();
+        std::mutex pyramidMutex;
+
+        NWBLoader loader;
+        parallelForDynamic(rows.size(), std::min<unsigned int>(numWorkerThreads(), NUM_NWB_LOADER_THREADS), [&](size_t i)
+        {
+            const NWBFileIndex& index = _ephysTraceIndices[rows[i]];
+
+            // A file that can't be read leaves its cell without sweeps, the other cells are still shown
+            try
+            {
+                NWBExperiment experiment;
+                loader.MaterializeNWB(*_ephysTraceSession, index, experiment, true);
+
+                {
+                    std::lock_guard<std::mutex> lock(pyramidMutex);
+                    for (const NWBSweep& sweep : experiment.sweeps)
+                    {
+                        if (sweep.acquisitionPyramid)
+                            pyramids->push_back({ QPair<uint32_t, int>(rows[i], sweep.sweepNumber), sweep.acquisitionPyramid });
+                    }
+                }
+
+                ToEphysExperiment(std::move(experiment), (*experiments)[i]);
+                (*succeeded)[i] = 1;
+            }
+            catch (const std::exception& e)
+            {
+                qWarning() << "Failed to read the traces of" << index.filePath << ":" << e.what();
+            }
+            catch (...)
+            {
+                qWarning() << "Failed to read the traces of" << index.filePath;
+            }
+        });
+
+        // The dataset is only changed on the GUI thread
+        QMetaObject::invokeMethod(this, [this, rows, succeeded, experiments, pyramids]()
+        {
+            finishEphysTraceRead(rows, std::move(*succeeded), std::move(*experiments), std::move(*pyramids));
+        }, Qt::QueuedConnection);
+    });
+}
+
+void PatchSeqDataLoader::finishEphysTraceRead(const std::vector<uint32_t>& rows, std::vector<char>&& succeeded, std::vector<Experiment>&& experiments, std::vector<SweepPyramid>&& pyramids)
+{
+    // The reader has nothing left to do but return
+    _ephysTraceReader.join();
+
+    // A row that failed to read, e.g. because its file was locked, keeps its sweeps and is read again later
+    std::vector<Experiment>& data = _ephysTraces->getData();
+    size_t numRead = 0;
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        if (!succeeded[i])
+        {
+            _ephysTraceReadStates[rows[i]] = TraceReadState::UNREAD;
+            continue;
+        }
+
+        data[rows[i]] = std::move(experiments[i]);
+        _ephysTraceReadStates[rows[i]] = TraceReadState::READ;
+        numRead++;
+    }
+
+    // The cache deletes pyramids that exceed its capacity right away and drops the least recently viewed ones beyond it
+    for (SweepPyramid& sweepPyramid : pyramids)
+    {
+        const qsizetype cost = static_cast<qsizetype>(sweepPyramid.pyramid->byteSize());
+        if (cost <= _ephysTracePyramids.maxCost())
+        {
+            _ephysTracePyramidKeys.insert(sweepPyramid.key);
+            _ephysTracePyramids.insert(sweepPyramid.key, new TracePyramid(std::move(*sweepPyramid.pyramid)), cost);
+        }
+    }
+
+    qDebug() << "Read the traces of" << numRead << "of" << rows.size() << "selected cells";
+    events().notifyDatasetDataChanged(_ephysTraces);
+
+    if (_ephysTraceReadPending)
+    {
+        _ephysTraceReadPending = false;
+        readSelectedEphysTraces();
+    }
+}
+
+QVariantMap PatchSeqDataLoader::queryEphysTrace(int row, int sweepNumber, float startTime, float endTime, int pixelWidth)
+{
+    const QPair<uint32_t, int> key(static_cast<uint32_t>(row), sweepNumber);
+    const TracePyramid* pyramid = _ephysTracePyramids.object(key);
+    if (!pyramid)
+    {
+        // An evicted pyramid is read again, the viewer queries it once the ephys traces change
+        if (_ephysTracePyramidKeys.contains(key) && _ephysTraceReadStates[key.first] == TraceReadState::READ)
+        {
+            _ephysTraceReadStates[key.first] = TraceReadState::UNREAD;
+            _ephysTraceRereadRows.push_back(key.first);
+            readSelectedEphysTraces();
+        }
+        return {};
+    }
+
+    Trace output;
+    pyramid->query(startTime, endTime, pixelWidth, output);
+
+    QVariantMap samples;
+    samples["xSeries"] = QVariant::fromValue(QList<float>(output.xSeries.begin(), output.xSeries.end()));
+    samples["ySeries"] = QVariant::fromValue(QList<float>(output.ySeries.begin(), output.ySeries.end()));
+    return samples;
+}
+
+void PatchSeqDataLoader::addNeighborQueries(Dataset<Points> knnDataset, const Embedding& embedding)
+{
+    if (!embedding.knnIndex)
+        return;
+
+    _knnIndices[knnDataset->getId()] = embedding.knnIndex;
+
+    // Views find queryNearestNeighbors through the kNN graph dataset
+    knnDataset->setProperty("NeighborQueryProvider", QVariant::fromValue(static_cast<QObject*>(this)));
+}
+
+QVariantList PatchSeqDataLoader::queryNearestNeighbors(const QString& datasetId, int row, int numNeighbors)
+{
+    const auto it = _knnIndices.constFind(datasetId);
+    if (it == _knnIndices.constEnd() || row < 0 || static_cast<size_t>(row) >= (*it)->numPoints() || numNeighbors <= 0)
+        return {};
+
+    const std::vector<uint32_t> neighbors = (*it)->findNeighbors(static_cast<uint32_t>(row), static_cast<size_t>(numNeighbors));
+
+    QVariantList neighborRows;
+    neighborRows.reserve(static_cast<qsizetype>(neighbors.size()));
+    for (uint32_t neighbor : neighbors)
+        neighborRows.append(neighbor);
+    return neighborRows;
+}
+
+void PatchSeqDataLoader::loadUMap(QString filePath, mv::Dataset<Points> parent, QString datasetName)
+{
+    TRACE_SCOPE("UMAP", filePath);
+
     MatrixData umapData;
     MatrixDataLoader matrixDataLoader(false);
     DataFrame umapDf;
@@ -1199,23 +1663,11 @@ void PatchSeqDataLoader::loadUMap(QString filePath, mv::Dataset<Points> parent,
     // Create dataset
     Dataset<Points> umapDataset = mv::data().createDataset("Points", datasetName, parent, "", false);
     //umapDataset->setSourceDataset(parent);
-    umapDataset->setData(umapData.data, umapData.numCols);
+    umapDataset->setData(umapData.data.data(), umapData.numRows, umapData.numCols);
     umapDataset->setDimensionNames(umapData.headers);
 
-    // Add bimap
-    BiMap umapBiMap;
-    std::vector<uint32_t> indices(umapDf[CELL_ID_TAG].size());
-    std::iota(indices.begin(), indices.end(), 0);
-    const std::vector<QString>& keys = umapDf[CELL_ID_TAG];
-    for (int i = 0; i < keys.size(); i++)
-    {
-        if (keys[i].isNull() || keys[i].isEmpty())
-            indices[i] = -1;
-    }
-
-    umapBiMap.addKeyValuePairs(keys, indices);
-
-    _selectionGroup.addDataset(umapDataset, umapBiMap);
+    // Link the selection
+    linkDataset(umapDataset, _cellRegistry.registerCells(umapDf[CELL_ID_TAG]));
 
     // Notify
     events().notifyDatasetAdded(umapDataset);
@@ -3,8 +3,15 @@
 #include <LoaderPlugin.h>
 
 #include "DataFrame.h"
+#include "MatrixData.h"
+#include "PatchSeqStages.h"
+#include "CellRegistry.h"
+#include "SelectionLinker.h"
 #include "PatchSeqFilePaths.h"
 #include "ColorTaxonomy.h"
+#include "Electrophysiology/NWBLoader.h"
+#include "Electrophysiology/NWBLoadSession.h"
+#include "Electrophysiology/TracePyramid.h"
 
 #include <PointData/PointData.h>
 #include <ClusterData/ClusterData.h>
@@ -14,9 +21,17 @@
 
 #include <Task.h>
 #include <SelectionGroup.h>
+#include <event/EventListener.h>
 
+#include <QCache>
+#include <QSet>
 #include <QString>
 #include <QColor>
+#include <QTimer>
+#include <QVariantMap>
+
+#include <memory>
+#include <thread>
 
 using namespace mv::plugin;
 
@@ -54,31 +69,79 @@ public:
     void loadData() Q_DECL_OVERRIDE;
 
 private:
+    // Samples of the acquisition of a sweep of a row of the ephys traces for a view of [startTime, endTime] seconds that
+    // is pixelWidth pixels wide, at full resolution over the stimulus epoch when zoomed in far enough. Returns a map
+    // with the "xSeries" and "ySeries" as QList<float>, or an empty map if the sweep has no pyramid, the viewer then
+    // shows the display samples of the experiment. The ephys traces dataset holds this plugin in its
+    // "TraceQueryProvider" property, so the viewer calls this by name through QMetaObject::invokeMethod. Called from
+    // the GUI thread.
+    Q_INVOKABLE QVariantMap queryEphysTrace(int row, int sweepNumber, float startTime, float endTime, int pixelWidth);
+
+    // Row indices of the numNeighbors nearest neighbours of a row of a modality, closest first and excluding the row
+    // itself, from the index its kNN graph dataset was built with. The kNN graph datasets hold this plugin in their
+    // "NeighborQueryProvider" property and are identified by their dataset id. Returns an empty list for an unknown
+    // dataset or row. Called from the GUI thread.
+    Q_INVOKABLE QVariantList queryNearestNeighbors(const QString& datasetId, int row, int numNeighbors);
+
+    // Keeps the kNN index of a modality for queryNearestNeighbors on its kNN graph dataset
+    void addNeighborQueries(mv::Dataset<Points> knnDataset, const Embedding& embedding);
+
+    void loadDataSets();
     void loadGeneExpressionData(QString filePath, const DataFrame& metadata);
     void loadEphysData(QString filePath, const DataFrame& metadata);
     void loadMorphologyData(QString filePath, const DataFrame& metadata);
     void loadMorphologyCells(QDir dir);
     void loadEphysTraces(QDir dir);
-    void loadUMap(QString filePath, mv::Dataset<Points> parent, QString datasetName, BiMap& bimap);
+
+    // Reads the sweeps of the rows of the ephys traces whose pyramids were queried after being evicted and of the
+    // selected rows that have not been read yet on a background thread
+    void readSelectedEphysTraces();
+
+    // Pyramid of a sweep of a row of the ephys traces, read along with its experiment
+    struct SweepPyramid
+    {
+        QPair<uint32_t, int> key;       // Row and sweep number
+        std::shared_ptr<TracePyramid> pyramid;
+    };
+
+    // Moves the sweeps of the given rows that were read into the ephys traces and their pyramids into the cache, on the
+    // GUI thread. Rows that failed to read are read again the next time they are selected.
+    void finishEphysTraceRead(const std::vector<uint32_t>& rows, std::vector<char>&& succeeded, std::vector<Experiment>&& experiments, std::vector<SweepPyramid>&& pyramids);
+    void loadUMap(QString filePath, mv::Dataset<Points> parent, QString datasetName);
+
+    // Adds a dataset whose rows hold the given registry cells to the selection linker, or to the selection group
+    // without INDEX_SELECTION_LINKING
+    void linkDataset(mv::Dataset<mv::DatasetImpl> dataset, const std::vector<uint32_t>& rowCells);
 
 private:
+    // Parameters of the processing stages for the dataset the plugin is built for
+    StageSettings _settings;
+
     DataFrame _taxonomyDf;
     QHash<QString, QColor> _cellTypeColors;
     ColorTaxonomy _colorTaxonomy;
 
     KeyBasedSelectionGroup _selectionGroup;
 
+    // Dense cell indices of the rows of the linked datasets
+    CellRegistry _cellRegistry;
+    std::vector<uint32_t> _metadataCells;
+    std::vector<uint32_t> _geneExpressionCells;
+    std::vector<uint32_t> _ephysCells;
+    std::vector<uint32_t> _morphoCells;
+    SelectionLinker _selectionLinker;
+
     // Metadata
     DataFrame _metadataDf;
     Dataset<Text> _metadata;
 
     // Gene expressions
-    DataFrame _transcriptomicsDf;
+    GeneExpression _geneExpression;         // Only held while loading
     Dataset<Points> _geneExpressionData;
     DataFrame _gexprMetadata;
 
     // Electrophysiology
-    DataFrame _ephysDf;
+    FeatureData _ephysFeatures;             // Only held while loading
     Dataset<Points> _ephysData;
     DataFrame _ephysMetadata;
 
@@ -86,8 +149,32 @@ private:
     Dataset<EphysExperiments> _ephysTraces;
     std::vector<QString> _ephysTraceCellIds;
 
+    enum class TraceReadState : uint8_t { UNREAD, READING, READ };
+
+    // Index of the NWB file of every row of the ephys traces and whether its sweeps have been read
+    std::unique_ptr<NWBLoadSession> _ephysTraceSession;
+    std::vector<NWBFileIndex> _ephysTraceIndices;
+    std::vector<TraceReadState> _ephysTraceReadStates;
+    mv::EventListener _eventListener;
+
+    // Sweeps are read once the selection has settled, by one reader at a time. A selection made while reading is read
+    // after it.
+    QTimer _ephysTraceReadTimer;
+    std::thread _ephysTraceReader;
+    bool _ephysTraceReadPending = false;
+
+    // Pyramids of the read sweeps by row and sweep number, their cost is their size in bytes. The keys of the sweeps
+    // that have a pyramid tell an evicted pyramid apart from a sweep without one, rows whose pyramids were evicted are
+    // read again before the selection.
+    QCache<QPair<uint32_t, int>, TracePyramid> _ephysTracePyramids;
+    QSet<QPair<uint32_t, int>> _ephysTracePyramidKeys;
+    std::vector<uint32_t> _ephysTraceRereadRows;
+
+    // kNN indices of the modalities by the id of their kNN graph dataset
+    QHash<QString, std::shared_ptr<HNSWIndex>> _knnIndices;
+
     // Morphology
-    DataFrame _morphologyDf;
+    FeatureData _morphoFeatures;            // Only held while loading
     Dataset<Points> _morphoData;
     DataFrame _morphoMetadata;
 
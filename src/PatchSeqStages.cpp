@@ -0,0 +1,294 @@
+#include "PatchSeqStages.h"
+
+#include "MatrixDataLoader.h"
+#include "MatrixTransforms.h"
+#include "Analysis/PCA.h"
+#include "Analysis/NearestNeighbors.h"
+#include "Tracing.h"
+#include "MemoryProfiler.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <unordered_set>
+
+namespace
+{
+    // Returns the number of rows removed
+    size_t removeDuplicateRows(DataFrame& df, QString columnToCheck, MatrixData& matrix)
+    {
+        TRACE_SCOPE("Dedup", columnToCheck);
+
+        std::vector<int> duplicateRows = df.findDuplicateRows(columnToCheck);
+        qDebug() << "Removing duplicate rows: " << duplicateRows.size();
+        for (size_t i = 0; i < duplicateRows.size(); i++)
+        {
+            qDebug() << df[columnToCheck][duplicateRows[i]];
+        }
+
+        df.removeRows(duplicateRows);
+        matrix.removeRows(duplicateRows);
+
+        return duplicateRows.size();
+    }
+
+    void removeRowsNotInMetadata(DataFrame& df, QString columnToCheck, const DataFrame& metadata, MatrixData& matrix)
+    {
+        TRACE_SCOPE("Join", columnToCheck);
+
+        std::vector<QString> metaColumn = metadata[columnToCheck];
+        // Make a unique set out of meta column
+        std::unordered_set<QString> uniqueValues;
+        for (size_t i = 0; i < metaColumn.size(); i++)
+        {
+            uniqueValues.insert(metaColumn[i]);
+        }
+
+        // For every value in df column, check if its in metadata
+        std::vector<QString> dfColumn = df[columnToCheck];
+        std::vector<int> rowsToRemove;
+        for (size_t i = 0; i < dfColumn.size(); i++)
+        {
+            QString row = dfColumn[i];
+            if (uniqueValues.find(row) == uniqueValues.end())
+            {
+                // Remove row because its not in the metadata
+                rowsToRemove.push_back(i);
+            }
+        }
+        qDebug() << "Removing " << rowsToRemove.size() << " rows because they are not found in metadata";
+
+        df.removeRows(rowsToRemove);
+        matrix.removeRows(rowsToRemove);
+    }
+
+    void removeFeatures(MatrixData& matrix, const QStringList& features)
+    {
+        std::vector<int> colsToDelete;
+        for (size_t i = 0; i < matrix.headers.size(); i++)
+        {
+            for (int j = 0; j < features.size(); j++)
+            {
+                if (matrix.headers[i] == features[j])
+                    colsToDelete.push_back(i);
+            }
+        }
+
+        matrix.removeCols(colsToDelete);
+    }
+
+    // Loads the nearest neighbour index of the rows from the cache, or builds and caches it if it is not there. Cache
+    // files are named by the hash of the indexed data, so a changed dataset never picks up a stale index.
+    void computeKnnGraph(const MatrixData& matrix, const StageSettings& settings, Embedding& embedding)
+    {
+        TRACE_SCOPE("kNN index");
+
+        // The index outlives the stage, its copy of the points follows the storage of the matrix
+        auto index = std::make_shared<HNSWIndex>(matrix.numCols);
+        if (matrix.data.isFileBacked())
+            index->useFileStorage();
+        uint64_t dataHash = HNSWIndex::hashPoints(matrix.data.data(), matrix.numRows, matrix.numCols);
+
+        QDir cacheDir(settings.knnCacheDir);
+        const bool hasCacheDir = !settings.knnCacheDir.isEmpty() && cacheDir.mkpath(".");
+        QString cacheFilePath = cacheDir.filePath(QString("%1.hnsw").arg(dataHash, 16, 16, QChar('0')));
+
+        if (!hasCacheDir || !index->load(cacheFilePath, dataHash))
+        {
+            index->build(matrix.data.data(), matrix.numRows);
+            if (hasCacheDir)
+                index->save(cacheFilePath, dataHash);
+        }
+
+        embedding.knnGraph = index->computeKnnGraph(settings.numKnnNeighbors);
+        embedding.knnIndex = std::move(index);
+    }
+
+    void computePCA(const MatrixData& matrix, const StageSettings& settings, Embedding& embedding)
+    {
+        TRACE_SCOPE("PCA");
+
+        ComputeRandomizedPCA(matrix, settings.numPcaComponents, embedding.pcaScores, embedding.explainedVariance);
+    }
+}
+
+void LoadGeneExpression(const QString& filePath, const StageSettings& settings, GeneExpression& geneExpression)
+{
+    TRACE_SCOPE("Gene expression", filePath);
+    MemoryStage memoryStage("Gene expression");
+
+    MatrixDataLoader matrixDataLoader;
+    matrixDataLoader.setTransforms(settings.geneTransforms);
+
+    MatrixData& matrixData = geneExpression.matrix;
+    if (QFileInfo(filePath).size() > settings.fileBackedMatrixThreshold)
+    {
+        matrixData.useFileStorage();
+        matrixDataLoader.setCacheDir(settings.matrixCacheDir);
+    }
+    matrixDataLoader.LoadMatrixData(filePath, geneExpression.df, matrixData, 1);
+
+    const size_t numDuplicateRows = removeDuplicateRows(geneExpression.df, settings.cellIdTag, matrixData);
+    MemoryProfiler::recordContainer("Gene expression matrix", matrixData.data.size() * sizeof(float));
+    MemoryProfiler::recordContainer("Transcriptomics data frame", geneExpression.df);
+
+    // The variance of the genes is stabilized on the (normalized) counts, a log1p at the end of the transforms is
+    // undone for it. The statistics gathered while parsing also cover the duplicate rows and are only gathered with
+    // transforms and without a cache, so they are only reused for counts, then and without duplicates. Empty counts
+    // stay missing and are left out of the statistics.
+    const bool logCounts = settings.geneTransforms.endsWith(TransformType::LOG1P);
+    ColumnStatistics countStats = matrixDataLoader.getTransforms().getColumnStatistics();
+    if (logCounts || numDuplicateRows > 0 || countStats.numColumns() != matrixData.numCols)
+        countStats = matrixData.computeColumnStatistics(logCounts);
+
+    // Only keep the highly variable genes
+    geneExpression.allGeneNames = QStringList(matrixData.headers.begin(), matrixData.headers.end());
+    std::vector<int> highlyVariableGenes = matrixData.findHighlyVariableColumns(countStats, settings.numHighlyVariableGenes, logCounts);
+    matrixData.keepCols(highlyVariableGenes);
+    qDebug() << "Kept" << matrixData.numCols << "highly variable genes out of" << geneExpression.allGeneNames.size();
+
+    matrixData.imputeMissingValues(settings.geneImputation);
+}
+
+void LoadEphysFeatures(const QString& filePath, const DataFrame& metadata, const QStringList& featuresToDelete, const StageSettings& settings, FeatureData& features)
+{
+    TRACE_SCOPE("Ephys features", filePath);
+    MemoryStage memoryStage("Ephys features");
+
+    MatrixDataLoader matrixDataLoader(true);
+    matrixDataLoader.LoadMatrixData(filePath, features.df, features.matrix, 2);
+
+    removeDuplicateRows(features.df, settings.cellIdTag, features.matrix);
+    if (metadata.numRows() > 0)
+        removeRowsNotInMetadata(features.df, settings.cellIdTag, metadata, features.matrix);
+    removeFeatures(features.matrix, featuresToDelete);
+    features.matrix.imputeMissingValues(settings.ephysImputation);
+
+    MemoryProfiler::recordContainer("Ephys matrix", features.matrix.data.size() * sizeof(float));
+    MemoryProfiler::recordContainer("Ephys data frame", features.df);
+}
+
+void LoadMorphologyFeatures(const QString& filePath, const StageSettings& settings, FeatureData& features)
+{
+    TRACE_SCOPE("Morphology features", filePath);
+    MemoryStage memoryStage("Morphology features");
+
+    MatrixDataLoader matrixDataLoader(true);
+    matrixDataLoader.LoadMatrixData(filePath, features.df, features.matrix, 1);
+
+    removeDuplicateRows(features.df, settings.cellIdTag, features.matrix);
+    features.matrix.imputeMissingValues(settings.morphologyImputation);
+
+    MemoryProfiler::recordContainer("Morphology matrix", features.matrix.data.size() * sizeof(float));
+    MemoryProfiler::recordContainer("Morphology data frame", features.df);
+}
+
+void EmbedGeneExpression(const MatrixData& genes, const StageSettings& settings, Embedding& embedding)
+{
+    TRACE_SCOPE("Embed gene expression");
+
+    // The copy of a file-backed matrix is backed by a temporary file of its own, so scaling it takes no memory either
+    MatrixData scaledGenes = genes;
+    scaledGenes.standardize();
+    MemoryProfiler::recordContainer("Scaled gene expression copy", scaledGenes.data.size() * sizeof(float));
+
+    computePCA(scaledGenes, settings, embedding);
+    MemoryProfiler::recordContainer("Gene expression PCA scores", embedding.pcaScores.data.size() * sizeof(float));
+
+    computeKnnGraph(embedding.pcaScores, settings, embedding);
+}
+
+void EmbedFeatures(const MatrixData& features, const StageSettings& settings, Embedding& embedding)
+{
+    TRACE_SCOPE("Embed features");
+
+    MatrixData standardizedData = features;
+    standardizedData.standardize();
+    MemoryProfiler::recordContainer("Standardized feature copy", standardizedData.data.size() * sizeof(float));
+
+    computePCA(standardizedData, settings, embedding);
+    computeKnnGraph(standardizedData, settings, embedding);
+}
+
+size_t CorrelateGenesWithFeatures(const GeneExpression& genes, const FeatureData& features, const StageSettings& settings, MatrixData& correlations)
+{
+    TRACE_SCOPE("Correlation");
+    MemoryStage memoryStage("Correlation");
+
+    std::vector<std::pair<uint32_t, uint32_t>> rowPairs = JoinRowsOnKeys(genes.df[settings.cellIdTag], features.df[settings.cellIdTag]);
+    ComputeCorrelations(genes.matrix, features.matrix, rowPairs, settings.geneFeatureCorrelation, correlations);
+
+    return rowPairs.size();
+}
+
+std::vector<QString> LookupClusterNames(const DataFrame& df, const DataFrame& metadata, const QString& cellIdTag, const QString& metaLabel)
+{
+    const std::vector<QString>& treeCluster = metadata[metaLabel];
+    const std::vector<QString>& metadataCellIds = metadata[cellIdTag];
+    const std::vector<QString>& dataCellIds = df[cellIdTag];
+
+    // The last metadata row of a cell wins
+    QHash<QString, int> metadataRows;
+    metadataRows.reserve(metadataCellIds.size());
+    for (size_t j = 0; j < metadataCellIds.size(); j++)
+        metadataRows.insert(metadataCellIds[j], j);
+
+    std::vector<QString> clusterNames(dataCellIds.size());
+    for (size_t i = 0; i < dataCellIds.size(); i++)
+    {
+        auto it = metadataRows.constFind(dataCellIds[i]);
+        clusterNames[i] = it != metadataRows.constEnd() ? treeCluster.at(it.value()) : "Undefined";
+    }
+
+    return clusterNames;
+}
+
+void FindMarkerGenes(const GeneExpression& genes, const std::vector<QString>& clusterNames, const StageSettings& settings, ClusterMarkers& clusterMarkers)
+{
+    TRACE_SCOPE("Marker genes");
+    MemoryStage memoryStage("Marker genes");
+
+    // Fold changes are taken of expm1 of the values, so they must be log1p of the normalized counts
+    clusterMarkers.clusters.clear();
+    clusterMarkers.markers.clear();
+    if (!settings.geneTransforms.endsWith(TransformType::LOG1P))
+    {
+        qWarning() << "Skipping the marker genes, the gene transforms do not end in log1p";
+        return;
+    }
+
+    // Number the clusters, undefined and unnamed cells are left out of the comparison
+    std::map<QString, int> clusterIndices;
+    for (const QString& clusterName : clusterNames)
+    {
+        if (!clusterName.isEmpty() && clusterName != "Undefined")
+            clusterIndices.emplace(clusterName, 0);
+    }
+
+    for (auto& kv : clusterIndices)
+    {
+        kv.second = static_cast<int>(clusterMarkers.clusters.size());
+        clusterMarkers.clusters.push_back(kv.first);
+    }
+
+    std::vector<int> labels(clusterNames.size(), -1);
+    for (size_t i = 0; i < clusterNames.size(); i++)
+    {
+        auto it = clusterIndices.find(clusterNames[i]);
+        if (it != clusterIndices.end())
+            labels[i] = it->second;
+    }
+
+    clusterMarkers.markers = ComputeDifferentialExpression(genes.matrix, labels, clusterMarkers.clusters.size());
+
+    if (settings.numMarkerGenesPerCluster > 0)
+    {
+        for (std::vector<MarkerGene>& markers : clusterMarkers.markers)
+            markers.resize(std::min(markers.size(), settings.numMarkerGenesPerCluster));
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "DataFrame.h"
+#include "MatrixData.h"
+#include "MatrixTransforms.h"
+#include "Analysis/Correlation.h"
+#include "Analysis/DifferentialExpression.h"
+
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class HNSWIndex;
+
+// Processing stages of a patch-seq dataset that don't depend on ManiVault, shared by the plugin and the benchmark.
+// The plugin turns their results into datasets.
+
+// Parameters of the stages, the plugin overrides them in its dataset blocks
+class StageSettings
+{
+public:
+    QString cellIdTag = "cell_id";
+
+    // Row transforms applied to the gene counts while parsing, counts per million and log1p by default. Files that
+    // are already normalized leave out the library size normalization.
+    TransformPipeline geneTransforms = TransformPipeline().add(MatrixTransform::libraryNormalize(1e6f)).add(MatrixTransform::log1p());
+
+    ImputationStrategy geneImputation = ImputationStrategy::MEAN;
+    ImputationStrategy ephysImputation = ImputationStrategy::MEAN;
+    ImputationStrategy morphologyImputation = ImputationStrategy::ZERO;
+
+    size_t numHighlyVariableGenes = 2000;       // Genes kept in the gene expression matrix
+    size_t numPcaComponents = 50;               // Principal components precomputed for every modality
+    size_t numKnnNeighbors = 15;                // Neighbours per cell in the kNN graph of every modality
+    size_t numMarkerGenesPerCluster = 100;      // Top marker genes kept per cluster, 0 keeps all genes
+
+    // Gene expression files larger than this many bytes are parsed into a memory-mapped file instead of memory
+    qint64 fileBackedMatrixThreshold = 4ll << 30;
+
+    // Directory the parsed values of those files are cached in, so they are only parsed once. None if empty.
+    QString matrixCacheDir;
+
+    CorrelationMethod geneFeatureCorrelation = CorrelationMethod::SPEARMAN;
+
+    // Directory the nearest neighbour indices are cached in, none if empty
+    QString knnCacheDir;
+};
+
+// Log-normalized gene expression of the cells, reduced to the highly variable genes
+class GeneExpression
+{
+public:
+    DataFrame df;
+    MatrixData matrix;
+    QStringList allGeneNames;
+};
+
+// Features of the cells of one modality, missing values imputed
+class FeatureData
+{
+public:
+    DataFrame df;
+    MatrixData matrix;
+};
+
+// PCA of a modality and the kNN graph of its cells
+class Embedding
+{
+public:
+    MatrixData pcaScores;
+    std::vector<float> explainedVariance;
+    std::vector<uint32_t> knnGraph;     // numKnnNeighbors neighbours per cell
+    std::shared_ptr<HNSWIndex> knnIndex;    // Index the graph was found with, for further neighbour queries
+};
+
+// Marker genes of the clusters, in the order of the cluster names
+class ClusterMarkers
+{
+public:
+    std::vector<QString> clusters;
+    std::vector<std::vector<MarkerGene>> markers;
+};
+
+// Parses the gene expression with the gene transforms of the settings and keeps the highly variable genes, ranked over
+// the cells that occur once
+void LoadGeneExpression(const QString& filePath, const StageSettings& settings, GeneExpression& geneExpression);
+
+// Parses the ephys features of the cells in the metadata, without the given features. Without metadata all cells are kept.
+void LoadEphysFeatures(const QString& filePath, const DataFrame& metadata, const QStringList& featuresToDelete, const StageSettings& settings, FeatureData& features);
+
+void LoadMorphologyFeatures(const QString& filePath, const StageSettings& settings, FeatureData& features);
+
+// The genes are scaled before the PCA, neighbours are searched in PCA space where noise is averaged out
+void EmbedGeneExpression(const MatrixData& genes, const StageSettings& settings, Embedding& embedding);
+
+// Features have different units, so they are standardized before the PCA and the neighbour search, the features
+// themselves are left as they are
+void EmbedFeatures(const MatrixData& features, const StageSettings& settings, Embedding& embedding);
+
+// Correlation of every gene with every feature over the cells measured in both. Returns the number of those cells.
+size_t CorrelateGenesWithFeatures(const GeneExpression& genes, const FeatureData& features, const StageSettings& settings, MatrixData& correlations);
+
+// Cluster name of every row of df, looked up in the metaLabel column of the metadata by cell ID, "Undefined" for cells
+// not in the metadata
+std::vector<QString> LookupClusterNames(const DataFrame& df, const DataFrame& metadata, const QString& cellIdTag, const QString& metaLabel);
+
+// Marker genes of the clusters the genes' cells belong to, undefined and unnamed clusters are left out. None are found
+// unless the gene transforms end in log1p, as the fold changes are taken of the normalized counts.
+void FindMarkerGenes(const GeneExpression& genes, const std::vector<QString>& clusterNames, const StageSettings& settings, ClusterMarkers& clusterMarkers);
@@ -0,0 +1,118 @@
+#include "SelectionLinker.h"
+
+#include "Tracing.h"
+
+#include <CoreInterface.h>
+#include <event/Event.h>
+
+#include <QDebug>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+
+namespace
+{
+    // Propagations slower than a frame at 60 Hz are reported as they happen
+    constexpr double SLOW_PROPAGATION_MILLISECONDS = 16.0;
+}
+
+SelectionLinker::SelectionLinker()
+{
+    _eventListener.addSupportedEventType(static_cast<std::uint32_t>(mv::EventType::DatasetDataSelectionChanged));
+    _eventListener.registerDataEvent([this](mv::DatasetEvent* dataEvent)
+    {
+        if (dataEvent->getType() == mv::EventType::DatasetDataSelectionChanged)
+            propagateSelection(dataEvent->getDataset());
+    });
+}
+
+SelectionLinker::~SelectionLinker()
+{
+    if (_numPropagations == 0)
+        return;
+
+    qDebug() << "Selection propagation:" << _numPropagations << "selections, average" << _totalMilliseconds / _numPropagations << "ms, max" << _maxMilliseconds << "ms";
+}
+
+void SelectionLinker::addDataset(mv::Dataset<mv::DatasetImpl> dataset, const std::vector<uint32_t>& rowCells)
+{
+    if (!dataset.isValid())
+        return;
+
+    _datasets.push_back({ dataset, rowCells, {} });
+}
+
+void SelectionLinker::link(const CellRegistry& registry)
+{
+    TRACE_SCOPE("Link selections");
+
+    for (LinkedDataset& source : _datasets)
+    {
+        source.rowMaps.resize(_datasets.size());
+        for (size_t t = 0; t < _datasets.size(); t++)
+        {
+            if (&_datasets[t] != &source)
+                source.rowMaps[t] = registry.mapRows(source.rowCells, _datasets[t].rowCells);
+        }
+    }
+}
+
+void SelectionLinker::propagateSelection(const mv::Dataset<mv::DatasetImpl>& source)
+{
+    // Ignore the selection changes caused by the propagation itself
+    if (_isPropagating)
+        return;
+
+    auto it = std::find_if(_datasets.begin(), _datasets.end(), [&source](const LinkedDataset& linked) { return linked.dataset == source; });
+    if (it == _datasets.end() || it->rowMaps.empty())
+        return;
+
+    _isPropagating = true;
+    auto start = std::chrono::steady_clock::now();
+
+    const std::vector<std::uint32_t>& selection = it->dataset->getSelectionIndices();
+    const size_t sourceIndex = it - _datasets.begin();
+
+    std::vector<uint64_t> selectedRows;
+    std::vector<std::uint32_t> targetSelection;
+    for (size_t t = 0; t < _datasets.size(); t++)
+    {
+        if (t == sourceIndex)
+            continue;
+
+        LinkedDataset& target = _datasets[t];
+        const RowMap& rowMap = it->rowMaps[t];
+
+        // Gather the target rows into a bitset, which also removes duplicates and sorts them
+        selectedRows.assign((target.rowCells.size() + 63) / 64, 0);
+        for (std::uint32_t row : selection)
+        {
+            if (row >= rowMap.numSourceRows())
+                continue;
+
+            for (uint32_t targetRow : rowMap.targetRows(row))
+                selectedRows[targetRow >> 6] |= uint64_t(1) << (targetRow & 63);
+        }
+
+        targetSelection.clear();
+        for (size_t word = 0; word < selectedRows.size(); word++)
+        {
+            for (uint64_t bits = selectedRows[word]; bits != 0; bits &= bits - 1)
+                targetSelection.push_back(static_cast<std::uint32_t>(word * 64 + std::countr_zero(bits)));
+        }
+
+        target.dataset->setSelectionIndices(targetSelection);
+        mv::events().notifyDatasetDataSelectionChanged(target.dataset);
+    }
+
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _numPropagations++;
+    _totalMilliseconds += milliseconds;
+    _maxMilliseconds = std::max(_maxMilliseconds, milliseconds);
+
+    if (milliseconds > SLOW_PROPAGATION_MILLISECONDS)
+        qDebug() << "Propagating a selection of" << selection.size() << "rows took" << milliseconds << "ms";
+
+    _isPropagating = false;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "CellRegistry.h"
+
+#include <Dataset.h>
+#include <event/EventListener.h>
+
+#include <cstdint>
+#include <vector>
+
+// Links the selections of datasets whose rows are cells of a CellRegistry. Once linked, the row maps between every pair
+// of datasets are precomputed, so propagating a selection is a gather over integer arrays into a bitset per dataset,
+// instead of going through cell ID strings. Propagation latency is measured and reported.
+class SelectionLinker
+{
+public:
+    SelectionLinker();
+    ~SelectionLinker();
+
+    // Adds a dataset whose row i holds cell rowCells[i] of the registry
+    void addDataset(mv::Dataset<mv::DatasetImpl> dataset, const std::vector<uint32_t>& rowCells);
+
+    // Precomputes the row maps between all pairs of datasets and starts propagating their selections
+    void link(const CellRegistry& registry);
+
+    // Selects the rows holding the selected cells of the source in every other linked dataset
+    void propagateSelection(const mv::Dataset<mv::DatasetImpl>& source);
+
+private:
+    struct LinkedDataset
+    {
+        mv::Dataset<mv::DatasetImpl> dataset;
+        std::vector<uint32_t> rowCells;
+        std::vector<RowMap> rowMaps;                    // Per linked dataset, the rows of every row of this dataset there
+    };
+
+    std::vector<LinkedDataset> _datasets;
+    mv::EventListener _eventListener;
+    bool _isPropagating = false;
+
+    // Latency statistics
+    size_t _numPropagations = 0;
+    double _totalMilliseconds = 0;
+    double _maxMilliseconds = 0;
+};
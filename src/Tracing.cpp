@@ -0,0 +1,96 @@
+#include "Tracing.h"
+
+#include "json.hpp"
+
+#include <QDebug>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name;
+        QString detail;
+        int64_t begin;
+        int64_t duration;
+        uint32_t thread;
+    };
+
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    std::mutex eventMutex;
+    std::vector<TraceEvent> events;
+
+    std::atomic<uint32_t> numThreads = 0;
+
+    // Small sequential thread IDs keep the trace viewer readable, the first thread to record gets 0
+    uint32_t currentThread()
+    {
+        thread_local uint32_t thread = numThreads++;
+        return thread;
+    }
+}
+
+const bool Tracing::detail::enabled = !qEnvironmentVariableIsEmpty("PATCHSEQ_TRACE");
+
+int64_t Tracing::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void Tracing::addEvent(const char* name, const QString& detail, int64_t beginMicroseconds, int64_t endMicroseconds)
+{
+    uint32_t thread = currentThread();
+
+    std::lock_guard<std::mutex> lock(eventMutex);
+    events.push_back({ name, detail, beginMicroseconds, endMicroseconds - beginMicroseconds, thread });
+}
+
+void Tracing::write()
+{
+    if (!isEnabled())
+        return;
+
+    QString filePath = qEnvironmentVariable("PATCHSEQ_TRACE");
+
+    std::vector<TraceEvent> writtenEvents;
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        writtenEvents.swap(events);
+    }
+
+    json traceEvents = json::array();
+    traceEvents.push_back({ { "name", "process_name" }, { "ph", "M" }, { "pid", 0 }, { "args", { { "name", "PatchSeqDataLoader" } } } });
+
+    for (const TraceEvent& event : writtenEvents)
+    {
+        json traceEvent = { { "name", event.name }, { "ph", "X" }, { "ts", event.begin }, { "dur", event.duration }, { "pid", 0 }, { "tid", event.thread } };
+        if (!event.detail.isEmpty())
+            traceEvent["args"] = { { "detail", event.detail.toStdString() } };
+
+        traceEvents.push_back(std::move(traceEvent));
+    }
+
+    std::ofstream file(filePath.toStdString());
+    if (!file)
+    {
+        qWarning() << "Failed to write trace to" << filePath;
+        return;
+    }
+
+    file << json({ { "traceEvents", traceEvents }, { "displayTimeUnit", "ms" } }).dump();
+    qDebug() << "Wrote" << traceEvents.size() - 1 << "trace events to" << filePath;
+}
+
+void Tracing::clear()
+{
+    std::lock_guard<std::mutex> lock(eventMutex);
+    events.clear();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QString>
+
+#include <cstdint>
+
+// Scoped tracing of the loading stages, written as Chrome trace event JSON that chrome://tracing and Perfetto open.
+// Tracing is enabled by setting the PATCHSEQ_TRACE environment variable to the output path. A disabled scope only
+// checks a flag, an enabled one records its begin and end time, thread and optional detail such as a file name.
+namespace Tracing
+{
+    namespace detail
+    {
+        extern const bool enabled;
+    }
+
+    inline bool isEnabled() { return detail::enabled; }
+
+    // Microseconds since the start of the process
+    int64_t now();
+
+    // Records a finished scope, the name must outlive the trace
+    void addEvent(const char* name, const QString& detail, int64_t beginMicroseconds, int64_t endMicroseconds);
+
+    // Writes the events recorded since the last write or clear to the trace file, and drops them
+    void write();
+
+    // Drops the events recorded so far, so a new load starts with an empty trace
+    void clear();
+}
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name, const QString& detail = QString()) :
+        _name(name)
+    {
+        if (!Tracing::isEnabled())
+            return;
+
+        _detail = detail;
+        _begin = Tracing::now();
+    }
+
+    // The detail is only made when tracing is enabled
+    template<typename MakeDetail>
+    TraceScope(const char* name, MakeDetail makeDetail) :
+        _name(name)
+    {
+        if (!Tracing::isEnabled())
+            return;
+
+        _detail = makeDetail();
+        _begin = Tracing::now();
+    }
+
+    ~TraceScope()
+    {
+        if (_begin >= 0)
+            Tracing::addEvent(_name, _detail, _begin, Tracing::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* _name;
+    QString _detail;
+    int64_t _begin = -1;
+};
+
+#define TRACE_SCOPE_CONCAT(a, b) a##b
+#define TRACE_SCOPE_VARIABLE(line) TRACE_SCOPE_CONCAT(traceScope, line)
+#define TRACE_SCOPE_EXPAND(x) x
+#define TRACE_SCOPE_SELECT(_1, _2, macro, ...) macro
+#define TRACE_SCOPE_NAME(name) TraceScope TRACE_SCOPE_VARIABLE(__LINE__)(name)
+#define TRACE_SCOPE_DETAIL(name, detail) TraceScope TRACE_SCOPE_VARIABLE(__LINE__)(name, [&]() { return QString(detail); })
+
+// Traces the enclosing scope, TRACE_SCOPE("Stage") or TRACE_SCOPE("Stage", fileName). The detail is only evaluated when
+// tracing is enabled.
+#define TRACE_SCOPE(...) TRACE_SCOPE_EXPAND(TRACE_SCOPE_SELECT(__VA_ARGS__, TRACE_SCOPE_DETAIL, TRACE_SCOPE_NAME)(__VA_ARGS__))
@@ -0,0 +1,98 @@
+// Checks the transform pipeline of MatrixDataLoader against a reference that applies every transform to the whole
+// matrix in turn, with the statistics of the values right before it. Exits with 1 on a mismatch.
+
+#include "MatrixData.h"
+#include "MatrixTransforms.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+    constexpr size_t NUM_ROWS = 500;
+    constexpr size_t NUM_COLS = 7;
+    constexpr float TOLERANCE = 1e-3f;
+
+    MatrixData makeMatrix()
+    {
+        std::mt19937 random(1);
+        std::gamma_distribution<float> counts(2.0f, 3.0f);
+
+        MatrixData matrix;
+        matrix.numRows = NUM_ROWS;
+        matrix.numCols = NUM_COLS;
+        matrix.data.resize(NUM_ROWS * NUM_COLS);
+        for (size_t i = 0; i < matrix.data.size(); i++)
+            matrix.data[i] = (i % 11 == 0) ? MISSING_VALUE : counts(random) * (1 + i % NUM_COLS);
+        return matrix;
+    }
+
+    // Runs the pipeline the way MatrixDataLoader does while parsing
+    MatrixData applyPipeline(TransformPipeline pipeline, const MatrixData& input)
+    {
+        MatrixData matrix = input;
+        pipeline.begin(matrix.numCols);
+        for (size_t row = 0; row < matrix.numRows; row++)
+            pipeline.transformRow(matrix.data.data() + row * matrix.numCols);
+        pipeline.finish(matrix);
+        return matrix;
+    }
+
+    MatrixData applyReference(const std::vector<MatrixTransform>& transforms, const MatrixData& input)
+    {
+        MatrixData matrix = input;
+        for (const MatrixTransform& transform : transforms)
+        {
+            ColumnStatistics stats = matrix.computeColumnStatistics();
+            std::vector<float> means = stats.means();
+            std::vector<float> invStdDevs = stats.stdDevs();
+            for (float& v : invStdDevs)
+                v = v != 0 ? 1.0f / v : 1.0f;
+
+            for (size_t row = 0; row < matrix.numRows; row++)
+                transform.applyToRow(matrix.data.data() + row * matrix.numCols, matrix.numCols, means.data(), invStdDevs.data());
+        }
+        return matrix;
+    }
+
+    bool check(const char* name, const std::vector<MatrixTransform>& transforms)
+    {
+        TransformPipeline pipeline;
+        for (const MatrixTransform& transform : transforms)
+            pipeline.add(transform);
+
+        const MatrixData input = makeMatrix();
+        const MatrixData result = applyPipeline(pipeline, input);
+        const MatrixData expected = applyReference(transforms, input);
+
+        float maxError = 0;
+        for (size_t i = 0; i < result.data.size(); i++)
+            maxError = std::max(maxError, std::abs(result.data[i] - expected.data[i]));
+
+        if (maxError > TOLERANCE)
+        {
+            qCritical() << name << "differs from the reference by" << maxError;
+            return false;
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    bool passed = true;
+
+    passed &= check("Log-normalize", { MatrixTransform::libraryNormalize(1e4f), MatrixTransform::log1p() });
+    passed &= check("Log-normalize and scale", { MatrixTransform::libraryNormalize(1e4f), MatrixTransform::log1p(), MatrixTransform::zScore() });
+
+    // Column transforms after the first one need the statistics of the values before them
+    passed &= check("Scale, clip and scale", { MatrixTransform::zScore(), MatrixTransform::clip(-1.0f, 0.5f), MatrixTransform::zScore() });
+    passed &= check("Scale, shift, log and scale", { MatrixTransform::log1p(), MatrixTransform::zScore(), MatrixTransform::clip(0.0f, 2.0f), MatrixTransform::log1p(), MatrixTransform::zScore() });
+    passed &= check("Scale twice", { MatrixTransform::zScore(), MatrixTransform::zScore() });
+
+    return passed ? 0 : 1;
+}